@@ -0,0 +1,30 @@
+#pragma once
+#include <precomp.h>
+#include <AppBase.h>
+#include <Scene.h>
+
+// On-disk store of serialized (vkCmdCopyAccelerationStructureToMemoryKHR) bottom level
+// acceleration structures. Entries are keyed by the mesh contents, the build flags and the
+// identity of the device and driver, so a driver update simply results in cache misses.
+class ASCache {
+public:
+    ASCache(AppBase& app, const char* directory);
+
+    uint64_t Key(const GLTFMesh& mesh, vk::BuildAccelerationStructureFlagsKHR flags) const;
+    // returns the serialized structure, or nothing when absent or incompatible with the driver
+    std::optional<std::vector<uint8_t>> Load(uint64_t key);
+    void Store(uint64_t key, const void* data, size_t size);
+
+    // the size to create the destination structure with, read from the serialization header
+    static vk::DeviceSize DeserializedSize(const std::vector<uint8_t>& data);
+
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+
+private:
+    AppBase& app;
+    std::filesystem::path directory;
+    uint64_t device_hash;
+
+    std::filesystem::path entryPath(uint64_t key) const;
+};
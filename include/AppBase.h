@@ -1,10 +1,13 @@
 #pragma once
 #include <precomp.h>
+#include <Uploader.h>
+#include <ThreadPool.h>
 
 template<typename T>
 struct vk_init {
     static void AddDeviceExtensions(std::vector<const char*>& exts);
     static void* EnableDeviceProperties(void* head);
+    // optional, static void RestrictToDevice(vk::PhysicalDevice) clears the requested features the picked device lacks
 };
 
 class AppBase : public NoCopy {
@@ -19,10 +22,20 @@ public:
     vk::DescriptorPool vk_descriptor_pool;
     vk::DispatchLoaderDynamic vk_ext_dispatcher;
     vk::Sampler vk_default_sampler;
+    std::unique_ptr<Uploader> uploader;
+    // shared CPU workers for loading and building, only wait on it from the main thread
+    std::unique_ptr<ThreadPool> thread_pool;
 
     virtual void Init();
     vk::CommandBuffer MakeGraphicsCommandBuffer();
     void WithSingleTimeCommandBuffer(std::function<void(vk::CommandBuffer)> record);
+
+    // one-shot command buffers are recycled once their fence has signaled
+    vk::CommandBuffer AcquireSingleTimeCommandBuffer();
+    SubmissionID SubmitSingleTimeCommandBuffer(vk::CommandBuffer cmdBuffer);
+    SubmissionID SubmitSingleTimeCommandBuffer(std::function<void(vk::CommandBuffer)> record);
+    bool IsSubmissionDone(SubmissionID id);
+    void WaitForSubmission(SubmissionID id);
     vk::ShaderModule LoadShader(const std::string& filename);
     AppBase() = default;
     virtual ~AppBase();
@@ -31,6 +44,9 @@ public:
     void Require() {
         vk_init<T>::AddDeviceExtensions(device_extensions);
         this->enabled_device_features = vk_init<T>::EnableDeviceProperties(enabled_device_features);
+        if constexpr (requires(vk::PhysicalDevice device) { vk_init<T>::RestrictToDevice(device); }) {
+            device_restrictions.push_back(&vk_init<T>::RestrictToDevice);
+        }
     }
 
 protected:
@@ -38,10 +54,25 @@ protected:
     std::vector<const char*> device_extensions;
     std::vector<const char*> validation_layers;
     void* enabled_device_features{};
+    // run once the physical device is picked, before the device is created with enabled_device_features
+    std::vector<void(*)(vk::PhysicalDevice)> device_restrictions;
 
     virtual void onQueueCreateInfo(std::vector<vk::DeviceQueueCreateInfo>& queueInfos) { throw std::runtime_error("no override"); };
 
 private:
+    struct SingleTimeSubmission {
+        vk::CommandBuffer cmdBuffer;
+        vk::Fence fence;
+        SubmissionID id;
+    };
+    std::deque<SingleTimeSubmission> pending_submissions;
+    std::vector<SingleTimeSubmission> recording_submissions;
+    std::vector<SingleTimeSubmission> free_submissions;
+    SubmissionID next_submission_id = 1;
+    SubmissionID completed_submission_id = 0;
+
+    void recycleSubmissions(SubmissionID waitFor);
+
     void createInstance();
     void pickPhysicalDevice();
     void findQueueFamilies();
@@ -50,4 +81,6 @@ private:
     void allocateDescriptorPool();
     void initVMA();
     void createSampler();
+    void createUploader();
+    void createThreadPool();
 };
@@ -18,10 +18,14 @@ namespace buffertools {
     Buffer CreateBufferD(AppBase& app, vk::BufferUsageFlags usage, size_t size);
     Buffer CreateBufferD(AppBase& app, vk::BufferUsageFlags usage, size_t size, void* data);
 
+    Buffer CreateBufferD2H(AppBase& app, vk::BufferUsageFlags usage, size_t size);
+
     uint64_t GetBufferDeviceAddress(AppBase& app, const Buffer& buffer);
 
     void* MapBuffer(AppBase& app, Buffer buffer);
     void UnmapBuffer(AppBase& app, Buffer buffer);
+    // makes host writes to a mapped range visible to the device, a no-op on coherent memory
+    void FlushBuffer(AppBase& app, Buffer buffer, vk::DeviceSize offset, vk::DeviceSize size);
 
 
     void DestroyBuffer(AppBase& app, Buffer& buffer);
@@ -3,7 +3,8 @@
 
 class Camera {
 public:
-    Camera(GLFWwindow* window);
+    // without a window the camera only moves when eye, theta and phi are set directly
+    Camera(GLFWwindow* window = nullptr);
 
     void update(float dt);
     glm::vec3 getViewDir() const;
@@ -12,6 +13,8 @@ public:
 
     glm::vec3 eye;
     float theta, phi;
+    // vertical, in degrees
+    float fov = 50.0f;
 private:
     GLFWwindow* window;
     bool hasMoved = false;
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <precomp.h>
+#include <AppBase.h>
+
+// single compute shader with one descriptor set and an optional push constant block
+class ComputePipeline {
+public:
+    vk::PipelineLayout layout;
+    vk::DescriptorSetLayout descriptorSetLayout;
+    vk::Pipeline pipeline;
+
+    // every binding is visible to the compute stage, the shader module is destroyed once the pipeline exists
+    ComputePipeline(AppBase& app, const std::string& shader, const std::vector<vk::DescriptorSetLayoutBinding>& bindings, uint32_t pushConstantSize = 0);
+    void Destroy(const AppBase& app);
+
+    vk::DescriptorSet AllocateDescriptor(const AppBase& app) const;
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <precomp.h>
+
+// Non cryptographic 64 bit hashing used to key the on-disk caches.
+namespace hash {
+    constexpr uint64_t SEED = 0x9E3779B97F4A7C15ull;
+
+    inline uint64_t Mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    inline uint64_t Combine(uint64_t seed, uint64_t value) {
+        return Mix(seed ^ (value + SEED + (seed << 6) + (seed >> 2)));
+    }
+
+    inline uint64_t Bytes(const void* data, size_t size, uint64_t seed = SEED) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+        uint64_t h = seed ^ (size * 0x87c37b91114253d5ull);
+
+        size_t i = 0;
+        for(; i + 8 <= size; i += 8) {
+            uint64_t word;
+            memcpy(&word, bytes + i, 8);
+            h = (h ^ Mix(word)) * 0x4cf5ad432745937full;
+        }
+
+        uint64_t tail = 0;
+        if (i < size) {
+            memcpy(&tail, bytes + i, size - i);
+        }
+        h = (h ^ Mix(tail)) * 0x4cf5ad432745937full;
+        return Mix(h);
+    }
+
+    template<typename T>
+    inline uint64_t Span(std::span<const T> data, uint64_t seed = SEED) {
+        return Bytes(data.data(), data.size_bytes(), seed);
+    }
+}
@@ -2,6 +2,8 @@
 #include <precomp.h>
 #include <AppBase.h>
 #include <BufferTools.h>
+#include <TextureTools.h>
+#include <stb_image_write.h>
 
 struct Image {
     vk::Image handle;
@@ -9,9 +11,16 @@ struct Image {
     VmaAllocation allocation{};
 };
 
+// RGBA32F pixels on the host, rows top to bottom
+struct HostImage {
+    uint32_t width;
+    uint32_t height;
+    std::vector<float> pixels;
+};
+
 namespace ImageTools {
-    inline Image CreateImageD(AppBase& app, uint32_t width, uint32_t height, vk::ImageUsageFlags usage, vk::Format format, vk::ImageLayout initialLayout) {
-        auto createInfo = static_cast<VkImageCreateInfo>(vk::inits::imageCreateInfo(width, height, format, usage, vk::ImageLayout::eUndefined));
+    inline Image CreateImageD(AppBase& app, uint32_t width, uint32_t height, vk::ImageUsageFlags usage, vk::Format format, vk::ImageLayout initialLayout, uint32_t mipLevels = 1) {
+        auto createInfo = static_cast<VkImageCreateInfo>(vk::inits::imageCreateInfo(width, height, format, usage, vk::ImageLayout::eUndefined, mipLevels));
         VmaAllocationCreateInfo allocInfo { .usage = VMA_MEMORY_USAGE_GPU_ONLY };
         VkImage c_handle;
         
@@ -20,12 +29,35 @@ namespace ImageTools {
 
         auto handle = vk::Image(c_handle);
 
-        app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
-            auto range = vk::inits::imageSubresourceRange(vk::ImageAspectFlagBits::eColor);
-            vk::tools::insertImageMemoryBarrier(cmdBuffer, handle, vk::AccessFlagBits::eMemoryRead, vk::AccessFlagBits::eMemoryWrite, vk::ImageLayout::eUndefined, initialLayout, vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eBottomOfPipe, range);
-        });
+        app.uploader->TransitionImage(handle, vk::ImageLayout::eUndefined, initialLayout, mipLevels);
+
+        auto viewInfo = vk::inits::imageViewCreateInfo(handle, vk::ImageAspectFlagBits::eColor, format, mipLevels);
+
+        return Image {
+            .handle = handle,
+            .view = app.vk_device.createImageView(viewInfo),
+            .allocation = allocation,
+        };
+    }
+
+    // layers of the same size behind a single e2DArray view, so shaders see an image2DArray even for one layer
+    inline Image CreateImageArrayD(AppBase& app, uint32_t width, uint32_t height, uint32_t layers, vk::ImageUsageFlags usage, vk::Format format, vk::ImageLayout initialLayout) {
+        auto imageInfo = vk::inits::imageCreateInfo(width, height, format, usage, vk::ImageLayout::eUndefined);
+        imageInfo.arrayLayers = layers;
+        auto createInfo = static_cast<VkImageCreateInfo>(imageInfo);
+        VmaAllocationCreateInfo allocInfo { .usage = VMA_MEMORY_USAGE_GPU_ONLY };
+        VkImage c_handle;
+
+        VmaAllocation allocation;
+        VK_CHECK_RESULT(vmaCreateImage(app.vma_allocator, &createInfo, &allocInfo, &c_handle, &allocation, nullptr));
+
+        auto handle = vk::Image(c_handle);
+
+        app.uploader->TransitionImage(handle, vk::ImageLayout::eUndefined, initialLayout);
 
         auto viewInfo = vk::inits::imageViewCreateInfo(handle, vk::ImageAspectFlagBits::eColor, format);
+        viewInfo.viewType = vk::ImageViewType::e2DArray;
+        viewInfo.subresourceRange.layerCount = layers;
 
         return Image {
             .handle = handle,
@@ -37,21 +69,28 @@ namespace ImageTools {
     inline Image CreateImageD(AppBase& app, uint32_t width, uint32_t height, vk::ImageUsageFlags usage, vk::Format format, vk::ImageLayout initialLayout, void* data, size_t stride = 4) {
         auto ret = CreateImageD(app, width, height, usage | vk::ImageUsageFlagBits::eTransferDst, format, vk::ImageLayout::eTransferDstOptimal);
 
-        const size_t imageSize = width * height * stride;
-        auto staging = buffertools::CreateBufferH(app, vk::BufferUsageFlagBits::eTransferSrc, imageSize, data);
-
-        app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
-            auto copyRegion = vk::inits::imageCopy(width, height);
-            cmdBuffer.copyBufferToImage(staging.handle, ret.handle, vk::ImageLayout::eTransferDstOptimal, copyRegion);
-            vk::tools::insertImageMemoryBarrier(cmdBuffer, ret.handle, vk::AccessFlagBits::eMemoryRead, vk::AccessFlagBits::eMemoryWrite, vk::ImageLayout::eTransferDstOptimal, initialLayout, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTopOfPipe, vk::inits::imageSubresourceRange(vk::ImageAspectFlagBits::eColor));
-        });
+        app.uploader->UploadImage(ret.handle, width, height, stride, data, initialLayout);
+        return ret;
+    }
 
-        buffertools::DestroyBuffer(app, staging);
+    // data holds every mip level tightly packed after each other, as produced by texturetools
+    inline Image CreateImageMipsD(AppBase& app, uint32_t width, uint32_t height, uint32_t mipLevels, vk::ImageUsageFlags usage, vk::Format format, vk::ImageLayout initialLayout, const void* data) {
+        auto ret = CreateImageD(app, width, height, usage | vk::ImageUsageFlagBits::eTransferDst, format, vk::ImageLayout::eTransferDstOptimal, mipLevels);
+
+        const auto [blockExtent, blockSize] = texturetools::BlockInfo(format);
+        const uint8_t* level = reinterpret_cast<const uint8_t*>(data);
+        for(uint32_t mip=0; mip<mipLevels; mip++) {
+            app.uploader->UploadImageLevel(ret.handle, mip, width, height, blockExtent, blockSize, level);
+            level += texturetools::LevelSize(format, width, height);
+            width = std::max(width / 2, 1u);
+            height = std::max(height / 2, 1u);
+        }
 
+        app.uploader->FinishImage(ret.handle, initialLayout, mipLevels);
         return ret;
     }
 
-    inline Image LoadImageD(AppBase& ctx, vk::ImageLayout initialLayout, vk::ImageUsageFlagBits usage, const char* filename) {
+    inline HostImage LoadImageH(const char* filename) {
         int width, height, nrChannels;
         float* pixels = stbi_loadf(filename, &width, &height, &nrChannels, STBI_rgb_alpha);
         if (!pixels) {
@@ -61,19 +100,52 @@ namespace ImageTools {
 
         assert(nrChannels >= 3 && "Image loading should produce a 4 channel buffer");
 
-        std::vector<float> data(width*height*4);
+        HostImage ret {
+            .width = static_cast<uint32_t>(width),
+            .height = static_cast<uint32_t>(height),
+            .pixels = std::vector<float>(width*height*4),
+        };
         for(size_t i=0; i<width*height; i++) {
-            data[4*i+0] = pixels[4*i+0];
-            data[4*i+1] = pixels[4*i+1];
-            data[4*i+2] = pixels[4*i+2];
-            data[4*i+3] = 1.0f;
+            ret.pixels[4*i+0] = pixels[4*i+0];
+            ret.pixels[4*i+1] = pixels[4*i+1];
+            ret.pixels[4*i+2] = pixels[4*i+2];
+            ret.pixels[4*i+3] = 1.0f;
         }
         stbi_image_free(pixels);
-
-        auto ret = CreateImageD(ctx, width, height, usage, vk::Format::eR32G32B32A32Sfloat, initialLayout, data.data(), 4 * sizeof(float));
         return ret;
     }
 
+    // .hdr keeps the linear values, .png is tonemapped and gamma corrected the same way triangle.frag shows the image
+    inline void WriteImageH(const std::filesystem::path& filename, const HostImage& image, float exposure = 3.0f) {
+        const int width = static_cast<int>(image.width);
+        const int height = static_cast<int>(image.height);
+        int written = 0;
+        if (filename.extension() == ".hdr") {
+            written = stbi_write_hdr(filename.string().c_str(), width, height, 4, image.pixels.data());
+        } else if (filename.extension() == ".png") {
+            std::vector<uint8_t> bytes(image.pixels.size());
+            for(size_t i=0; i<bytes.size(); i++) {
+                const float mapped = i % 4 == 3 ? 1.0f : std::pow(1.0f - std::exp(-image.pixels[i] * exposure), 1.0f / 2.2f);
+                bytes[i] = static_cast<uint8_t>(std::clamp(mapped, 0.0f, 1.0f) * 255.0f + 0.5f);
+            }
+            written = stbi_write_png(filename.string().c_str(), width, height, 4, bytes.data(), width * 4);
+        } else {
+            throw std::runtime_error(fmt::format("Cannot write {}, only .hdr and .png are supported", filename.string()));
+        }
+
+        if (!written) {
+            throw std::runtime_error(fmt::format("Could not write image {}", filename.string()));
+        }
+    }
+
+    inline Image LoadImageD(AppBase& ctx, vk::ImageLayout initialLayout, vk::ImageUsageFlagBits usage, const HostImage& image) {
+        return CreateImageD(ctx, image.width, image.height, usage, vk::Format::eR32G32B32A32Sfloat, initialLayout, (void*)image.pixels.data(), 4 * sizeof(float));
+    }
+
+    inline Image LoadImageD(AppBase& ctx, vk::ImageLayout initialLayout, vk::ImageUsageFlagBits usage, const char* filename) {
+        return LoadImageD(ctx, initialLayout, usage, LoadImageH(filename));
+    }
+
     inline void DestroyImage(AppBase& app, Image& image) {
         app.vk_device.destroyImageView(image.view);
         vmaDestroyImage(app.vma_allocator, image.handle, image.allocation);
@@ -0,0 +1,34 @@
+#pragma once
+#include <precomp.h>
+#include <Scene.h>
+
+// emissive triangle in world space, picked through the alias table and then sampled uniformly by area
+struct LightTriangle {
+    glm::vec3 v0;
+    MaterialID material_id;
+    glm::vec3 v1;
+    // density per unit area of sampling a point on this triangle, only depends on its material's emission
+    float area_pdf;
+    glm::vec3 v2;
+    float padding;
+};
+
+// Vose alias table entry, keep this slot with the given probability and take alias otherwise
+struct AliasEntry {
+    float probability;
+    uint32_t alias;
+};
+
+// CPU side preparation of the light sampling data for next event estimation.
+namespace lighttools {
+    float Luminance(glm::vec3 color);
+    // luminance of what a material emits as a light, translucent emitters are left to bsdf sampling and count as zero
+    float EmittedLuminance(const GLTFMaterial& material);
+    // every triangle of every instance whose material emits light, area_pdf is left for the caller
+    std::vector<LightTriangle> EmissiveTriangles(const Scene& scene);
+    float Area(const LightTriangle& triangle);
+    // per texel weights for sampling a lat-long environment by luminance, rows are scaled by sin(theta) for the solid angle they cover
+    std::vector<float> EnvironmentWeights(const float* rgba, uint32_t width, uint32_t height);
+    // samples slot i with probability weights[i] / sum(weights)
+    std::vector<AliasEntry> BuildAliasTable(const std::vector<float>& weights);
+}
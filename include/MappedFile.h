@@ -0,0 +1,21 @@
+#pragma once
+#include <precomp.h>
+
+// Read only memory mapping of a whole file, pages are faulted in on first access.
+class MappedFile : public NoCopy {
+public:
+    explicit MappedFile(const std::filesystem::path& path);
+    ~MappedFile();
+
+    const uint8_t* Data() const { return data; }
+    size_t Size() const { return size; }
+
+    template<typename T>
+    std::span<const T> View(uint64_t offset, uint64_t count) const {
+        return std::span<const T>(reinterpret_cast<const T*>(data + offset), count);
+    }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include <precomp.h>
+#include <Scene.h>
+
+// Material tweaks read from a JSON file and applied on top of the materials a scene loaded with.
+// The file is watched, every change re-applies all overrides to the original values so removing
+// an entry restores the material. Format:
+//
+//   { "overrides": [
+//       { "material": 12, "roughness": 0.4 },
+//       { "mesh": -1, "primitive": 8, "diffuse_color": [null, null, null, 0], "glass": [0, 0, 0, 1.46] }
+//   ] }
+//
+// An entry selects a material by index or through a primitive of a mesh, negative mesh indices
+// count from the last mesh. Every GLTFMaterial field except the texture ids can be set, vectors
+// with three components keep the original w and null components keep their original value.
+class MaterialOverrides : public NoCopy {
+public:
+    // snapshots scene.materials as the base the overrides are applied to
+    MaterialOverrides(Scene& scene, std::filesystem::path path);
+
+    // re-applies the overrides when the file changed, returns true when scene.materials was modified
+    bool Poll();
+
+private:
+    Scene& scene;
+    std::filesystem::path path;
+    std::vector<GLTFMaterial> base_materials;
+    std::filesystem::file_time_type last_write_time{};
+    std::chrono::steady_clock::time_point last_poll{};
+    bool applied = false;
+
+    bool apply();
+};
@@ -0,0 +1,16 @@
+#pragma once
+#include <precomp.h>
+#include <Vertex.h>
+
+// CPU side mesh preprocessing on a single primitive's full precision vertices and indices.
+// Everything works in place and is independent per primitive so callers can spread it over threads.
+namespace meshtools {
+    // merges bitwise identical vertices and rewrites the indices to match
+    void Weld(std::vector<GLTFVertex>& vertices, std::vector<uint32_t>& indices);
+    // orders triangles along a Morton curve through their centroids so neighbours share cache lines
+    void SortTriangles(const std::vector<GLTFVertex>& vertices, std::vector<uint32_t>& indices);
+    // renumbers vertices in the order the indices first reference them and drops unreferenced ones
+    void RemapFirstUse(std::vector<GLTFVertex>& vertices, std::vector<uint32_t>& indices);
+    // Weld, SortTriangles and RemapFirstUse in that order
+    void Optimize(std::vector<GLTFVertex>& vertices, std::vector<uint32_t>& indices);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <precomp.h>
+#include <AppBase.h>
+#include <Camera.h>
+
+// A single headless render, read from the command line or a JSON job file. Format:
+//
+//   { "scene": "models/bistro.glb", "output": "bistro.hdr", "materials": "materials.json",
+//     "width": 1920, "height": 1080, "eye": [-5, 5, 0], "theta": 1.57, "phi": 0, "fov": 50,
+//     "spp": 1024, "seconds": 60 }
+//
+// Tracing stops at whichever of spp and seconds is reached first, 0 disables either. The output
+// extension picks the format, .hdr keeps the linear radiance and .png is tonemapped for display.
+// "cameras": [{ "eye": [0, 1, 0], "phi": 1.57 }, ...] traces several views in a single launch instead,
+// each starting from the values above, and writes view i to the output with _i before the extension.
+struct OfflineJob {
+    std::string scene = "models/bistro.glb";
+    std::string output = "render.png";
+    std::string materials = "materials.json";
+    uint32_t width = 1920;
+    uint32_t height = 1080;
+    glm::vec3 eye = glm::vec3(-5, 5, 0);
+    float theta = glm::pi<float>() / 2.0f;
+    float phi = 0;
+    float fov = 50.0f;
+    // empty renders the single camera above
+    std::vector<Camera> cameras;
+    uint32_t spp = 256;
+    double seconds = 0;
+
+    // fields the file does not mention keep their current value
+    void Load(const std::filesystem::path& path);
+    // same for a job given as JSON text, throws std::runtime_error when it is malformed
+    void Parse(const std::string& text);
+
+    std::vector<Camera> Cameras() const;
+    std::filesystem::path OutputPath(uint32_t camera) const;
+};
+
+// Vulkan without a window, surface or swapchain, only the graphics queue AppBase creates is used. Nothing here
+// touches GLFW, so it runs on display-less machines and on software drivers such as lavapipe.
+class OfflineApp : public AppBase {
+protected:
+    virtual void onQueueCreateInfo(std::vector<vk::DeviceQueueCreateInfo>& queueInfos) override {}
+};
@@ -7,33 +7,93 @@
 #include <ImageTools.h>
 #include <Scene.h>
 #include <Camera.h>
+#include <ASCache.h>
+#include <LightTools.h>
+#include <ComputePipeline.h>
 
 struct RTXAccelerationStructure {
     vk::AccelerationStructureKHR handle;
     Buffer buffer;
 };
 
-struct InstanceData {
+// device side of a GLTFMesh, one BLAS shared by every instance of the mesh
+struct MeshData {
     std::vector<GLTFPrimitive> primitives;
     Buffer vertex_buffer;
     Buffer index_buffer;
-    Buffer transformation_buffer;
+    // dequantizes positions during BLAS builds so the structure ends up in mesh space
+    vk::TransformMatrixKHR position_transform;
+    Buffer transform_buffer;
     RTXAccelerationStructure acceleration_structure;
     uint32_t geometry_offset;
 };
 
-struct UniformData {
+// in-progress bottom level build, geometries and ranges are owned here so build_info can point at them
+struct BLASBuild {
+    std::vector<vk::AccelerationStructureGeometryKHR> geometries;
+    std::vector<vk::AccelerationStructureBuildRangeInfoKHR> ranges;
+    vk::AccelerationStructureBuildGeometryInfoKHR build_info;
+    vk::AccelerationStructureBuildSizesInfoKHR sizes;
+    RTXAccelerationStructure structure;
+    uint32_t triangle_count = 0;
+    uint32_t mesh_id = 0;
+    uint64_t cache_key = 0;
+    vk::AccelerationStructureBuildTypeKHR build_type = vk::AccelerationStructureBuildTypeKHR::eDevice;
+};
+
+// cameras one launch can trace, keep MAX_CAMERAS in common.glsl in sync
+constexpr uint32_t MAX_CAMERAS = 32;
+
+struct CameraData {
     glm::mat4 proj;
     glm::mat4 projInverse;
     glm::mat4 view;
     glm::mat4 viewInverse;
     glm::vec4 viewDirection;
-    float time;
-    uint32_t tick;
+};
+
+// state shared by every launch recorded for a frame, what changes from launch to launch is pushed as LaunchConstants
+struct UniformData {
+    // zero disables next event estimation
+    uint32_t light_count;
+    // non zero to sample the skybox directly next to the emissive triangles
+    uint32_t environment_sampling;
+    SampleSequence sample_sequence;
+    // std140 starts the camera array on 16 bytes
+    uint32_t padding;
+    // indexed by the depth of the launch, only the launched cameras are written
+    CameraData cameras[MAX_CAMERAS];
+};
+
+// one record per primitive of every mesh, indexed by gl_InstanceCustomIndexEXT + gl_GeometryIndexEXT in hit.rchit
+struct GeometryInfo {
+    // device addresses of the primitive's first vertex and first index
+    uint64_t vertex_address;
+    uint64_t index_address;
+    glm::vec4 position_scale;
+    glm::vec4 position_offset;
+    uint32_t index_size;
+    uint32_t material_id;
+    // LightTriangle::area_pdf of the primitive's triangles, zero when it is not in the light table
+    float light_pdf;
+    uint32_t padding;
+};
+
+// written by convergence.comp, reset before every pass
+struct ConvergenceStats {
+    uint32_t converged_tiles;
+    // samples per pixel the slowest tile still needs, assuming its error keeps falling with the square root of the sample count
+    uint32_t remaining_samples;
 };
 
 class RTX {
 public:
+    static constexpr vk::BuildAccelerationStructureFlagsKHR BLAS_BUILD_FLAGS = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction;
+    // keep in sync with common.glsl and the workgroup size of convergence.comp
+    static constexpr uint32_t CONVERGENCE_TILE_SIZE = 16;
+    // samples per pixel between two convergence passes
+    static constexpr uint32_t CONVERGENCE_INTERVAL = 16;
+
     vk::PipelineLayout pipeline_layout;
     vk::DescriptorSetLayout descr_layout;
     vk::Pipeline pipeline;
@@ -41,10 +101,50 @@ public:
     vk::PhysicalDeviceAccelerationStructureFeaturesKHR acceleration_structure_features;
     Image storage_image;
     vk::DescriptorSet descriptor_set;
+    // totals of the last device BLAS build, for benchmarks
+    struct {
+        double build_ms = 0;
+        vk::DeviceSize compacted_bytes = 0;
+    } blas_stats;
 
-    RTX(AppBase& app, Scene& scene, RTXConfig& config);
+    RTX(AppBase& app, Scene& scene, const RTXConfig& config);
     void Destroy();
-    void Record(vk::CommandBuffer cmdBuffer, uint32_t tick, const Camera& camera);
+    // frame is the flight index below RTXConfig::framesInFlight and picks the copy of the uniforms to write. Ticks 0 and 1
+    // restart the accumulation, with reproject what was accumulated for the previous view is carried over to this one
+    // wherever the first hits agree.
+    void Record(vk::CommandBuffer cmdBuffer, uint32_t frame, uint32_t tick, const Camera& camera, bool reproject = false) {
+        Record(cmdBuffer, frame, tick, std::span(&camera, 1), reproject);
+    }
+    // traces every camera in the same launch into its own layer of the storage image, at most RTXConfig::cameraCount.
+    // Only a single camera is reprojected.
+    void Record(vk::CommandBuffer cmdBuffer, uint32_t frame, uint32_t tick, std::span<const Camera> cameras, bool reproject = false);
+    // takes effect with the next Record, restart the accumulation when changing it
+    void SetEnvironmentSampling(bool enabled) { config.environmentSampling = enabled; }
+    void SetSampleSequence(SampleSequence sequence) { config.sampleSequence = sequence; }
+    void SetSamplesPerLaunch(uint32_t samples) { config.samplesPerLaunch = std::max(samples, 1u); }
+    // recreates the images sized to the output and its layers, waits for the device and leaves the acceleration
+    // structures alone. The accumulation is lost, so the next Record has to restart it. Throws when the size is beyond
+    // the device limits or its memory, the images then keep their old size.
+    void Resize(uint32_t width, uint32_t height, uint32_t cameraCount);
+    // copies scene.materials into the next material slot on the following Record, no acceleration structure is touched.
+    // Edits that change what a material emits rebuild the light tables, which waits for the device.
+    void UpdateMaterials();
+    // builds every BLAS once on the device and once on the host and logs both timings
+    void BenchmarkBLASBuilds();
+    // traces frames launches back to back and returns the primary rays per second, accumulation restarts once when
+    // firstTick is 0 or 1 and continues from an earlier call otherwise
+    double BenchmarkTrace(const Camera& camera, uint32_t frames, uint32_t firstTick = 0) {
+        return BenchmarkTrace(std::span(&camera, 1), frames, firstTick);
+    }
+    double BenchmarkTrace(std::span<const Camera> cameras, uint32_t frames, uint32_t firstTick = 0);
+    // copies the accumulation image back to the host, expects it in eShaderReadOnlyOptimal. Every layer is returned,
+    // one after the other.
+    std::vector<glm::vec4> ReadStorageImage();
+    // convergence as of the last frame recorded with this flight index, all zero until a pass has run. Only read it
+    // once that frame's fence has signaled, e.g. right after the window handed the slot out again.
+    ConvergenceStats Convergence(uint32_t frame);
+    // tiles of the cameras traced by the last launch
+    uint32_t TileCount() const { return resources.tiles_x * resources.tiles_y * resources.active_cameras; }
 
     vk::Sampler CreateStorageImageSampler();
 
@@ -53,11 +153,19 @@ private:
     Scene& scene;
     RTXConfig config;
     std::vector<vk::RayTracingShaderGroupCreateInfoKHR> shader_groups;
+    bool host_build = false;
+    // the launch time pushed to raygen.rgen counts from here, so the renderer does not need GLFW's clock
+    std::chrono::steady_clock::time_point created = std::chrono::steady_clock::now();
+    std::optional<ComputePipeline> convergence_pipeline;
+    vk::DescriptorSet convergence_descriptor_set;
+    std::optional<ComputePipeline> reprojection_pipeline;
+    vk::DescriptorSet reprojection_descriptor_set;
 
 
     struct {
         Buffer raygen;
         uint64_t raygen_address;
+        // the path miss shader followed by the shadow miss shader
         Buffer miss;
         uint64_t miss_address;
         Buffer hit;
@@ -65,21 +173,96 @@ private:
     } binding_table;
 
     struct {
-        std::vector<InstanceData> instances;
+        std::vector<MeshData> meshes;
         std::vector<Image> textures;
         RTXAccelerationStructure top;
+        // one UniformData per frame in flight, bound with a dynamic offset
         Buffer uniform_buffer;
-        UniformData* uniform_buffer_data;
+        uint8_t* uniform_buffer_data;
+        vk::DeviceSize uniform_slot_size;
+        // ring of materialSlots copies of the material table, bound with a dynamic offset
         Buffer material_buffer;
+        uint8_t* material_buffer_data;
+        vk::DeviceSize material_slot_size;
+        uint32_t material_slot = 0;
+        bool materials_dirty = false;
+        Buffer geometry_info_buffer;
+        // emissive triangles and the alias table picking them by power, both hold a dummy entry when there are none
+        Buffer light_buffer;
+        Buffer alias_buffer;
+        uint32_t light_count = 0;
+        float light_power = 0;
+        // EmittedLuminance of every material when the light tables were built
+        std::vector<float> light_emission;
         Image skybox;
+        // alias table over the skybox texels and the probability of each texel, a dummy entry when the sky is black
+        Buffer environment_alias_buffer;
+        Buffer environment_pdf_buffer;
+        bool environment_sampling = false;
+        // Sobol direction numbers and the blue noise tile for SampleSequence::eSobol
+        Buffer sobol_buffer;
+        Buffer blue_noise_buffer;
+        // luminance second moment per pixel, the tiles the raygen still traces and what the last convergence pass counted
+        Image moments_image;
+        Buffer tile_mask_buffer;
+        Buffer convergence_buffer;
+        // a copy of the stats per frame in flight, so the host never reads what the device may be writing
+        Buffer convergence_readback;
+        ConvergenceStats* convergence_data;
+        // cameras of the last launch, the layers the convergence pass looks at
+        uint32_t active_cameras = 1;
+        uint32_t tiles_x;
+        uint32_t tiles_y;
+        // first hit per pixel and copies of the accumulation, its moments and first hits from before the camera moved
+        Image gbuffer_image;
+        Image history_image;
+        Image history_moments_image;
+        Image history_gbuffer_image;
+        // camera of the last Record
+        glm::mat4 previous_view_projection;
+        glm::vec3 previous_eye;
+        // samples per pixel in the current accumulation, when the last convergence pass ran and where its sequence starts
+        uint32_t accumulated_samples = 0;
+        uint32_t convergence_samples = 0;
+        uint32_t sample_offset = 0;
+        // counts the accumulations started from scratch and scrambles the Sobol sequence of each, without it every
+        // restart would replay exactly the samples of the one before
+        uint32_t accumulation = 0;
     } resources;
 
     void getProperties();
     void createBottomLevelAS();
+    BLASBuild prepareBLASBuild(uint32_t meshID, vk::AccelerationStructureBuildTypeKHR buildType);
+    void buildAndCompactBLAS(std::vector<BLASBuild>& builds);
+    void buildBLASHost(std::vector<BLASBuild>& builds);
+    void joinDeferredOperation(vk::DeferredOperationKHR operation);
+    Buffer createASBuffer(vk::DeviceSize size, vk::AccelerationStructureBuildTypeKHR buildType);
+    void deserializeBLAS(const std::vector<std::pair<uint32_t, std::vector<uint8_t>>>& cached);
+    void serializeBLAS(const std::vector<BLASBuild>& builds, ASCache& cache);
     void createTopLevelAS();
     void createMaterialBuffer();
+    void createLightBuffer();
+    void createEnvironment();
+    void createSamplerTables();
+    void createGeometryInfoBuffer();
+    // the light, alias and geometry info buffers, written again whenever the light tables are rebuilt
+    void writeLightDescriptors();
     void createTextureBuffer();
-    void createStorageImage();
+    // the storage image and everything else sized to the output, recreated by Resize
+    void createFrameImages();
+    void destroyFrameImages();
+    // throws when the frame images of that size exceed the device limits
+    void checkFrameSize(uint32_t width, uint32_t height, uint32_t cameraCount) const;
+    // what createFrameImages allocates for a size, and the most a single device local heap still has room for
+    vk::DeviceSize frameImageBytes(uint32_t width, uint32_t height, uint32_t cameraCount) const;
+    vk::DeviceSize deviceMemoryAvailable() const;
+    void writeFrameDescriptors();
+    void createConvergencePass();
+    void recordConvergencePass(vk::CommandBuffer cmdBuffer);
+    void recordConvergenceReadback(vk::CommandBuffer cmdBuffer, uint32_t frame);
+    void createReprojectionPass();
+    void recordHistoryCopy(vk::CommandBuffer cmdBuffer);
+    void recordReprojectionPass(vk::CommandBuffer cmdBuffer, uint32_t uniformOffset);
     void createPipeline();
     void createShaderBindingTable();
     void createDescriptorSet();
@@ -99,10 +282,15 @@ struct vk_init<RTX> {
         exts.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
     }
 
+    static vk::PhysicalDeviceAccelerationStructureFeaturesKHR& AccelerationStructureFeatures() {
+        static vk::PhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures;
+        return accelerationStructureFeatures;
+    }
+
     static void* EnableDeviceProperties(void* head) {
         static vk::PhysicalDeviceBufferDeviceAddressFeatures bufferAddressFeatures;
         static vk::PhysicalDeviceRayTracingPipelineFeaturesKHR pipelineFeatures;
-        static vk::PhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures;
+        auto& accelerationStructureFeatures = AccelerationStructureFeatures();
         static vk::PhysicalDeviceDescriptorIndexingFeatures deviceFeatures;
 
         deviceFeatures.runtimeDescriptorArray = VK_TRUE;
@@ -120,3 +308,24 @@ struct vk_init<RTX> {
         return &accelerationStructureFeatures;
     }
 };
+
+// opt-in for building acceleration structures on the CPU, require it after RTX
+struct RTXHostBuild {};
+
+template <>
+struct vk_init<RTXHostBuild> {
+    static void AddDeviceExtensions(std::vector<const char*>& exts) {}
+
+    static void* EnableDeviceProperties(void* head) {
+        vk_init<RTX>::AccelerationStructureFeatures().accelerationStructureHostCommands = VK_TRUE;
+        return head;
+    }
+
+    // most desktop drivers lack host commands and would fail device creation, RTX then builds on the device
+    static void RestrictToDevice(vk::PhysicalDevice device) {
+        vk::PhysicalDeviceAccelerationStructureFeaturesKHR supported;
+        vk::PhysicalDeviceFeatures2 features { .pNext = &supported };
+        device.getFeatures2(&features);
+        vk_init<RTX>::AccelerationStructureFeatures().accelerationStructureHostCommands = supported.accelerationStructureHostCommands;
+    }
+};
@@ -1,7 +1,32 @@
 #pragma once
 #include <precomp.h>
+#include <SamplerTools.h>
 
 struct RTXConfig {
     uint32_t width;
     uint32_t height;
+    // directory of the serialized BLAS cache, nullptr disables it
+    const char* accelerationStructureCache = "./cache/blas";
+    // build acceleration structures on the CPU with deferred host operations, needs RTXHostBuild
+    bool hostBuild = false;
+    // frames the caller records ahead of the device, each gets its own copy of the uniforms
+    uint32_t framesInFlight = 2;
+    // copies of the material table the device reads from in turn, must exceed the frames in flight
+    uint32_t materialSlots = 3;
+    // sample emissive triangles directly at every diffuse bounce, combined with bsdf sampling through MIS
+    bool nextEventEstimation = true;
+    // also sample the skybox by luminance at every diffuse bounce, only with nextEventEstimation
+    bool environmentSampling = true;
+    SampleSequence sampleSequence = SampleSequence::eSobol;
+    // stop tracing tiles once the relative standard error of every pixel's mean luminance is below convergenceTarget
+    bool adaptiveSampling = true;
+    float convergenceTarget = 0.01f;
+    // samples every pixel gets before its variance estimate is trusted
+    uint32_t convergenceMinSamples = 64;
+    // carry the accumulation over to the new view when the camera moves, instead of starting from one sample
+    bool temporalReprojection = true;
+    // paths traced per pixel in every launch, see SampleBudget for picking it from a frame time
+    uint32_t samplesPerLaunch = 1;
+    // layers of the storage image, the most cameras a single launch can trace, up to MAX_CAMERAS
+    uint32_t cameraCount = 1;
 };
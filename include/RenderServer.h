@@ -0,0 +1,92 @@
+#pragma once
+#include <precomp.h>
+#include <OfflineApp.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// what the render callback of a RenderServer reports for a finished job
+struct RenderResult {
+    // per pixel of every camera
+    uint32_t samples = 0;
+    uint32_t cameras = 1;
+    double trace_seconds = 0;
+};
+
+// Accepts render jobs on a local Unix socket and runs them one at a time on the thread that calls Run, so the
+// scene and acceleration structures stay resident between jobs. Clients write one job per line in the OfflineJob
+// JSON format, fields a job leaves out keep the server's defaults. {"shutdown": true} finishes the queue and stops.
+// Only the user running the server may connect. Outputs are relative paths inside the output directory, and the
+// materials file is the server's, so jobs naming another one are rejected. A client that leaves its replies unread
+// for several seconds is disconnected, so it cannot stall the render thread.
+//
+// Every job is answered on its connection with one JSON object per line, first
+//   { "id": 3, "status": "queued", "queue_depth": 2 }
+// and then once it ran
+//   { "id": 3, "status": "done", "output": "a.png", "samples": 256, "cameras": 1, "queue_ms": 812.0, "render_ms": 2410.5,
+//     "latency_ms": 3222.5, "samples_per_second": 2.2e8, "queue_depth": 1, "jobs_per_minute": 18.4 }
+// or { "id": 3, "status": "error", "error": "..." }. "output" is the path the job gave, relative to the output
+// directory, and a list like ["a_0.png", "a_1.png"] for a job with several cameras.
+class RenderServer : public NoCopy {
+public:
+    RenderServer(std::filesystem::path socketPath, std::filesystem::path outputDirectory, OfflineJob defaults);
+    ~RenderServer();
+
+    // blocks until a shutdown request, calling render for every job in the order they arrived
+    void Run(const std::function<RenderResult(const OfflineJob&)>& render);
+
+private:
+    struct Connection {
+        int fd;
+        // replies come from the render thread and the connection's reader
+        std::mutex write_mutex;
+        // cleared once the client stopped sending, queued jobs keep the connection open for their replies
+        std::atomic<bool> reading = true;
+
+        explicit Connection(int fd) : fd(fd) {}
+        ~Connection();
+        void Send(const std::string& line);
+        // for a caller that already holds write_mutex
+        void SendLocked(const std::string& line);
+    };
+
+    struct QueuedJob {
+        uint64_t id;
+        // job.output is resolved into the output directory, the reply names the files the way the client did
+        OfflineJob job;
+        std::vector<std::string> outputs;
+        std::shared_ptr<Connection> connection;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    std::filesystem::path socket_path;
+    // canonical, every output of a job resolves to somewhere below it
+    std::filesystem::path output_directory;
+    OfflineJob defaults;
+    int listen_fd = -1;
+
+    std::mutex mutex;
+    std::condition_variable job_available;
+    std::deque<QueuedJob> queue;
+    uint64_t next_job_id = 1;
+    bool stopping = false;
+
+    struct Reader {
+        std::shared_ptr<Connection> connection;
+        std::thread thread;
+    };
+
+    std::thread accept_thread;
+    // only touched by the accept thread until it has been joined
+    std::vector<Reader> readers;
+
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    uint64_t jobs_done = 0;
+    double busy_seconds = 0;
+
+    void acceptConnections();
+    void readJobs(std::shared_ptr<Connection> connection);
+    void submit(const std::string& line, const std::shared_ptr<Connection>& connection);
+    // job.output within the output directory, throws std::runtime_error when it would end up outside of it
+    std::string resolveOutput(const std::string& output) const;
+};
@@ -0,0 +1,26 @@
+#pragma once
+#include <precomp.h>
+
+// Picks RTXConfig::samplesPerLaunch so a frame takes about a target time. The cost of a sample is estimated from
+// the measured frame times, so it assumes frames are bound by the trace rather than by vsync.
+class SampleBudget {
+public:
+    // equal bounds fix the samples per launch and only measure the rate
+    SampleBudget(double targetSeconds, uint32_t minSamples = 1, uint32_t maxSamples = 64);
+
+    // takes effect with the next Update
+    void SetTarget(double targetSeconds) { target_seconds = targetSeconds; }
+    // duration of the last frame, which traced SamplesPerLaunch() samples per pixel, returns the samples for the next one
+    uint32_t Update(double frameSeconds);
+    uint32_t SamplesPerLaunch() const { return samples_per_launch; }
+    // smoothed over the last frames
+    double SamplesPerSecond() const { return samples_per_second; }
+
+private:
+    double target_seconds;
+    uint32_t min_samples;
+    uint32_t max_samples;
+    uint32_t samples_per_launch;
+    double seconds_per_sample = 0;
+    double samples_per_second = 0;
+};
@@ -0,0 +1,22 @@
+#pragma once
+#include <precomp.h>
+
+// sequences randf() draws from in raygen.rgen, see shaders/sampler.glsl
+enum class SampleSequence : uint32_t {
+    // xorshift seeded from the pixel, tick and time
+    eRandom,
+    // Owen scrambled Sobol shifted per pixel by a blue noise tile
+    eSobol,
+};
+
+// CPU side tables for the low discrepancy sampler, generated once and uploaded by the RTX.
+namespace samplertools {
+    // sampler.glsl pads every path dimension onto these, keep the constants there in sync
+    constexpr uint32_t SOBOL_DIMENSIONS = 4;
+    constexpr uint32_t BLUE_NOISE_SIZE = 64;
+
+    // 32 direction numbers per dimension, Joe and Kuo's primitive polynomials after van der Corput
+    std::vector<uint32_t> SobolDirections(uint32_t dimensions);
+    // size x size values in (0, 1) with a blue noise spectrum, built with Ulichney's void and cluster method
+    std::vector<float> BlueNoiseTile(uint32_t size);
+}
@@ -2,6 +2,8 @@
 #include <precomp.h>
 #include <AppBase.h>
 #include <Vertex.h>
+#include <MappedFile.h>
+#include <TextureTools.h>
 
 typedef uint32_t MaterialID;
 typedef uint32_t TextureID;
@@ -9,7 +11,15 @@ typedef uint32_t TextureID;
 struct GLTFTexture {
     uint32_t width;
     uint32_t height;
+    // every mip level of format, tightly packed from the largest level down
     std::vector<uint8_t> data;
+    // set instead of data when the texture lives in a mapped scene cache
+    std::span<const uint8_t> mapped_data;
+    vk::Format format = vk::Format::eR8G8B8A8Unorm;
+    uint32_t mip_levels = 1;
+    bool normal_map = false;
+
+    std::span<const uint8_t> Data() const { return data.empty() ? mapped_data : std::span<const uint8_t>(data); }
 };
 
 struct GLTFMaterial {
@@ -24,28 +34,108 @@ struct GLTFMaterial {
 
 struct GLTFPrimitive {
     uint32_t index_count;
+    // in bytes, every primitive's indices start 16 byte aligned
     uint32_t index_offset;
     uint32_t vertex_count;
+    // in vertices of the mesh's layout
     uint32_t vertex_offset;
-    GLTFMaterial material;
-    glm::mat4 transform;
+    // 16 bit whenever the primitive has few enough vertices
+    vk::IndexType index_type;
+    // index into Scene::materials, primitives using the same glTF material share it
+    MaterialID material_id;
+
+    uint32_t IndexSize() const { return index_type == vk::IndexType::eUint16 ? sizeof(uint16_t) : sizeof(uint32_t); }
 };
 
 struct GLTFMesh {
     std::vector<GLTFPrimitive> primitives;
-    std::vector<GLTFVertex> vertices;
-    std::vector<uint32_t> indices;
+    // vertices in the scene's VertexLayout and indices in each primitive's index type
+    std::vector<uint8_t> vertex_data;
+    std::vector<uint8_t> index_data;
+    // set instead of vertex_data and index_data when the mesh lives in a mapped scene cache
+    std::span<const uint8_t> mapped_vertex_data;
+    std::span<const uint8_t> mapped_index_data;
+    // quantized positions decode as pos * position_scale + position_offset, identity otherwise
+    glm::vec3 position_scale = glm::vec3(1);
+    glm::vec3 position_offset = glm::vec3(0);
+
+    std::span<const uint8_t> VertexData() const { return vertex_data.empty() ? mapped_vertex_data : std::span<const uint8_t>(vertex_data); }
+    std::span<const uint8_t> IndexData() const { return index_data.empty() ? mapped_index_data : std::span<const uint8_t>(index_data); }
+};
+
+// a node referencing a mesh, mesh data is shared between all instances of it
+struct GLTFInstance {
+    uint32_t mesh_id;
+    glm::mat4 transform;
 };
 
 class Scene {
 public:
+    // bump whenever the layout of anything written to a .pvscene changes
+    static constexpr uint32_t CACHE_VERSION = 6;
+
     Scene(AppBase& app) : app(app) {}
 
+    // loads from the scene cache when it is up to date, otherwise parses the glTF and refreshes the cache
     void LoadModel(const char* filename, bool binary = false);
+    // frees the host copy of texture pixels once every RTX that needs them has been created. Textures in a mapped
+    // scene cache are left alone, the mapping costs no memory until it is read.
+    void ReleaseTexturePixels();
 
     std::vector<GLTFMesh> meshes;
+    std::vector<GLTFInstance> instances;
     std::vector<GLTFTexture> textures;
+    std::vector<GLTFMaterial> materials;
+
+    // directory of the .pvscene files, nullptr disables the cache
+    const char* cache_directory = "./cache/scenes";
+    // storage of color textures, normal maps use BC5 whenever compression is enabled
+    texturetools::Encoding texture_encoding = texturetools::Encoding::eBC7;
+    // directory of encoded textures keyed by their source pixels, nullptr disables it
+    const char* texture_cache_directory = "./cache/textures";
+    // storage of mesh vertices, eFull keeps the original 32 byte vertices
+    VertexLayout vertex_layout = VertexLayout::eQuantized;
+    // weld vertices and sort triangles spatially for better fetch locality in the hit shader
+    bool optimize_meshes = true;
 
 private:
     AppBase& app;
+    // backing storage of the mapped_* views, alive as long as the scene
+    std::vector<std::unique_ptr<MappedFile>> mapped_files;
+
+    struct LoadRange {
+        uint32_t mesh_offset;
+        uint32_t instance_offset;
+        uint32_t texture_offset;
+        uint32_t material_offset;
+    };
+
+    // texture_encoding, or uncompressed when the device cannot sample BC formats
+    texturetools::Encoding deviceTextureEncoding() const;
+    void loadGLTF(const char* filename, bool binary);
+    bool loadCache(const std::filesystem::path& path, const std::filesystem::path& source);
+    void storeCache(const std::filesystem::path& path, const std::filesystem::path& source, const LoadRange& range) const;
+
+    static glm::mat4 nodeTransform(const tinygltf::Node& node);
+    // textures already created for the glTF being loaded
+    struct TextureCache {
+        // (image, normal map), samplers are not used so textures only differ in how their mips are built
+        std::map<std::pair<int, bool>, TextureID> textures;
+        std::unordered_map<int, TextureID> images;
+        uint32_t references = 0;
+        size_t bytes_saved = 0;
+    };
+
+    // returns the texture for a glTF texture index, creating it on first use
+    TextureID resolveTexture(tinygltf::Model& model, int textureIndex, bool normalMap, TextureCache& cache);
+    // replaces the RGBA8 pixels of a texture with its encoded mip chain, reusing earlier results from disk
+    bool processTexture(GLTFTexture& texture, texturetools::Encoding encoding) const;
+    // returns the material for a glTF material index, creating it and its textures on first use
+    MaterialID resolveMaterial(tinygltf::Model& model, int materialIndex, TextureCache& textureCache, std::unordered_map<int, MaterialID>& materialIDs);
+    // resolves materials and textures and sizes the vertex and index arrays of a mesh
+    GLTFMesh layoutMesh(tinygltf::Model& model, const tinygltf::Mesh& mesh, const char* filename, TextureCache& textureCache, std::unordered_map<int, MaterialID>& materialIDs);
+    // fills in one primitive of a laid out mesh, safe to run concurrently for distinct primitives
+    static void convertPrimitive(const tinygltf::Model& model, const tinygltf::Primitive& primitive, GLTFMesh& mesh, GLTFPrimitive& res, VertexLayout layout, bool optimize);
+    // closes the gaps optimized primitives leave behind in the vertex data
+    static void compactVertices(GLTFMesh& mesh, VertexLayout layout);
 };
@@ -0,0 +1,34 @@
+#pragma once
+#include <precomp.h>
+
+// CPU side texture processing: mip chain generation and block compression of RGBA8 data.
+// Encoders work on one 4x4 block at a time so callers can spread textures over threads.
+namespace texturetools {
+    // how color textures are stored on the GPU, normal maps always use BC5 unless uncompressed
+    enum class Encoding : uint32_t {
+        eUncompressed,
+        // BC1 for opaque textures, BC3 when alpha is used
+        eBC1,
+        // BC7 mode 6 for every color texture
+        eBC7,
+    };
+
+    uint32_t MipLevelCount(uint32_t width, uint32_t height);
+    // bytes of one level of the given format, block formats round up to whole blocks
+    size_t LevelSize(vk::Format format, uint32_t width, uint32_t height);
+    size_t ChainSize(vk::Format format, uint32_t width, uint32_t height, uint32_t mipLevels);
+    // texels per block edge and bytes per block (or texel for uncompressed formats)
+    std::pair<uint32_t, uint32_t> BlockInfo(vk::Format format);
+
+    // full RGBA8 mip chain, color is filtered in linear space, normals are renormalized
+    std::vector<uint8_t> GenerateMips(const uint8_t* rgba, uint32_t width, uint32_t height, bool normalMap);
+    vk::Format ChooseFormat(Encoding encoding, bool normalMap, bool hasAlpha);
+    // encodes a chain produced by GenerateMips into format
+    std::vector<uint8_t> EncodeChain(const std::vector<uint8_t>& chain, uint32_t width, uint32_t height, uint32_t mipLevels, vk::Format format);
+
+    void EncodeBC1Block(const uint8_t block[64], uint8_t out[8]);
+    void EncodeBC3Block(const uint8_t block[64], uint8_t out[16]);
+    void EncodeBC4Block(const uint8_t values[16], uint8_t out[8]);
+    void EncodeBC5Block(const uint8_t block[64], uint8_t out[16]);
+    void EncodeBC7Block(const uint8_t block[64], uint8_t out[16]);
+}
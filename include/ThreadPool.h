@@ -0,0 +1,33 @@
+#pragma once
+#include <precomp.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Fixed set of worker threads draining a shared task queue. The first exception a task throws is rethrown by the
+// next Wait, on the thread waiting for the work.
+class ThreadPool : public NoCopy {
+public:
+    explicit ThreadPool(uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency()));
+    ~ThreadPool();
+
+    void Submit(std::function<void()> task);
+    // blocks until the queue is empty and every worker is idle
+    void Wait();
+    // runs fn(i) for i in [0, count) on the workers and waits for completion
+    void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+    uint32_t Size() const { return static_cast<uint32_t>(workers.size()); }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable task_available;
+    std::condition_variable all_done;
+    uint32_t active = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+
+    void work();
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <precomp.h>
+#include <BufferTools.h>
+
+class AppBase;
+// monotonically increasing handle of a one-shot submission, see AppBase::SubmitSingleTimeCommandBuffer
+typedef uint64_t SubmissionID;
+
+// Gathers host to device transfers into a few large submissions. Data is copied into a
+// persistently mapped ring of staging memory right away, so callers may release their host
+// copy as soon as the upload call returns. Recorded copies are only submitted on Flush(),
+// which the app does before any of its own submissions, so the queue order is preserved.
+class Uploader : public NoCopy {
+public:
+    static constexpr vk::DeviceSize DEFAULT_ARENA_SIZE = 64 * 1024 * 1024;
+
+    Uploader(AppBase& app, vk::DeviceSize arenaSize = DEFAULT_ARENA_SIZE);
+    ~Uploader();
+
+    void UploadBuffer(vk::Buffer dst, const void* data, vk::DeviceSize size, vk::DeviceSize dstOffset = 0);
+    // expects the image to be in eTransferDstOptimal, leaves it in finalLayout
+    void UploadImage(vk::Image dst, uint32_t width, uint32_t height, size_t texelSize, const void* data, vk::ImageLayout finalLayout);
+    // copies one tightly packed mip level, blockExtent is 4 for block compressed formats and 1 otherwise.
+    // Expects eTransferDstOptimal and leaves the layout alone.
+    void UploadImageLevel(vk::Image dst, uint32_t mipLevel, uint32_t width, uint32_t height, uint32_t blockExtent, size_t blockSize, const void* data);
+    // makes the uploaded levels visible and moves them from eTransferDstOptimal to finalLayout
+    void FinishImage(vk::Image dst, vk::ImageLayout finalLayout, uint32_t mipLevels = 1);
+    void TransitionImage(vk::Image image, vk::ImageLayout oldLayout, vk::ImageLayout newLayout, uint32_t mipLevels = 1);
+
+    // submits everything recorded so far without waiting for it
+    void Flush();
+    // flushes and blocks until all uploads have landed, logs the transfer statistics
+    void Finish();
+
+private:
+    struct Batch {
+        vk::CommandBuffer cmdBuffer;
+        SubmissionID id;
+        uint64_t arenaEnd;
+    };
+
+    AppBase& app;
+    Buffer arena;
+    uint8_t* arena_data;
+    vk::DeviceSize arena_size;
+    // monotonic byte counters, the ring offset is the counter modulo arena_size
+    uint64_t arena_head = 0;
+    uint64_t arena_tail = 0;
+
+    std::optional<Batch> recording;
+    std::deque<Batch> in_flight;
+
+    struct {
+        uint64_t bytes = 0;
+        uint32_t submissions = 0;
+        double stallSeconds = 0.0;
+    } stats;
+
+    vk::CommandBuffer currentCommandBuffer();
+    vk::DeviceSize allocate(vk::DeviceSize size, vk::DeviceSize alignment);
+    void retireOldest();
+    void retireCompleted();
+};
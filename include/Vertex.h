@@ -16,11 +16,48 @@ struct Vertex3D {
     glm::vec3 pos;
 };
 
+// full precision scene vertex, the uv is split over the w components
 struct GLTFVertex {
     glm::vec4 pos;
     glm::vec4 normal;
 };
 
+// how scene vertices are stored on the GPU, the hit shader gets this as a specialization constant
+enum class VertexLayout : uint32_t {
+    // GLTFVertex, 32 bytes
+    eFull,
+    // PackedVertex, 20 bytes
+    ePacked,
+    // QuantizedVertex, 16 bytes
+    eQuantized,
+};
+
+// float position, octahedral normal as 2x snorm16 and uv as 2x half
+struct PackedVertex {
+    glm::vec3 pos;
+    uint32_t normal;
+    uint32_t uv;
+};
+
+// PackedVertex with the position as snorm16 relative to the mesh bounds, the fourth component is padding
+struct QuantizedVertex {
+    std::array<int16_t, 4> pos;
+    uint32_t normal;
+    uint32_t uv;
+};
+
+namespace vertextools {
+    uint32_t Stride(VertexLayout layout);
+    // format of the position at the start of each vertex, as given to the BLAS build
+    vk::Format PositionFormat(VertexLayout layout);
+    uint32_t OctEncode(glm::vec3 normal);
+    glm::vec3 OctDecode(uint32_t encoded);
+    // writes count vertices in the given layout, quantized positions are stored as (pos - offset) / scale
+    void Pack(VertexLayout layout, const GLTFVertex* src, size_t count, glm::vec3 scale, glm::vec3 offset, uint8_t* dst);
+    // mesh space position of one vertex written by Pack
+    glm::vec3 UnpackPosition(VertexLayout layout, const uint8_t* vertex, glm::vec3 scale, glm::vec3 offset);
+}
+
 template<>
 struct vertex_info<Vertex2D> {
     static vk::VertexInputBindingDescription BindingDescription(uint32_t binding) {
@@ -17,7 +17,7 @@
 namespace vk {
 namespace inits {
 
-constexpr vk::ImageViewCreateInfo imageViewCreateInfo(vk::Image image, vk::ImageAspectFlags aspect, vk::Format format) {
+constexpr vk::ImageViewCreateInfo imageViewCreateInfo(vk::Image image, vk::ImageAspectFlags aspect, vk::Format format, uint32_t mipLevels = 1) {
     return vk::ImageViewCreateInfo {
         .image = image,
         .viewType = vk::ImageViewType::e2D,
@@ -31,7 +31,7 @@ constexpr vk::ImageViewCreateInfo imageViewCreateInfo(vk::Image image, vk::Image
         .subresourceRange = ImageSubresourceRange {
             .aspectMask = aspect,
             .baseMipLevel = 0,
-            .levelCount = 1,
+            .levelCount = mipLevels,
             .baseArrayLayer = 0,
             .layerCount = 1,
         }
@@ -45,13 +45,14 @@ constexpr vk::ColorComponentFlags componentsRGBA() {
          | vk::ColorComponentFlagBits::eA;
 }
 
-constexpr vk::ImageSubresourceRange imageSubresourceRange(vk::ImageAspectFlags aspect) {
+// every layer, so barriers on array images cover all of them
+constexpr vk::ImageSubresourceRange imageSubresourceRange(vk::ImageAspectFlags aspect, uint32_t mipLevels = 1) {
     return vk::ImageSubresourceRange {
         .aspectMask = aspect,
         .baseMipLevel = 0,
-        .levelCount = 1,
+        .levelCount = mipLevels,
         .baseArrayLayer = 0,
-        .layerCount = 1,
+        .layerCount = VK_REMAINING_ARRAY_LAYERS,
     };
 }
 
@@ -64,7 +65,7 @@ constexpr vk::Viewport viewport(uint32_t width, uint32_t height) {
     };
 }
 
-constexpr vk::ImageCreateInfo imageCreateInfo(uint32_t width, uint32_t height, vk::Format format, vk::ImageUsageFlags usage, vk::ImageLayout initialLayout)
+constexpr vk::ImageCreateInfo imageCreateInfo(uint32_t width, uint32_t height, vk::Format format, vk::ImageUsageFlags usage, vk::ImageLayout initialLayout, uint32_t mipLevels = 1)
 {
     vk::ImageCreateInfo imageCreateInfo {};
     imageCreateInfo.imageType = vk::ImageType::e2D;
@@ -73,7 +74,7 @@ constexpr vk::ImageCreateInfo imageCreateInfo(uint32_t width, uint32_t height, v
     imageCreateInfo.extent.width = width;
     imageCreateInfo.extent.height = height;
     imageCreateInfo.extent.depth = 1;
-    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.mipLevels = mipLevels;
     imageCreateInfo.arrayLayers = 1;
     imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
     imageCreateInfo.tiling = vk::ImageTiling::eOptimal,
@@ -122,16 +123,17 @@ constexpr vk::WriteDescriptorSet writeDescriptorSetBuffer(
     return writeDescriptorSet;
 }
 
-constexpr vk::BufferImageCopy imageCopy(uint32_t width, uint32_t height) {
+// layers are tightly packed after each other in the buffer
+constexpr vk::BufferImageCopy imageCopy(uint32_t width, uint32_t height, uint32_t mipLevel = 0, uint32_t layers = 1) {
     vk::BufferImageCopy region {
             .bufferOffset = 0,
             .bufferRowLength = 0,
             .bufferImageHeight = 0,
             .imageSubresource = {
                     .aspectMask = vk::ImageAspectFlagBits::eColor,
-                    .mipLevel = 0,
+                    .mipLevel = mipLevel,
                     .baseArrayLayer = 0,
-                    .layerCount = 1,
+                    .layerCount = layers,
             },
             .imageOffset = {0,0,0},
             .imageExtent = {width, height, 1},
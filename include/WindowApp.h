@@ -8,6 +8,20 @@ struct Frame {
     vk::ImageView view;
     uint32_t imageIdx;
     uint32_t flightIdx;
+    // owned by the frame slot and already begun, WindowFrameEnd ends and submits it
+    vk::CommandBuffer cmdBuffer;
+};
+
+// measurements of the oldest frame in flight, taken when WindowFrameStart recycles its slot
+struct FrameTimings {
+    // from WindowFrameStart returning to WindowFrameEnd
+    double cpu_ms = 0;
+    // WindowFrameStart blocked on the slot's fence, near zero when the CPU is the bottleneck
+    double wait_ms = 0;
+    // from the first to the last command of the frame on the device, zero without timestamp support
+    double gpu_ms = 0;
+    // the device had nothing to do between the end of the previous frame and the start of this one
+    double gpu_idle_ms = 0;
 };
 
 struct WindowAppConfig {
@@ -37,8 +51,10 @@ public:
 
     bool WindowShouldClose() const { return glfwWindowShouldClose(glfw_window); }
     vk::Format getSurfaceFormat() const { return vk_surface_format.format; }
+    // waits until the next frame slot is free again, so anything that slot's last frame used can be reused
     Frame WindowFrameStart();
-    void WindowFrameEnd(vk::CommandBuffer cmdBuffer);
+    void WindowFrameEnd();
+    const FrameTimings& LastFrameTimings() const { return frameTimings; }
 
 protected:
     virtual void onQueueCreateInfo(std::vector<vk::DeviceQueueCreateInfo>& queueInfos) override;
@@ -47,10 +63,25 @@ private:
     WindowAppConfig config;
     std::vector<vk::Semaphore> imageAvailableSemaphores;
     std::vector<vk::Semaphore> renderFinishedSemaphores;
+    std::vector<vk::CommandBuffer> commandBuffers;
+    // fence of the frame that last rendered to each swapchain image
+    std::vector<vk::Fence> imagesInFlight;
     uint32_t imageIdx;
     uint32_t flightIdx = 0;
+
+    // a start and an end timestamp per frame slot
+    vk::QueryPool timestampPool;
+    double timestampPeriod = 0;
+    std::vector<bool> timestampsWritten;
+    uint64_t lastGpuEnd = 0;
+    std::vector<double> cpuMs;
+    std::chrono::steady_clock::time_point frameStart;
+    FrameTimings frameTimings;
+
     void createSwapchain();
     void createSyncObjects();
+    void createTimestampPool();
+    void readFrameTimings(double waitMs);
 
     vk::SurfaceFormatKHR chooseSurfaceFormat() const;
     vk::PresentModeKHR choosePresentMode() const;
@@ -27,7 +27,17 @@
 #include <optional>
 #include <limits>
 #include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <memory>
+#include <deque>
+#include <chrono>
+#include <filesystem>
+#include <span>
+#include <tuple>
+#include <map>
+#include <unordered_map>
+#include <atomic>
 
 #include <string>
 
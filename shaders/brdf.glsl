@@ -187,3 +187,34 @@ void ImportanceSampleGgxVdn(vec3 wo, Material material,
         reflectance = vec3(0);
     }
 }
+
+//====================================================================
+// ImportanceSampleGgxVdn's bsdf times cosine for a direction it did not pick itself, such as a light sample
+vec3 EvaluateGgxVdn(vec3 wo, vec3 wi, Material material)
+{
+    if(BsdfNDot(wo) <= 0.0f || BsdfNDot(wi) <= 0.0f) {
+        return vec3(0);
+    }
+    float a = material.roughness;
+    float a2 = a * a;
+    vec3 wm = normalize(wo + wi);
+
+    vec3 F = SchlickFresnel(material.diffuse_color.xyz, dot(wi, wm));
+    float G2 = SmithGGXMaskingShadowing(wi, wo, a2);
+    return F * G2 * GGX_D(a2, BsdfNDot(wm)) / (4.0f * BsdfNDot(wo));
+}
+
+//====================================================================
+// solid angle density of ImportanceSampleGgxVdn returning wi
+float PdfGgxVdn(vec3 wo, vec3 wi, Material material)
+{
+    if(BsdfNDot(wo) <= 0.0f || BsdfNDot(wi) <= 0.0f) {
+        return 0.0f;
+    }
+    float a = material.roughness;
+    float a2 = a * a;
+    vec3 wm = normalize(wo + wi);
+
+    // visible normal density G1 * D * dot(wo, wm) / wo.z with the reflection jacobian 1 / (4 * dot(wo, wm))
+    return SmithGGXMasking(wi, wo, a2) * GGX_D(a2, BsdfNDot(wm)) / (4.0f * BsdfNDot(wo));
+}
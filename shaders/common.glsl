@@ -5,6 +5,20 @@ const float INVPI = 1.0f / 3.141592653589793f;
 const float EPS = 0.001f;
 
 float max3(in vec3 v) { return max(v.x, max(v.y, v.z)); }
+float luminance(in vec3 c) { return dot(c, vec3(0.2126f, 0.7152f, 0.0722f)); }
+
+// RTX::CONVERGENCE_TILE_SIZE, pixels per side of the tiles adaptive sampling switches on and off
+const uint CONVERGENCE_TILE_SIZE = 16;
+
+// MAX_CAMERAS and CameraData on the host, the Uniforms block holds one per layer of the output images
+const uint MAX_CAMERAS = 32;
+struct CameraData {
+    mat4 proj;
+    mat4 projInverse;
+    mat4 view;
+    mat4 viewInverse;
+    vec4 viewDirection;
+};
 
 
 uint rand_xorshift(in uint seed)
@@ -27,11 +41,21 @@ uint wang_hash(in uint seed)
 
 uint g_seed = 22;
 
+#ifdef SAMPLER_INTERFACE
+// provided by the including shader, see sampler.glsl
+float nextSample();
+
+float randf()
+{
+    return nextSample();
+}
+#else
 float randf()
 {
     g_seed = rand_xorshift(g_seed);
     return g_seed * 2.3283064365387e-10f;
 }
+#endif
 
 float randf_seed(in uint seed) {
     return wang_hash(seed) * 2.3283064365387e-10f;
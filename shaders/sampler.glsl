@@ -0,0 +1,89 @@
+#ifndef GLSL_SAMPLER
+#define GLSL_SAMPLER
+// Sample sequences behind randf(). Include after common.glsl compiled with SAMPLER_INTERFACE defined and after
+// the Uniforms block and launch push constants, which provide sampleSequence and scrambleSeed.
+
+// SampleSequence on the host
+const uint SAMPLE_SEQUENCE_RANDOM = 0;
+const uint SAMPLE_SEQUENCE_SOBOL = 1;
+
+// samplertools on the host
+const uint SOBOL_DIMENSIONS = 4;
+const uint BLUE_NOISE_SIZE = 64;
+// dimensions reserved for the camera ray and for every bounce, so a bounce draws the same dimensions in every sample
+const uint CAMERA_DIMENSIONS = 8;
+const uint BOUNCE_DIMENSIONS = 16;
+
+layout(binding = 13) readonly buffer SobolDirections { uint sobolDirections[]; };
+layout(binding = 14) readonly buffer BlueNoise { float blueNoise[]; };
+
+uvec2 g_sample_pixel;
+uint g_sample_index;
+uint g_sample_dimension;
+
+// seed only feeds the random sequence
+void samplerInit(uvec2 pixel, uint sampleIndex, uint seed) {
+    g_seed = seed;
+    g_sample_pixel = pixel;
+    g_sample_index = sampleIndex;
+    g_sample_dimension = 0;
+}
+
+void samplerStartBounce(uint depth) {
+    g_sample_dimension = CAMERA_DIMENSIONS + depth * BOUNCE_DIMENSIONS;
+}
+
+uint sobol(uint index, uint dimension) {
+    uint x = 0;
+    for(uint bit = 0; index != 0; bit++, index >>= 1) {
+        if ((index & 1) != 0) {
+            x ^= sobolDirections[dimension * 32 + bit];
+        }
+    }
+    return x;
+}
+
+// Practical Hash-based Owen Scrambling (Burley 2020)
+uint laineKarrasPermutation(uint x, uint seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+uint nestedUniformScramble(uint x, uint seed) {
+    x = bitfieldReverse(x);
+    x = laineKarrasPermutation(x, seed);
+    return bitfieldReverse(x);
+}
+
+uint hashCombine(uint seed, uint v) {
+    return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+// Dimensions are padded in groups of SOBOL_DIMENSIONS, every group shuffles the sample order and scrambles the
+// points with its own seed, derived from the accumulation's scrambleSeed. All pixels share the sequence and are told
+// apart by a toroidal shift from a blue noise tile, which spreads the remaining error as blue noise instead of white.
+float sobolSample(uint dimension) {
+    const uint group = dimension / SOBOL_DIMENSIONS;
+    const uint component = dimension % SOBOL_DIMENSIONS;
+    const uint seed = wang_hash(hashCombine(wang_hash(scrambleSeed), group + 1));
+    const uint index = nestedUniformScramble(g_sample_index, seed);
+    const uint x = nestedUniformScramble(sobol(index, component), hashCombine(seed, component));
+
+    // every dimension reads the tile at a different offset along the R2 sequence
+    const uvec2 offset = uvec2(fract(vec2(dimension) * vec2(0.7548776662f, 0.5698402910f)) * BLUE_NOISE_SIZE);
+    const uvec2 texel = (g_sample_pixel + offset) % BLUE_NOISE_SIZE;
+    return fract(float(x >> 8) * (1.0f / 16777216.0f) + blueNoise[texel.y * BLUE_NOISE_SIZE + texel.x]);
+}
+
+float nextSample() {
+    if (sampleSequence == SAMPLE_SEQUENCE_SOBOL) {
+        return sobolSample(g_sample_dimension++);
+    }
+    g_seed = rand_xorshift(g_seed);
+    return g_seed * 2.3283064365387e-10f;
+}
+#endif
@@ -1,7 +1,8 @@
 #version 460
 
 
-layout(binding = 0) uniform sampler2D tex;
+// the first camera's layer of RTX::storage_image
+layout(binding = 0) uniform sampler2DArray tex;
 
 layout(location = 0) in vec2 uv;
 layout(location = 0) out vec4 outColor;
@@ -10,7 +11,7 @@ void main() {
     const float gamma = 2.2f;
     const float exposure = 3.0f;
 
-    vec4 bufferVal = texture(tex, uv);
+    vec4 bufferVal = texture(tex, vec3(uv, 0));
 
     vec3 hdrColor = bufferVal.xyz / bufferVal.w;
     vec3 mapped = pow(vec3(1.0f) - exp(-hdrColor * exposure), vec3(1.0f / gamma));
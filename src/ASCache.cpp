@@ -0,0 +1,99 @@
+#include <ASCache.h>
+#include <Hash.h>
+
+// layout of the header vulkan puts in front of a serialized acceleration structure
+constexpr size_t SERIALIZED_VERSION_SIZE = 2 * VK_UUID_SIZE;
+constexpr size_t SERIALIZED_SIZE_OFFSET = SERIALIZED_VERSION_SIZE;
+constexpr size_t DESERIALIZED_SIZE_OFFSET = SERIALIZED_VERSION_SIZE + sizeof(uint64_t);
+constexpr size_t SERIALIZED_HEADER_SIZE = SERIALIZED_VERSION_SIZE + 3 * sizeof(uint64_t);
+
+ASCache::ASCache(AppBase& app, const char* directory) : app(app), directory(directory) {
+    std::filesystem::create_directories(this->directory);
+
+    vk::PhysicalDeviceIDProperties idProperties{};
+    vk::PhysicalDeviceProperties2 properties { .pNext = &idProperties };
+    app.vk_physical_device.getProperties2(&properties);
+
+    device_hash = hash::Bytes(idProperties.deviceUUID.data(), VK_UUID_SIZE);
+    device_hash = hash::Combine(device_hash, hash::Bytes(idProperties.driverUUID.data(), VK_UUID_SIZE));
+    device_hash = hash::Combine(device_hash, properties.properties.driverVersion);
+    device_hash = hash::Combine(device_hash, properties.properties.vendorID);
+}
+
+uint64_t ASCache::Key(const GLTFMesh& mesh, vk::BuildAccelerationStructureFlagsKHR flags) const {
+    uint64_t key = hash::Combine(device_hash, static_cast<uint32_t>(flags));
+    key = hash::Combine(key, hash::Span(mesh.VertexData()));
+    key = hash::Combine(key, hash::Span(mesh.IndexData()));
+    // quantized meshes are built through their dequantization transform
+    key = hash::Combine(key, hash::Bytes(&mesh.position_scale, sizeof(glm::vec3)));
+    key = hash::Combine(key, hash::Bytes(&mesh.position_offset, sizeof(glm::vec3)));
+    for(const auto& primitive : mesh.primitives) {
+        key = hash::Combine(key, static_cast<uint32_t>(primitive.index_type));
+        key = hash::Combine(key, primitive.index_count);
+        key = hash::Combine(key, primitive.index_offset);
+        key = hash::Combine(key, primitive.vertex_count);
+        key = hash::Combine(key, primitive.vertex_offset);
+    }
+    return key;
+}
+
+std::optional<std::vector<uint8_t>> ASCache::Load(uint64_t key) {
+    const auto path = entryPath(key);
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        misses++;
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(data.data()), data.size());
+    file.close();
+
+    uint64_t serializedSize = 0;
+    if (data.size() >= SERIALIZED_HEADER_SIZE) {
+        memcpy(&serializedSize, data.data() + SERIALIZED_SIZE_OFFSET, sizeof(uint64_t));
+    }
+
+    bool valid = serializedSize == data.size();
+    if (valid) {
+        vk::AccelerationStructureVersionInfoKHR versionInfo { .pVersionData = data.data() };
+        valid = app.vk_device.getAccelerationStructureCompatibilityKHR(versionInfo, app.vk_ext_dispatcher) == vk::AccelerationStructureCompatibilityKHR::eCompatible;
+    }
+
+    if (!valid) {
+        logger::warn("Discarding stale acceleration structure cache entry {}", path.string());
+        std::filesystem::remove(path);
+        misses++;
+        return std::nullopt;
+    }
+
+    hits++;
+    return data;
+}
+
+void ASCache::Store(uint64_t key, const void* data, size_t size) {
+    // write to a temporary first so an interrupted run never leaves a truncated entry behind
+    const auto path = entryPath(key);
+    auto tmpPath = path;
+    tmpPath += ".tmp";
+
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        logger::warn("Could not write acceleration structure cache entry {}", path.string());
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(data), size);
+    file.close();
+    std::filesystem::rename(tmpPath, path);
+}
+
+vk::DeviceSize ASCache::DeserializedSize(const std::vector<uint8_t>& data) {
+    uint64_t size;
+    memcpy(&size, data.data() + DESERIALIZED_SIZE_OFFSET, sizeof(uint64_t));
+    return size;
+}
+
+std::filesystem::path ASCache::entryPath(uint64_t key) const {
+    return directory / fmt::format("{:016x}.blas", key);
+}
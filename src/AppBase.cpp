@@ -10,6 +10,8 @@ void AppBase::Init() {
     allocateDescriptorPool();
     initVMA();
     createSampler();
+    createUploader();
+    createThreadPool();
 }
 
 vk::CommandBuffer AppBase::MakeGraphicsCommandBuffer() {
@@ -23,18 +25,81 @@ vk::CommandBuffer AppBase::MakeGraphicsCommandBuffer() {
 }
 
 void AppBase::WithSingleTimeCommandBuffer(std::function<void(vk::CommandBuffer)> record) {
-    auto cmdBuffer = MakeGraphicsCommandBuffer();
+    WaitForSubmission(SubmitSingleTimeCommandBuffer(record));
+}
+
+vk::CommandBuffer AppBase::AcquireSingleTimeCommandBuffer() {
+    recycleSubmissions(0);
+
+    SingleTimeSubmission submission{};
+    if (!free_submissions.empty()) {
+        submission = free_submissions.back();
+        free_submissions.pop_back();
+    } else {
+        submission.cmdBuffer = MakeGraphicsCommandBuffer();
+        submission.fence = vk_device.createFence(vk::FenceCreateInfo{});
+    }
+
+    recording_submissions.push_back(submission);
+
     vk::CommandBufferBeginInfo beginInfo { .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit, };
-    cmdBuffer.begin(beginInfo);
-    record(cmdBuffer);
-    cmdBuffer.end();
+    submission.cmdBuffer.begin(beginInfo);
+    return submission.cmdBuffer;
+}
 
+SubmissionID AppBase::SubmitSingleTimeCommandBuffer(vk::CommandBuffer cmdBuffer) {
+    // anything staged before this point may be consumed by the submission
+    if (uploader) {
+        uploader->Flush();
+    }
+
+    auto it = std::find_if(recording_submissions.begin(), recording_submissions.end(), [&](const auto& s) { return s.cmdBuffer == cmdBuffer; });
+    assert(it != recording_submissions.end() && "command buffer was not acquired with AcquireSingleTimeCommandBuffer");
+    SingleTimeSubmission submission = *it;
+    recording_submissions.erase(it);
+
+    cmdBuffer.end();
     vk::SubmitInfo submitInfo {
         .commandBufferCount = 1,
         .pCommandBuffers = &cmdBuffer,
     };
-    vk_graphics_queue.submit(submitInfo);
-    vk_graphics_queue.waitIdle();
+    vk_graphics_queue.submit({submitInfo}, submission.fence);
+
+    submission.id = next_submission_id++;
+    pending_submissions.push_back(submission);
+    return submission.id;
+}
+
+SubmissionID AppBase::SubmitSingleTimeCommandBuffer(std::function<void(vk::CommandBuffer)> record) {
+    auto cmdBuffer = AcquireSingleTimeCommandBuffer();
+    record(cmdBuffer);
+    return SubmitSingleTimeCommandBuffer(cmdBuffer);
+}
+
+bool AppBase::IsSubmissionDone(SubmissionID id) {
+    recycleSubmissions(0);
+    return id <= completed_submission_id;
+}
+
+void AppBase::WaitForSubmission(SubmissionID id) {
+    recycleSubmissions(id);
+}
+
+void AppBase::recycleSubmissions(SubmissionID waitFor) {
+    while (!pending_submissions.empty()) {
+        auto& front = pending_submissions.front();
+        if (front.id <= waitFor) {
+            vk::resultCheck(vk_device.waitForFences({front.fence}, VK_TRUE, UINT64_MAX), "error waiting for submission");
+        } else if (vk_device.getFenceStatus(front.fence) != vk::Result::eSuccess) {
+            break;
+        }
+
+        vk_device.resetFences({front.fence});
+        front.cmdBuffer.reset();
+        completed_submission_id = front.id;
+        free_submissions.push_back(front);
+        pending_submissions.pop_front();
+    }
 }
 
 vk::ShaderModule AppBase::LoadShader(const std::string& filename) {
@@ -60,6 +125,16 @@ vk::ShaderModule AppBase::LoadShader(const std::string& filename) {
 
 AppBase::~AppBase() {
     logger::info("destroying app");
+    thread_pool.reset();
+    uploader.reset();
+    WaitForSubmission(next_submission_id - 1);
+    for(const auto& submission : free_submissions) {
+        vk_device.destroyFence(submission.fence);
+    }
+    // acquired but never submitted, e.g. when recording threw. Their command buffers go with the pool.
+    for(const auto& submission : recording_submissions) {
+        vk_device.destroyFence(submission.fence);
+    }
     vk_device.destroySampler(vk_default_sampler);
     vmaDestroyAllocator(vma_allocator);
     vk_device.destroyDescriptorPool(vk_descriptor_pool);
@@ -104,7 +179,19 @@ void AppBase::pickPhysicalDevice() {
         throw std::runtime_error("No vulkan capable devices detected");
     }
 
-    this->vk_physical_device = devices[0];
+    // the first device that has every requested extension, software drivers like lavapipe may be listed next to a GPU that lacks them
+    auto supportsExtensions = [&](vk::PhysicalDevice device) {
+        const auto available = device.enumerateDeviceExtensionProperties();
+        return std::all_of(device_extensions.begin(), device_extensions.end(), [&](const char* name) {
+            return std::any_of(available.begin(), available.end(), [&](const vk::ExtensionProperties& ext) { return strcmp(ext.extensionName, name) == 0; });
+        });
+    };
+    auto picked = std::find_if(devices.begin(), devices.end(), supportsExtensions);
+    if (picked == devices.end()) {
+        throw std::runtime_error("No vulkan device supports the required extensions");
+    }
+
+    this->vk_physical_device = *picked;
     logger::debug("picked device: {}", vk_physical_device.getProperties().deviceName);
 }
 
@@ -139,8 +226,13 @@ void AppBase::createDevice() {
     );
 
     this->onQueueCreateInfo(queueCreateInfos);
+    for(auto restrictToDevice : device_restrictions) {
+        restrictToDevice(vk_physical_device);
+    }
 
     vk::PhysicalDeviceFeatures deviceFeatures{};
+    // scene textures are block compressed whenever the device can sample BC formats
+    deviceFeatures.textureCompressionBC = vk_physical_device.getFeatures().textureCompressionBC;
 
     vk::DeviceCreateInfo createInfo {
         .pNext = this->enabled_device_features,
@@ -169,7 +261,7 @@ void AppBase::createDevice() {
 
     this->vk_graphics_queue = vk_device.getQueue(vk_graphics_family, 0);
 
-    this->vk_ext_dispatcher = vk::DispatchLoaderDynamic(vk_instance, glfwGetInstanceProcAddress, vk_device);
+    this->vk_ext_dispatcher = vk::DispatchLoaderDynamic(vk_instance, vkGetInstanceProcAddr, vk_device);
 }
 
 void AppBase::allocateCommandPool() {
@@ -223,9 +315,20 @@ void AppBase::createSampler() {
     vk::SamplerCreateInfo createInfo {
         .magFilter = vk::Filter::eLinear,
         .minFilter = vk::Filter::eLinear,
+        .mipmapMode = vk::SamplerMipmapMode::eLinear,
         .addressModeU = vk::SamplerAddressMode::eRepeat,
         .addressModeV = vk::SamplerAddressMode::eRepeat,
         .addressModeW = vk::SamplerAddressMode::eRepeat,
+        .maxLod = VK_LOD_CLAMP_NONE,
     };
     this->vk_default_sampler = vk_device.createSampler(createInfo);
 }
+
+void AppBase::createUploader() {
+    this->uploader = std::make_unique<Uploader>(*this);
+}
+
+void AppBase::createThreadPool() {
+    this->thread_pool = std::make_unique<ThreadPool>();
+    logger::info("Using {} worker threads", thread_pool->Size());
+}
@@ -51,16 +51,17 @@ namespace buffertools {
 
     Buffer CreateBufferD(AppBase& app, vk::BufferUsageFlags usage, size_t size, void* data) {
         Buffer ret = CreateBufferD(app, usage | vk::BufferUsageFlagBits::eTransferDst, size);
-        Buffer staging = CreateBufferH(app, vk::BufferUsageFlagBits::eTransferSrc, size, data);
-
-        app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
-            logger::info("Transfering {} bytes to the gpu for buffer initialisation", size);
-            vk::BufferCopy copyRegion { .size = size };
-            cmdBuffer.copyBuffer(staging.handle, ret.handle, copyRegion);
-        });
-
-        DestroyBuffer(app, staging);
+        app.uploader->UploadBuffer(ret.handle, data, size);
+        return ret;
+    }
 
+    Buffer CreateBufferD2H(AppBase& app, vk::BufferUsageFlags usage, size_t size) {
+        Buffer ret;
+        auto bufferInfo = static_cast<VkBufferCreateInfo>(vk::BufferCreateInfo { .size = size, .usage = usage });
+        VmaAllocationCreateInfo allocInfo { .usage = VMA_MEMORY_USAGE_GPU_TO_CPU };
+        VkBuffer retBuffer;
+        vmaCreateBuffer(app.vma_allocator, &bufferInfo, &allocInfo, &retBuffer, &ret.allocation, nullptr);
+        ret.handle = vk::Buffer(retBuffer);
         return ret;
     }
 
@@ -82,4 +83,8 @@ namespace buffertools {
     void UnmapBuffer(AppBase& app, Buffer buffer) {
         vmaUnmapMemory(app.vma_allocator, buffer.allocation);
     }
+
+    void FlushBuffer(AppBase& app, Buffer buffer, vk::DeviceSize offset, vk::DeviceSize size) {
+        vmaFlushAllocation(app.vma_allocator, buffer.allocation, offset, size);
+    }
 }
@@ -8,6 +8,9 @@ Camera::Camera(GLFWwindow* window) : window(window) {
 
 void Camera::update(float dt) {
     hasMoved = false;
+    if (!window) {
+        return;
+    }
 
     const float moveSpeed = 3.0f * dt;
     const float rotSpeed = 2.0f * dt;
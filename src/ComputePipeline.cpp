@@ -0,0 +1,54 @@
+#include <ComputePipeline.h>
+
+ComputePipeline::ComputePipeline(AppBase& app, const std::string& shader, const std::vector<vk::DescriptorSetLayoutBinding>& bindings, uint32_t pushConstantSize) {
+    std::vector<vk::DescriptorSetLayoutBinding> computeBindings = bindings;
+    for(auto& binding : computeBindings) {
+        binding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+
+    vk::DescriptorSetLayoutCreateInfo descriptorSetLayoutInfo {
+        .bindingCount = static_cast<uint32_t>(computeBindings.size()),
+        .pBindings = computeBindings.data(),
+    };
+    this->descriptorSetLayout = app.vk_device.createDescriptorSetLayout(descriptorSetLayoutInfo);
+
+    vk::PushConstantRange pushConstantRange {
+        .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        .offset = 0,
+        .size = pushConstantSize,
+    };
+
+    vk::PipelineLayoutCreateInfo layoutInfo {
+        .setLayoutCount = 1,
+        .pSetLayouts = &this->descriptorSetLayout,
+        .pushConstantRangeCount = pushConstantSize > 0 ? 1u : 0u,
+        .pPushConstantRanges = &pushConstantRange,
+    };
+    this->layout = app.vk_device.createPipelineLayout(layoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo {
+        .stage = vk::inits::shaderStageCreateInfo(app.LoadShader(shader), vk::ShaderStageFlagBits::eCompute),
+        .layout = layout,
+    };
+
+    auto result = app.vk_device.createComputePipeline(nullptr, pipelineInfo);
+    vk::resultCheck(result.result, "Error creating compute pipeline");
+    this->pipeline = result.value;
+    app.vk_device.destroyShaderModule(pipelineInfo.stage.module);
+}
+
+void ComputePipeline::Destroy(const AppBase& app) {
+    app.vk_device.destroyPipeline(pipeline);
+    app.vk_device.destroyPipelineLayout(layout);
+    app.vk_device.destroyDescriptorSetLayout(descriptorSetLayout);
+}
+
+vk::DescriptorSet ComputePipeline::AllocateDescriptor(const AppBase& app) const {
+    vk::DescriptorSetAllocateInfo allocInfo {
+        .descriptorPool = app.vk_descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &this->descriptorSetLayout
+    };
+
+    return app.vk_device.allocateDescriptorSets(allocInfo)[0];
+}
@@ -0,0 +1,107 @@
+#include <LightTools.h>
+#include <numeric>
+
+float lighttools::Luminance(glm::vec3 color) {
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+float lighttools::EmittedLuminance(const GLTFMaterial& material) {
+    // paths only stop on them with probability alpha, shadow rays treat every surface as opaque
+    if (material.diffuse_color.w < 1.0f) {
+        return 0.0f;
+    }
+    return std::max(Luminance(glm::vec3(material.emission)), 0.0f);
+}
+
+std::vector<LightTriangle> lighttools::EmissiveTriangles(const Scene& scene) {
+    const uint32_t stride = vertextools::Stride(scene.vertex_layout);
+    std::vector<LightTriangle> triangles;
+    for(const auto& instance : scene.instances) {
+        const auto& mesh = scene.meshes[instance.mesh_id];
+        const auto vertexData = mesh.VertexData();
+        const auto indexData = mesh.IndexData();
+        for(const auto& primitive : mesh.primitives) {
+            if (EmittedLuminance(scene.materials[primitive.material_id]) <= 0.0f) {
+                continue;
+            }
+
+            const uint8_t* indices = indexData.data() + primitive.index_offset;
+            auto getIndex = [&](uint32_t i) -> uint32_t {
+                if (primitive.index_type == vk::IndexType::eUint16) {
+                    return reinterpret_cast<const uint16_t*>(indices)[i];
+                }
+                return reinterpret_cast<const uint32_t*>(indices)[i];
+            };
+            auto getPosition = [&](uint32_t i) {
+                const uint8_t* vertex = vertexData.data() + size_t(primitive.vertex_offset + getIndex(i)) * stride;
+                const glm::vec3 pos = vertextools::UnpackPosition(scene.vertex_layout, vertex, mesh.position_scale, mesh.position_offset);
+                return glm::vec3(instance.transform * glm::vec4(pos, 1.0f));
+            };
+
+            for(uint32_t i=0; i+2<primitive.index_count; i+=3) {
+                LightTriangle triangle {
+                    .v0 = getPosition(i+0),
+                    .material_id = primitive.material_id,
+                    .v1 = getPosition(i+1),
+                    .v2 = getPosition(i+2),
+                };
+                // degenerate triangles can never be hit, so they need not be sampled either
+                if (Area(triangle) > 0.0f) {
+                    triangles.push_back(triangle);
+                }
+            }
+        }
+    }
+    return triangles;
+}
+
+float lighttools::Area(const LightTriangle& triangle) {
+    return 0.5f * glm::length(glm::cross(triangle.v1 - triangle.v0, triangle.v2 - triangle.v0));
+}
+
+std::vector<float> lighttools::EnvironmentWeights(const float* rgba, uint32_t width, uint32_t height) {
+    std::vector<float> weights(size_t(width) * height);
+    for(uint32_t y=0; y<height; y++) {
+        // row y spans theta = pi * [y, y+1) / height, matching the acos(direction.y) / pi lookup in raygen.rgen
+        const float sinTheta = std::sin(glm::pi<float>() * (y + 0.5f) / height);
+        for(uint32_t x=0; x<width; x++) {
+            const size_t i = size_t(y) * width + x;
+            weights[i] = std::max(Luminance(glm::make_vec3(rgba + 4 * i)), 0.0f) * sinTheta;
+        }
+    }
+    return weights;
+}
+
+std::vector<AliasEntry> lighttools::BuildAliasTable(const std::vector<float>& weights) {
+    const size_t count = weights.size();
+    const double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+    if (count == 0 || total <= 0.0) {
+        throw std::runtime_error("Cannot build an alias table without positive weights");
+    }
+
+    // scale so the average is one, slots below one are topped up from slots above it
+    std::vector<double> scaled(count);
+    std::vector<uint32_t> small, large;
+    for(uint32_t i=0; i<count; i++) {
+        scaled[i] = weights[i] * count / total;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+
+    std::vector<AliasEntry> table(count);
+    while (!small.empty() && !large.empty()) {
+        const uint32_t s = small.back();
+        small.pop_back();
+        const uint32_t l = large.back();
+        table[s] = AliasEntry { .probability = static_cast<float>(scaled[s]), .alias = l };
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // whatever remains is one up to rounding
+    for(uint32_t i : large) table[i] = AliasEntry { .probability = 1.0f, .alias = i };
+    for(uint32_t i : small) table[i] = AliasEntry { .probability = 1.0f, .alias = i };
+    return table;
+}
@@ -0,0 +1,33 @@
+#include <MappedFile.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::filesystem::path& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error("Could not open " + path.string());
+    }
+
+    struct stat info{};
+    if (fstat(fd, &info) == -1 || info.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Could not stat " + path.string());
+    }
+    size = static_cast<size_t>(info.st_size);
+
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Could not map " + path.string());
+    }
+    // everything is streamed to the GPU right away, start reading ahead
+    madvise(mapping, size, MADV_WILLNEED);
+    data = reinterpret_cast<const uint8_t*>(mapping);
+}
+
+MappedFile::~MappedFile() {
+    munmap(const_cast<uint8_t*>(data), size);
+}
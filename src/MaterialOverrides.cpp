@@ -0,0 +1,103 @@
+#include <MaterialOverrides.h>
+#include <json.hpp>
+
+using json = nlohmann::json;
+
+// how often the file is checked for changes
+constexpr auto POLL_INTERVAL = std::chrono::milliseconds(250);
+
+MaterialOverrides::MaterialOverrides(Scene& scene, std::filesystem::path path) : scene(scene), path(std::move(path)) {
+    base_materials = scene.materials;
+}
+
+bool MaterialOverrides::Poll() {
+    const auto now = std::chrono::steady_clock::now();
+    if (now - last_poll < POLL_INTERVAL) {
+        return false;
+    }
+    last_poll = now;
+
+    std::error_code error;
+    const auto writeTime = std::filesystem::last_write_time(path, error);
+    if (error) {
+        // the file was removed, fall back to the loaded materials once
+        if (!applied) {
+            return false;
+        }
+        logger::info("Material overrides {} removed, restoring the scene materials", path.string());
+        scene.materials = base_materials;
+        applied = false;
+        last_write_time = {};
+        return true;
+    }
+
+    if (writeTime == last_write_time) {
+        return false;
+    }
+    last_write_time = writeTime;
+    return apply();
+}
+
+static void readVector(const json& entry, const char* key, glm::vec4& dst) {
+    if (!entry.contains(key)) {
+        return;
+    }
+    const auto& values = entry.at(key);
+    if (!values.is_array() || values.size() < 3 || values.size() > 4) {
+        throw std::runtime_error(fmt::format("'{}' needs 3 or 4 components", key));
+    }
+    for(size_t i=0; i<values.size(); i++) {
+        // null keeps the loaded component
+        if (!values.at(i).is_null()) {
+            dst[i] = values.at(i).get<float>();
+        }
+    }
+}
+
+static void readScalar(const json& entry, const char* key, float& dst) {
+    if (entry.contains(key)) {
+        dst = entry.at(key).get<float>();
+    }
+}
+
+bool MaterialOverrides::apply() {
+    std::ifstream file(path);
+    const json document = json::parse(file, nullptr, false);
+    if (document.is_discarded()) {
+        // keep the previous state, the file is likely still being written
+        logger::warn("Could not parse material overrides {}", path.string());
+        return false;
+    }
+
+    std::vector<GLTFMaterial> materials = base_materials;
+    uint32_t count = 0;
+    try {
+        for(const auto& entry : document.value("overrides", json::array())) {
+            MaterialID materialID;
+            if (entry.contains("material")) {
+                materialID = entry.at("material").get<MaterialID>();
+            } else {
+                // negative mesh indices count from the back, -1 is the last mesh loaded
+                const int64_t meshIndex = entry.value("mesh", int64_t(0));
+                const auto& mesh = scene.meshes.at(meshIndex < 0 ? scene.meshes.size() + meshIndex : meshIndex);
+                materialID = mesh.primitives.at(entry.at("primitive").get<uint32_t>()).material_id;
+            }
+
+            auto& material = materials.at(materialID);
+            readVector(entry, "diffuse_color", material.diffuse_color);
+            readVector(entry, "emission", material.emission);
+            readVector(entry, "glass", material.glass);
+            readScalar(entry, "roughness", material.roughness);
+            readScalar(entry, "metallic", material.metallic);
+            count++;
+        }
+    } catch (const std::exception& e) {
+        logger::warn("Ignoring material overrides {}: {}", path.string(), e.what());
+        return false;
+    }
+
+    logger::info("Applied {} material overrides from {}", count, path.string());
+    scene.materials = std::move(materials);
+    applied = true;
+    return true;
+}
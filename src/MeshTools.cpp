@@ -0,0 +1,89 @@
+#include <MeshTools.h>
+#include <Hash.h>
+
+void meshtools::Weld(std::vector<GLTFVertex>& vertices, std::vector<uint32_t>& indices) {
+    struct VertexHash {
+        size_t operator()(const GLTFVertex& v) const { return hash::Bytes(&v, sizeof(GLTFVertex)); }
+    };
+    struct VertexEqual {
+        bool operator()(const GLTFVertex& a, const GLTFVertex& b) const { return memcmp(&a, &b, sizeof(GLTFVertex)) == 0; }
+    };
+
+    std::unordered_map<GLTFVertex, uint32_t, VertexHash, VertexEqual> unique;
+    unique.reserve(vertices.size());
+    std::vector<uint32_t> remap(vertices.size());
+    std::vector<GLTFVertex> welded;
+    welded.reserve(vertices.size());
+    for(size_t i=0; i<vertices.size(); i++) {
+        auto [it, inserted] = unique.try_emplace(vertices[i], static_cast<uint32_t>(welded.size()));
+        if (inserted) {
+            welded.push_back(vertices[i]);
+        }
+        remap[i] = it->second;
+    }
+
+    for(auto& index : indices) {
+        index = remap[index];
+    }
+    vertices = std::move(welded);
+}
+
+// spreads the lower 10 bits of v so there are two zero bits between each of them
+static uint32_t expandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+void meshtools::SortTriangles(const std::vector<GLTFVertex>& vertices, std::vector<uint32_t>& indices) {
+    const size_t triangleCount = indices.size() / 3;
+    std::vector<glm::vec3> centroids(triangleCount);
+    glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+    for(size_t i=0; i<triangleCount; i++) {
+        centroids[i] = (glm::vec3(vertices[indices[i*3+0]].pos) + glm::vec3(vertices[indices[i*3+1]].pos) + glm::vec3(vertices[indices[i*3+2]].pos)) / 3.0f;
+        boundsMin = glm::min(boundsMin, centroids[i]);
+        boundsMax = glm::max(boundsMax, centroids[i]);
+    }
+
+    const glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(1e-20f));
+    std::vector<std::pair<uint32_t, uint32_t>> keys(triangleCount);
+    for(size_t i=0; i<triangleCount; i++) {
+        const glm::vec3 p = glm::clamp((centroids[i] - boundsMin) / extent * 1023.0f, 0.0f, 1023.0f);
+        const uint32_t code = (expandBits(static_cast<uint32_t>(p.x)) << 2) | (expandBits(static_cast<uint32_t>(p.y)) << 1) | expandBits(static_cast<uint32_t>(p.z));
+        keys[i] = { code, static_cast<uint32_t>(i) };
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<uint32_t> sorted(triangleCount * 3);
+    for(size_t i=0; i<triangleCount; i++) {
+        const uint32_t t = keys[i].second;
+        sorted[i*3+0] = indices[t*3+0];
+        sorted[i*3+1] = indices[t*3+1];
+        sorted[i*3+2] = indices[t*3+2];
+    }
+    std::copy(sorted.begin(), sorted.end(), indices.begin());
+}
+
+void meshtools::RemapFirstUse(std::vector<GLTFVertex>& vertices, std::vector<uint32_t>& indices) {
+    constexpr uint32_t UNUSED = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(vertices.size(), UNUSED);
+    std::vector<GLTFVertex> ordered;
+    ordered.reserve(vertices.size());
+    for(auto& index : indices) {
+        if (remap[index] == UNUSED) {
+            remap[index] = static_cast<uint32_t>(ordered.size());
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices = std::move(ordered);
+}
+
+void meshtools::Optimize(std::vector<GLTFVertex>& vertices, std::vector<uint32_t>& indices) {
+    Weld(vertices, indices);
+    SortTriangles(vertices, indices);
+    RemapFirstUse(vertices, indices);
+}
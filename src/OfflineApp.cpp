@@ -0,0 +1,83 @@
+#include <OfflineApp.h>
+#include <json.hpp>
+
+using json = nlohmann::json;
+
+void OfflineJob::Load(const std::filesystem::path& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error(fmt::format("Could not open offline job {}", path.string()));
+    }
+
+    const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    try {
+        Parse(text);
+    } catch (const std::exception& e) {
+        throw std::runtime_error(fmt::format("Invalid offline job {}: {}", path.string(), e.what()));
+    }
+}
+
+static glm::vec3 readVector(const json& values, const char* key) {
+    if (!values.is_array() || values.size() != 3) {
+        throw std::runtime_error(fmt::format("'{}' needs 3 components", key));
+    }
+    return glm::vec3(values.at(0).get<float>(), values.at(1).get<float>(), values.at(2).get<float>());
+}
+
+void OfflineJob::Parse(const std::string& text) {
+    try {
+        const json job = json::parse(text);
+        if (job.contains("scene")) scene = job.at("scene").get<std::string>();
+        if (job.contains("output")) output = job.at("output").get<std::string>();
+        if (job.contains("materials")) materials = job.at("materials").get<std::string>();
+        if (job.contains("width")) width = job.at("width").get<uint32_t>();
+        if (job.contains("height")) height = job.at("height").get<uint32_t>();
+        if (job.contains("eye")) eye = readVector(job.at("eye"), "eye");
+        if (job.contains("theta")) theta = job.at("theta").get<float>();
+        if (job.contains("phi")) phi = job.at("phi").get<float>();
+        if (job.contains("fov")) fov = job.at("fov").get<float>();
+        if (job.contains("cameras")) {
+            cameras.clear();
+            for(const auto& entry : job.at("cameras")) {
+                Camera camera;
+                camera.eye = entry.contains("eye") ? readVector(entry.at("eye"), "eye") : eye;
+                camera.theta = entry.value("theta", theta);
+                camera.phi = entry.value("phi", phi);
+                camera.fov = entry.value("fov", fov);
+                cameras.push_back(camera);
+            }
+        }
+        if (job.contains("spp")) spp = job.at("spp").get<uint32_t>();
+        if (job.contains("seconds")) seconds = job.at("seconds").get<double>();
+    } catch (const json::exception& e) {
+        throw std::runtime_error(e.what());
+    }
+
+    if (width == 0 || height == 0) {
+        throw std::runtime_error("width and height must be positive");
+    }
+}
+
+std::vector<Camera> OfflineJob::Cameras() const {
+    if (!cameras.empty()) {
+        return cameras;
+    }
+    Camera camera;
+    camera.eye = eye;
+    camera.theta = theta;
+    camera.phi = phi;
+    camera.fov = fov;
+    return {camera};
+}
+
+std::filesystem::path OfflineJob::OutputPath(uint32_t camera) const {
+    std::filesystem::path path = output;
+    if (cameras.size() <= 1) {
+        return path;
+    }
+    const auto extension = path.extension();
+    path.replace_extension();
+    path += fmt::format("_{}", camera);
+    path += extension;
+    return path;
+}
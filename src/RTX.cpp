@@ -1,29 +1,60 @@
 #include <RTX.h>
+#include <algorithm>
+#include <numeric>
 
-RTX::RTX(AppBase& app, Scene& scene, RTXConfig& config) : app(app), config(config), scene(scene) {
+RTX::RTX(AppBase& app, Scene& scene, const RTXConfig& config) : app(app), config(config), scene(scene) {
+    if (config.materialSlots <= config.framesInFlight) {
+        throw std::runtime_error("RTXConfig::materialSlots must exceed framesInFlight");
+    }
+    // checked before anything is created, the images would otherwise fail with a less helpful error
+    checkFrameSize(config.width, config.height, config.cameraCount);
     getProperties();
-    resources.skybox = ImageTools::LoadImageD(app, vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageUsageFlagBits::eSampled, "./skybox.jpg");
+    this->host_build = config.hostBuild && acceleration_structure_features.accelerationStructureHostCommands;
+    if (config.hostBuild && !host_build) {
+        logger::warn("Host acceleration structure builds are not supported by this device or RTXHostBuild was not required, building on the device");
+    }
+    createEnvironment();
+    createSamplerTables();
     createBottomLevelAS();
     createTopLevelAS();
     createMaterialBuffer();
+    createLightBuffer();
+    createGeometryInfoBuffer();
     createTextureBuffer();
-    createStorageImage();
+    createFrameImages();
+    createConvergencePass();
     createPipeline();
     createShaderBindingTable();
     createDescriptorSet();
+    createReprojectionPass();
+    writeFrameDescriptors();
+    app.uploader->Finish();
 }
 
 void RTX::Destroy() {
-    ImageTools::DestroyImage(app, storage_image);
+    destroyFrameImages();
     ImageTools::DestroyImage(app, resources.skybox);
-
-
-    for(auto& instance : resources.instances) {
-        app.vk_device.destroyAccelerationStructureKHR(instance.acceleration_structure.handle, nullptr, app.vk_ext_dispatcher);
-        buffertools::DestroyBuffer(app, instance.acceleration_structure.buffer);
-        buffertools::DestroyBuffer(app, instance.vertex_buffer);
-        buffertools::DestroyBuffer(app, instance.index_buffer);
-        buffertools::DestroyBuffer(app, instance.transformation_buffer);
+    buffertools::DestroyBuffer(app, resources.environment_alias_buffer);
+    buffertools::DestroyBuffer(app, resources.environment_pdf_buffer);
+    buffertools::DestroyBuffer(app, resources.sobol_buffer);
+    buffertools::DestroyBuffer(app, resources.blue_noise_buffer);
+    buffertools::DestroyBuffer(app, resources.convergence_buffer);
+    buffertools::UnmapBuffer(app, resources.convergence_readback);
+    buffertools::DestroyBuffer(app, resources.convergence_readback);
+    app.vk_device.freeDescriptorSets(app.vk_descriptor_pool, convergence_descriptor_set);
+    convergence_pipeline->Destroy(app);
+    app.vk_device.freeDescriptorSets(app.vk_descriptor_pool, reprojection_descriptor_set);
+    reprojection_pipeline->Destroy(app);
+
+
+    for(auto& mesh : resources.meshes) {
+        app.vk_device.destroyAccelerationStructureKHR(mesh.acceleration_structure.handle, nullptr, app.vk_ext_dispatcher);
+        buffertools::DestroyBuffer(app, mesh.acceleration_structure.buffer);
+        buffertools::DestroyBuffer(app, mesh.vertex_buffer);
+        buffertools::DestroyBuffer(app, mesh.index_buffer);
+        if (mesh.transform_buffer.handle) {
+            buffertools::DestroyBuffer(app, mesh.transform_buffer);
+        }
     }
 
     for(auto& texture : resources.textures) {
@@ -34,37 +65,287 @@ void RTX::Destroy() {
     buffertools::DestroyBuffer(app, resources.uniform_buffer);
     app.vk_device.destroyAccelerationStructureKHR(resources.top.handle, nullptr, app.vk_ext_dispatcher);
     buffertools::DestroyBuffer(app, resources.top.buffer);
+    buffertools::UnmapBuffer(app, resources.material_buffer);
     buffertools::DestroyBuffer(app, resources.material_buffer);
+    buffertools::DestroyBuffer(app, resources.geometry_info_buffer);
+    buffertools::DestroyBuffer(app, resources.light_buffer);
+    buffertools::DestroyBuffer(app, resources.alias_buffer);
 
 
 
     buffertools::DestroyBuffer(app, binding_table.raygen);
     buffertools::DestroyBuffer(app, binding_table.miss);
     buffertools::DestroyBuffer(app, binding_table.hit);
+    // the pool outlives this RTX, benchmarks create several of them
+    app.vk_device.freeDescriptorSets(app.vk_descriptor_pool, descriptor_set);
     app.vk_device.destroyPipeline(this->pipeline);
     app.vk_device.destroyPipelineLayout(this->pipeline_layout);
     app.vk_device.destroyDescriptorSetLayout(this->descr_layout);
 }
 
-void RTX::Record(vk::CommandBuffer cmdBuffer, uint32_t tick, const Camera& camera) {
-    float aspectRatio = static_cast<float>(config.width) / static_cast<float>(config.height);
-    resources.uniform_buffer_data->proj = glm::perspective(glm::radians(50.0f), aspectRatio, 0.0001f, 10000.0f);
-    resources.uniform_buffer_data->proj[1][1] *= -1;
-    resources.uniform_buffer_data->projInverse = glm::inverse(resources.uniform_buffer_data->proj);
-    resources.uniform_buffer_data->view = camera.getViewMatrix();
-    resources.uniform_buffer_data->viewInverse = glm::inverse(resources.uniform_buffer_data->view);
-    resources.uniform_buffer_data->viewDirection = glm::vec4(camera.getViewDir(), 0.0f);
-    resources.uniform_buffer_data->time = static_cast<float>(glfwGetTime());
-    resources.uniform_buffer_data->tick = tick;
+// push constants of raygen.rgen, BenchmarkTrace records several launches against the same uniform slot so
+// everything that differs between launches has to live here
+struct LaunchConstants {
+    uint32_t tick;
+    uint32_t sample_offset;
+    uint32_t samples_per_launch;
+    float time;
+    uint32_t scramble_seed;
+};
+
+void RTX::Record(vk::CommandBuffer cmdBuffer, uint32_t frame, uint32_t tick, std::span<const Camera> cameras, bool reproject) {
+    if (cameras.empty() || cameras.size() > config.cameraCount) {
+        throw std::runtime_error(fmt::format("Record takes 1 to {} cameras, got {}", config.cameraCount, cameras.size()));
+    }
+    const uint32_t cameraCount = static_cast<uint32_t>(cameras.size());
+    // there is only something to carry over once a frame has been traced, and only from the one camera it was traced for
+    reproject = reproject && config.temporalReprojection && tick <= 1 && resources.accumulated_samples > 0
+        && cameraCount == 1 && resources.active_cameras == 1;
+    resources.active_cameras = cameraCount;
+    if (tick <= 1) {
+        // a reprojected accumulation continues the sequence of the old one, anything else gets a sequence of its own
+        if (!reproject) {
+            resources.accumulation++;
+        }
+        resources.sample_offset = reproject ? resources.sample_offset + resources.accumulated_samples : 0;
+        resources.accumulated_samples = 0;
+        resources.convergence_samples = 0;
+    }
+
+    // the other slots may still be read by frames in flight
+    const uint32_t uniformOffset = static_cast<uint32_t>(frame * resources.uniform_slot_size);
+    auto& uniforms = *reinterpret_cast<UniformData*>(resources.uniform_buffer_data + uniformOffset);
+    const float aspectRatio = static_cast<float>(config.width) / static_cast<float>(config.height);
+    glm::mat4 viewProjection;
+    for(uint32_t i=0; i<cameraCount; i++) {
+        glm::mat4 proj = glm::perspective(glm::radians(cameras[i].fov), aspectRatio, 0.0001f, 10000.0f);
+        proj[1][1] *= -1;
+        const glm::mat4 view = cameras[i].getViewMatrix();
+        uniforms.cameras[i] = CameraData {
+            .proj = proj,
+            .projInverse = glm::inverse(proj),
+            .view = view,
+            .viewInverse = glm::inverse(view),
+            .viewDirection = glm::vec4(cameras[i].getViewDir(), 0.0f),
+        };
+        if (i == 0) {
+            viewProjection = proj * view;
+        }
+    }
+    uniforms.light_count = config.nextEventEstimation ? resources.light_count : 0;
+    uniforms.environment_sampling = config.nextEventEstimation && config.environmentSampling && resources.environment_sampling;
+    uniforms.sample_sequence = config.sampleSequence;
+    buffertools::FlushBuffer(app, resources.uniform_buffer, uniformOffset, offsetof(UniformData, cameras) + cameraCount * sizeof(CameraData));
+
+    const LaunchConstants launch {
+        .tick = tick,
+        .sample_offset = resources.sample_offset + resources.accumulated_samples,
+        .samples_per_launch = config.samplesPerLaunch,
+        .time = std::chrono::duration<float>(std::chrono::steady_clock::now() - created).count(),
+        .scramble_seed = resources.accumulation,
+    };
     const uint32_t handleSizeAlligned = vk::tools::allignedSize(pipeline_properties.shaderGroupHandleSize, pipeline_properties.shaderGroupHandleAlignment);
     vk::StridedDeviceAddressRegionKHR raygenEntry { .deviceAddress = binding_table.raygen_address, .stride = handleSizeAlligned, .size = handleSizeAlligned };
-    vk::StridedDeviceAddressRegionKHR missEntry { .deviceAddress = binding_table.miss_address, .stride = handleSizeAlligned, .size = handleSizeAlligned };
+    vk::StridedDeviceAddressRegionKHR missEntry { .deviceAddress = binding_table.miss_address, .stride = handleSizeAlligned, .size = 2 * handleSizeAlligned };
     vk::StridedDeviceAddressRegionKHR hitEntry { .deviceAddress = binding_table.hit_address, .stride = handleSizeAlligned, .size = handleSizeAlligned };
     vk::StridedDeviceAddressRegionKHR callableEntry{};
 
+    if (resources.materials_dirty) {
+        // the slot written last is still in use by earlier frames, the next one no longer is
+        resources.material_slot = (resources.material_slot + 1) % config.materialSlots;
+        const vk::DeviceSize offset = resources.material_slot * resources.material_slot_size;
+        memcpy(resources.material_buffer_data + offset, scene.materials.data(), scene.materials.size() * sizeof(GLTFMaterial));
+        buffertools::FlushBuffer(app, resources.material_buffer, offset, resources.material_slot_size);
+        resources.materials_dirty = false;
+    }
+    const uint32_t materialOffset = static_cast<uint32_t>(resources.material_slot * resources.material_slot_size);
+
+    // a fresh accumulation traces every tile again and forgets the progress of the old one
+    if (tick <= 1) {
+        vk::MemoryBarrier clearBarrier {
+            .srcAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferRead,
+            .dstAccessMask = vk::AccessFlagBits::eTransferWrite,
+        };
+        cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, {clearBarrier}, {}, {});
+        cmdBuffer.fillBuffer(resources.tile_mask_buffer.handle, 0, VK_WHOLE_SIZE, 1);
+        cmdBuffer.fillBuffer(resources.convergence_buffer.handle, 0, VK_WHOLE_SIZE, 0);
+        vk::MemoryBarrier maskBarrier {
+            .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+            .dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+        };
+        cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eComputeShader, {}, {maskBarrier}, {}, {});
+    }
+    if (reproject) {
+        recordHistoryCopy(cmdBuffer);
+    }
+
     cmdBuffer.bindPipeline(vk::PipelineBindPoint::eRayTracingKHR, pipeline);
-    cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eRayTracingKHR, pipeline_layout, 0, descriptor_set, {});
-    cmdBuffer.traceRaysKHR(&raygenEntry, &missEntry, &hitEntry, &callableEntry, config.width, config.height, 1, app.vk_ext_dispatcher);
+    // dynamic offsets go in binding order, the uniforms at 2 and the materials at 5
+    cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eRayTracingKHR, pipeline_layout, 0, descriptor_set, {uniformOffset, materialOffset});
+    cmdBuffer.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eRaygenKHR, 0, sizeof(LaunchConstants), &launch);
+    cmdBuffer.traceRaysKHR(&raygenEntry, &missEntry, &hitEntry, &callableEntry, config.width, config.height, cameraCount, app.vk_ext_dispatcher);
+    resources.accumulated_samples += config.samplesPerLaunch;
+    if (reproject) {
+        recordReprojectionPass(cmdBuffer, uniformOffset);
+    }
+    recordConvergencePass(cmdBuffer);
+    recordConvergenceReadback(cmdBuffer, frame);
+
+    resources.previous_view_projection = viewProjection;
+    resources.previous_eye = cameras[0].eye;
+}
+
+// push constants of reproject.comp
+struct ReprojectionSettings {
+    glm::mat4 previous_view_projection;
+    glm::vec4 previous_eye;
+};
+
+void RTX::recordHistoryCopy(vk::CommandBuffer cmdBuffer) {
+    vk::MemoryBarrier copyBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite,
+    };
+    cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, {copyBarrier}, {}, {});
+
+    const vk::ImageSubresourceLayers layers {
+        .aspectMask = vk::ImageAspectFlagBits::eColor,
+        .mipLevel = 0,
+        .baseArrayLayer = 0,
+        .layerCount = 1,
+    };
+    const vk::ImageCopy region {
+        .srcSubresource = layers,
+        .srcOffset = {0, 0, 0},
+        .dstSubresource = layers,
+        .dstOffset = {0, 0, 0},
+        .extent = {config.width, config.height, 1},
+    };
+    // every image involved is only ever used in the general layout while recording
+    cmdBuffer.copyImage(storage_image.handle, vk::ImageLayout::eGeneral, resources.history_image.handle, vk::ImageLayout::eGeneral, region);
+    cmdBuffer.copyImage(resources.moments_image.handle, vk::ImageLayout::eGeneral, resources.history_moments_image.handle, vk::ImageLayout::eGeneral, region);
+    cmdBuffer.copyImage(resources.gbuffer_image.handle, vk::ImageLayout::eGeneral, resources.history_gbuffer_image.handle, vk::ImageLayout::eGeneral, region);
+
+    vk::MemoryBarrier historyBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlagBits::eShaderRead,
+    };
+    cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eComputeShader, {}, {historyBarrier}, {}, {});
+}
+
+void RTX::recordReprojectionPass(vk::CommandBuffer cmdBuffer, uint32_t uniformOffset) {
+    vk::MemoryBarrier traceBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+    };
+    cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::PipelineStageFlagBits::eComputeShader, {}, {traceBarrier}, {}, {});
+
+    const ReprojectionSettings settings {
+        .previous_view_projection = resources.previous_view_projection,
+        .previous_eye = glm::vec4(resources.previous_eye, 1.0f),
+    };
+    cmdBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, reprojection_pipeline->pipeline);
+    cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, reprojection_pipeline->layout, 0, reprojection_descriptor_set, uniformOffset);
+    cmdBuffer.pushConstants(reprojection_pipeline->layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(ReprojectionSettings), &settings);
+    cmdBuffer.dispatch(resources.tiles_x, resources.tiles_y, 1);
+
+    vk::MemoryBarrier reprojectBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+    };
+    cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eComputeShader, {}, {reprojectBarrier}, {}, {});
+}
+
+// push constants of convergence.comp
+struct ConvergenceSettings {
+    float target_error;
+    uint32_t min_samples;
+};
+
+void RTX::recordConvergencePass(vk::CommandBuffer cmdBuffer) {
+    if (!config.adaptiveSampling || resources.accumulated_samples < config.convergenceMinSamples
+            || resources.accumulated_samples - resources.convergence_samples < CONVERGENCE_INTERVAL) {
+        return;
+    }
+    resources.convergence_samples = resources.accumulated_samples;
+
+    vk::MemoryBarrier traceBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eShaderRead,
+    };
+    cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::PipelineStageFlagBits::eComputeShader, {}, {traceBarrier}, {}, {});
+    cmdBuffer.fillBuffer(resources.convergence_buffer.handle, 0, VK_WHOLE_SIZE, 0);
+    vk::MemoryBarrier clearBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+    };
+    cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, {clearBarrier}, {}, {});
+
+    const ConvergenceSettings settings {
+        .target_error = config.convergenceTarget,
+        .min_samples = config.convergenceMinSamples,
+    };
+    cmdBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, convergence_pipeline->pipeline);
+    cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, convergence_pipeline->layout, 0, convergence_descriptor_set, {});
+    cmdBuffer.pushConstants(convergence_pipeline->layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(ConvergenceSettings), &settings);
+    cmdBuffer.dispatch(resources.tiles_x, resources.tiles_y, resources.active_cameras);
+
+    // the next launch reads the mask, the readback copy the stats
+    vk::MemoryBarrier maskBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead,
+    };
+    cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eTransfer, {}, {maskBarrier}, {}, {});
+}
+
+void RTX::recordConvergenceReadback(vk::CommandBuffer cmdBuffer, uint32_t frame) {
+    // the stats may have just been cleared by a restart
+    vk::MemoryBarrier clearBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlagBits::eTransferRead,
+    };
+    cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, {clearBarrier}, {}, {});
+    const vk::BufferCopy region {
+        .srcOffset = 0,
+        .dstOffset = frame * sizeof(ConvergenceStats),
+        .size = sizeof(ConvergenceStats),
+    };
+    cmdBuffer.copyBuffer(resources.convergence_buffer.handle, resources.convergence_readback.handle, region);
+
+    // later clears of the stats wait for the copy, the host reads the slot once the frame's fence signaled
+    vk::MemoryBarrier readbackBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlagBits::eHostRead | vk::AccessFlagBits::eTransferWrite,
+    };
+    cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eHost, {}, {readbackBarrier}, {}, {});
+}
+
+ConvergenceStats RTX::Convergence(uint32_t frame) {
+    vmaInvalidateAllocation(app.vma_allocator, resources.convergence_readback.allocation, frame * sizeof(ConvergenceStats), sizeof(ConvergenceStats));
+    return resources.convergence_data[frame];
+}
+
+void RTX::UpdateMaterials() {
+    if (scene.materials.size() * sizeof(GLTFMaterial) > resources.material_slot_size) {
+        throw std::runtime_error("Materials cannot be added after the RTX is created");
+    }
+    resources.materials_dirty = true;
+
+    // emitters that appeared, went dark or stopped being opaque change which triangles are lights and every light's pdf
+    std::vector<float> emission(scene.materials.size());
+    std::transform(scene.materials.begin(), scene.materials.end(), emission.begin(), lighttools::EmittedLuminance);
+    if (emission == resources.light_emission) {
+        return;
+    }
+    // frames in flight still sample the old tables
+    app.vk_device.waitIdle();
+    buffertools::DestroyBuffer(app, resources.light_buffer);
+    buffertools::DestroyBuffer(app, resources.alias_buffer);
+    buffertools::DestroyBuffer(app, resources.geometry_info_buffer);
+    createLightBuffer();
+    createGeometryInfoBuffer();
+    app.uploader->Finish();
+    writeLightDescriptors();
 }
 
 vk::Sampler RTX::CreateStorageImageSampler() {
@@ -87,181 +368,784 @@ void RTX::getProperties() {
     vk::PhysicalDeviceFeatures2 deviceFeatures{};
     deviceFeatures.pNext = &acceleration_structure_features;
     app.vk_physical_device.getFeatures2(&deviceFeatures);
+    // host commands are only usable when RTXHostBuild enabled them on the device
+    acceleration_structure_features.accelerationStructureHostCommands &= vk_init<RTX>::AccelerationStructureFeatures().accelerationStructureHostCommands;
+}
+
+void RTX::Resize(uint32_t width, uint32_t height, uint32_t cameraCount) {
+    if (width == config.width && height == config.height && cameraCount == config.cameraCount) {
+        return;
+    }
+    // everything that can be checked up front is, so a rejected size leaves the current images alone
+    checkFrameSize(width, height, cameraCount);
+    const vk::DeviceSize required = frameImageBytes(width, height, cameraCount);
+    const vk::DeviceSize available = deviceMemoryAvailable() + frameImageBytes(config.width, config.height, config.cameraCount);
+    if (required > available) {
+        throw std::runtime_error(fmt::format("{}x{} with {} cameras needs {} MiB of device memory, only {} MiB is available",
+                width, height, cameraCount, required >> 20, available >> 20));
+    }
+
+    app.vk_device.waitIdle();
+    const RTXConfig previous = config;
+    destroyFrameImages();
+    config.width = width;
+    config.height = height;
+    config.cameraCount = cameraCount;
+    try {
+        createFrameImages();
+    } catch (const std::exception& e) {
+        // the estimate can be off, put back the images of the old size so RTX stays usable
+        logger::warn("Resizing to {}x{} failed, keeping {}x{}: {}", width, height, previous.width, previous.height, e.what());
+        destroyFrameImages();
+        config.width = previous.width;
+        config.height = previous.height;
+        config.cameraCount = previous.cameraCount;
+        createFrameImages();
+        writeFrameDescriptors();
+        app.uploader->Finish();
+        throw;
+    }
+    writeFrameDescriptors();
+    app.uploader->Finish();
+    // the new images hold nothing to reproject from
+    resources.accumulated_samples = 0;
 }
 
-void RTX::createStorageImage() {
-    this->storage_image = ImageTools::CreateImageD(app, config.width, config.height, vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled, vk::Format::eR32G32B32A32Sfloat, vk::ImageLayout::eShaderReadOnlyOptimal);
+void RTX::checkFrameSize(uint32_t width, uint32_t height, uint32_t cameraCount) const {
+    const auto limits = app.vk_physical_device.getProperties().limits;
+    // one image layer per camera, so the device can limit them below MAX_CAMERAS as well
+    const uint32_t maxCameras = std::min(MAX_CAMERAS, limits.maxImageArrayLayers);
+    if (cameraCount == 0 || cameraCount > maxCameras) {
+        throw std::runtime_error(fmt::format("RTXConfig::cameraCount must be between 1 and {}", maxCameras));
+    }
+    if (width == 0 || height == 0 || width > limits.maxImageDimension2D || height > limits.maxImageDimension2D) {
+        throw std::runtime_error(fmt::format("{}x{} is not a valid size, both sides must be between 1 and {}", width, height, limits.maxImageDimension2D));
+    }
+}
+
+vk::DeviceSize RTX::frameImageBytes(uint32_t width, uint32_t height, uint32_t cameraCount) const {
+    const vk::DeviceSize pixels = vk::DeviceSize(width) * height;
+    const vk::DeviceSize tiles = vk::DeviceSize((width + CONVERGENCE_TILE_SIZE - 1) / CONVERGENCE_TILE_SIZE) * ((height + CONVERGENCE_TILE_SIZE - 1) / CONVERGENCE_TILE_SIZE);
+    // storage, gbuffer and moments per camera, the history only for the first
+    return pixels * cameraCount * (16 + 16 + 4) + tiles * cameraCount * sizeof(uint32_t) + pixels * (16 + 4 + 16);
+}
+
+vk::DeviceSize RTX::deviceMemoryAvailable() const {
+    std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets;
+    vmaGetHeapBudgets(app.vma_allocator, budgets.data());
+    const auto memoryProperties = app.vk_physical_device.getMemoryProperties();
+    vk::DeviceSize available = 0;
+    for(uint32_t i=0; i<memoryProperties.memoryHeapCount; i++) {
+        if (memoryProperties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal && budgets[i].budget > budgets[i].usage) {
+            available = std::max(available, budgets[i].budget - budgets[i].usage);
+        }
+    }
+    return available;
+}
+
+void RTX::createFrameImages() {
+    // one layer per camera, the reprojection history only ever covers the first
+    const uint32_t layers = config.cameraCount;
+    this->storage_image = ImageTools::CreateImageArrayD(app, config.width, config.height, layers, vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc, vk::Format::eR32G32B32A32Sfloat, vk::ImageLayout::eShaderReadOnlyOptimal);
+    resources.gbuffer_image = ImageTools::CreateImageArrayD(app, config.width, config.height, layers, vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc, vk::Format::eR32G32B32A32Sfloat, vk::ImageLayout::eGeneral);
+
+    resources.tiles_x = (config.width + CONVERGENCE_TILE_SIZE - 1) / CONVERGENCE_TILE_SIZE;
+    resources.tiles_y = (config.height + CONVERGENCE_TILE_SIZE - 1) / CONVERGENCE_TILE_SIZE;
+    // only ever used as a storage image, so it stays in the general layout
+    resources.moments_image = ImageTools::CreateImageArrayD(app, config.width, config.height, layers, vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc, vk::Format::eR32Sfloat, vk::ImageLayout::eGeneral);
+    std::vector<uint32_t> mask(resources.tiles_x * resources.tiles_y * layers, 1);
+    resources.tile_mask_buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, mask.size() * sizeof(uint32_t), mask.data());
+
+    const auto historyUsage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferDst;
+    resources.history_image = ImageTools::CreateImageArrayD(app, config.width, config.height, 1, historyUsage, vk::Format::eR32G32B32A32Sfloat, vk::ImageLayout::eGeneral);
+    resources.history_moments_image = ImageTools::CreateImageArrayD(app, config.width, config.height, 1, historyUsage, vk::Format::eR32Sfloat, vk::ImageLayout::eGeneral);
+    resources.history_gbuffer_image = ImageTools::CreateImageArrayD(app, config.width, config.height, 1, historyUsage, vk::Format::eR32G32B32A32Sfloat, vk::ImageLayout::eGeneral);
+}
+
+void RTX::destroyFrameImages() {
+    ImageTools::DestroyImage(app, storage_image);
+    ImageTools::DestroyImage(app, resources.gbuffer_image);
+    ImageTools::DestroyImage(app, resources.moments_image);
+    buffertools::DestroyBuffer(app, resources.tile_mask_buffer);
+    ImageTools::DestroyImage(app, resources.history_image);
+    ImageTools::DestroyImage(app, resources.history_moments_image);
+    ImageTools::DestroyImage(app, resources.history_gbuffer_image);
+    // a createFrameImages that throws halfway leaves null handles behind, which are safe to destroy again
+    storage_image = {};
+    resources.gbuffer_image = {};
+    resources.moments_image = {};
+    resources.tile_mask_buffer = {};
+    resources.history_image = {};
+    resources.history_moments_image = {};
+    resources.history_gbuffer_image = {};
+}
+
+void RTX::writeFrameDescriptors() {
+    auto general = [](vk::ImageView view) {
+        return vk::DescriptorImageInfo { .imageView = view, .imageLayout = vk::ImageLayout::eGeneral };
+    };
+    // in the order of the reprojection bindings
+    std::array<vk::DescriptorImageInfo, 6> imageInfos {
+        general(storage_image.view),
+        general(resources.moments_image.view),
+        general(resources.gbuffer_image.view),
+        general(resources.history_image.view),
+        general(resources.history_moments_image.view),
+        general(resources.history_gbuffer_image.view),
+    };
+    vk::DescriptorBufferInfo maskInfo {
+        .buffer = resources.tile_mask_buffer.handle,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+
+    std::vector<vk::WriteDescriptorSet> writes {
+        vk::inits::writeDescriptorSetImage(descriptor_set, vk::DescriptorType::eStorageImage, 0, &imageInfos[0]),
+        vk::inits::writeDescriptorSetImage(descriptor_set, vk::DescriptorType::eStorageImage, 15, &imageInfos[1]),
+        vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eStorageBuffer, 16, &maskInfo),
+        vk::inits::writeDescriptorSetImage(descriptor_set, vk::DescriptorType::eStorageImage, 17, &imageInfos[2]),
+        vk::inits::writeDescriptorSetImage(convergence_descriptor_set, vk::DescriptorType::eStorageImage, 0, &imageInfos[0]),
+        vk::inits::writeDescriptorSetImage(convergence_descriptor_set, vk::DescriptorType::eStorageImage, 1, &imageInfos[1]),
+        vk::inits::writeDescriptorSetBuffer(convergence_descriptor_set, vk::DescriptorType::eStorageBuffer, 2, &maskInfo),
+    };
+    for(uint32_t i=0; i<imageInfos.size(); i++) {
+        writes.push_back(vk::inits::writeDescriptorSetImage(reprojection_descriptor_set, vk::DescriptorType::eStorageImage, i, &imageInfos[i]));
+    }
+    app.vk_device.updateDescriptorSets(writes, {});
+}
+
+void RTX::createConvergencePass() {
+    ConvergenceStats noStats{};
+    resources.convergence_buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, sizeof(ConvergenceStats), &noStats);
+    resources.convergence_readback = buffertools::CreateBufferD2H(app, vk::BufferUsageFlagBits::eTransferDst, config.framesInFlight * sizeof(ConvergenceStats));
+    resources.convergence_data = reinterpret_cast<ConvergenceStats*>(buffertools::MapBuffer(app, resources.convergence_readback));
+    std::fill_n(resources.convergence_data, config.framesInFlight, ConvergenceStats{});
+
+    std::vector<vk::DescriptorSetLayoutBinding> bindings {
+        { .binding = 0, .descriptorType = vk::DescriptorType::eStorageImage, .descriptorCount = 1 },
+        { .binding = 1, .descriptorType = vk::DescriptorType::eStorageImage, .descriptorCount = 1 },
+        { .binding = 2, .descriptorType = vk::DescriptorType::eStorageBuffer, .descriptorCount = 1 },
+        { .binding = 3, .descriptorType = vk::DescriptorType::eStorageBuffer, .descriptorCount = 1 },
+    };
+    convergence_pipeline.emplace(app, "./shaders_bin/convergence.comp.spv", bindings, sizeof(ConvergenceSettings));
+    convergence_descriptor_set = convergence_pipeline->AllocateDescriptor(app);
+
+    // the images and the tile mask are written by writeFrameDescriptors
+    vk::DescriptorBufferInfo statsInfo {
+        .buffer = resources.convergence_buffer.handle,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    auto statsWrite = vk::inits::writeDescriptorSetBuffer(convergence_descriptor_set, vk::DescriptorType::eStorageBuffer, 3, &statsInfo);
+    app.vk_device.updateDescriptorSets({statsWrite}, {});
+}
+
+void RTX::createReprojectionPass() {
+    std::vector<vk::DescriptorSetLayoutBinding> bindings;
+    for(uint32_t binding=0; binding<6; binding++) {
+        bindings.push_back({ .binding = binding, .descriptorType = vk::DescriptorType::eStorageImage, .descriptorCount = 1 });
+    }
+    bindings.push_back({ .binding = 6, .descriptorType = vk::DescriptorType::eUniformBufferDynamic, .descriptorCount = 1 });
+    reprojection_pipeline.emplace(app, "./shaders_bin/reproject.comp.spv", bindings, sizeof(ReprojectionSettings));
+    reprojection_descriptor_set = reprojection_pipeline->AllocateDescriptor(app);
+
+    // the images are written by writeFrameDescriptors
+    vk::DescriptorBufferInfo uniformInfo {
+        .buffer = resources.uniform_buffer.handle,
+        .offset = 0,
+        .range = sizeof(UniformData),
+    };
+    auto uniformWrite = vk::inits::writeDescriptorSetBuffer(reprojection_descriptor_set, vk::DescriptorType::eUniformBufferDynamic, 6, &uniformInfo);
+    app.vk_device.updateDescriptorSets({uniformWrite}, {});
 }
 
 void RTX::createTextureBuffer() {
+    size_t deviceBytes = 0, uncompressedBytes = 0;
     for(const auto& texture : scene.textures) {
-        resources.textures.push_back(ImageTools::CreateImageD(app, texture.width, texture.height, vk::ImageUsageFlagBits::eSampled, vk::Format::eR8G8B8A8Unorm, vk::ImageLayout::eShaderReadOnlyOptimal, (void*)texture.data.data()));
+        resources.textures.push_back(ImageTools::CreateImageMipsD(app, texture.width, texture.height, texture.mip_levels, vk::ImageUsageFlagBits::eSampled, texture.format, vk::ImageLayout::eShaderReadOnlyOptimal, texture.Data().data()));
+        deviceBytes += texture.Data().size();
+        uncompressedBytes += size_t(texture.width) * texture.height * 4;
     }
+    logger::info("Uploaded {} textures: {:.2f} MiB in VRAM against {:.2f} MiB as single level RGBA8",
+            scene.textures.size(), deviceBytes / (1024.0 * 1024.0), uncompressedBytes / (1024.0 * 1024.0));
 }
 
 
 void RTX::createBottomLevelAS() {
+    std::optional<ASCache> cache;
+    if (config.accelerationStructureCache != nullptr && !host_build) {
+        cache.emplace(app, config.accelerationStructureCache);
+    }
+
+    std::vector<BLASBuild> builds;
+    std::vector<std::pair<uint32_t, std::vector<uint8_t>>> cached;
+
+    // host builds point into the mesh data, it must not move while builds are prepared
+    resources.meshes.reserve(scene.meshes.size());
+    size_t vertexBytes = 0, indexBytes = 0, fullBytes = 0;
     uint32_t runningGeometryCount = 0;
-    for(const auto& mesh : scene.meshes) {
-        InstanceData instanceData{};
-        instanceData.primitives = mesh.primitives;
-        instanceData.geometry_offset = runningGeometryCount;
+    for(uint32_t meshID = 0; meshID < scene.meshes.size(); meshID++) {
+        const auto& mesh = scene.meshes[meshID];
+        MeshData meshData{};
+        meshData.primitives = mesh.primitives;
+        meshData.geometry_offset = runningGeometryCount;
         runningGeometryCount += mesh.primitives.size();
 
-        std::vector<vk::AccelerationStructureGeometryKHR> meshGeometries;
-        std::vector<uint32_t> meshGeometiesTriangleCounts;
-        std::vector<vk::AccelerationStructureBuildRangeInfoKHR> meshGeomtriesBuildRanges;
-
-        const auto usage = vk::BufferUsageFlagBits::eShaderDeviceAddress;
-        instanceData.vertex_buffer = buffertools::CreateBufferD(app, usage | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eStorageBuffer, mesh.vertices.size() * sizeof(GLTFVertex), (void*)mesh.vertices.data());
-        vk::DeviceOrHostAddressConstKHR vertexBufferAddress { .deviceAddress = buffertools::GetBufferDeviceAddress(app, instanceData.vertex_buffer), };
-        instanceData.index_buffer = buffertools::CreateBufferD(app, usage | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eStorageBuffer, mesh.indices.size() * sizeof(uint32_t), (void*)mesh.indices.data());
-        vk::DeviceOrHostAddressConstKHR indexBufferAddress { .deviceAddress = buffertools::GetBufferDeviceAddress(app, instanceData.index_buffer), };
+        const auto usage = vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
+        meshData.vertex_buffer = buffertools::CreateBufferD(app, usage, mesh.VertexData().size(), (void*)mesh.VertexData().data());
+        meshData.index_buffer = buffertools::CreateBufferD(app, usage, mesh.IndexData().size(), (void*)mesh.IndexData().data());
+
+        const glm::vec3& scale = mesh.position_scale;
+        const glm::vec3& offset = mesh.position_offset;
+        meshData.position_transform = vk::TransformMatrixKHR {
+            .matrix = std::array<std::array<float,4>,3> {
+                std::array<float,4> { scale.x, 0, 0, offset.x },
+                std::array<float,4> { 0, scale.y, 0, offset.y },
+                std::array<float,4> { 0, 0, scale.z, offset.z },
+            }
+        };
+        if (scene.vertex_layout == VertexLayout::eQuantized) {
+            meshData.transform_buffer = buffertools::CreateBufferD(app, usage, sizeof(vk::TransformMatrixKHR), &meshData.position_transform);
+        }
+        resources.meshes.push_back(meshData);
 
-        std::vector<vk::TransformMatrixKHR> transformMatrices;
+        vertexBytes += mesh.VertexData().size();
+        indexBytes += mesh.IndexData().size();
         for(const auto& primitive : mesh.primitives) {
-            transformMatrices.push_back(vk::TransformMatrixKHR {
-                .matrix = std::array<std::array<float,4>,3> {
-                    std::array<float,4> { primitive.transform[0][0], primitive.transform[1][0], primitive.transform[2][0], primitive.transform[3][0] },
-                    std::array<float,4> { primitive.transform[0][1], primitive.transform[1][1], primitive.transform[2][1], primitive.transform[3][1] },
-                    std::array<float,4> { primitive.transform[0][2], primitive.transform[1][2], primitive.transform[2][2], primitive.transform[3][2] },
-                }
-            });
+            fullBytes += primitive.vertex_count * sizeof(GLTFVertex) + primitive.index_count * sizeof(uint32_t);
         }
-        instanceData.transformation_buffer = buffertools::CreateBufferD(app, usage | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR, transformMatrices.size() * sizeof(vk::TransformMatrixKHR), transformMatrices.data());
-        vk::DeviceOrHostAddressConstKHR transformationBufferAddress { .deviceAddress = buffertools::GetBufferDeviceAddress(app, instanceData.transformation_buffer), };
-
-
-
-        for(uint32_t primitiveID = 0; primitiveID < mesh.primitives.size(); primitiveID++) {
-            const auto& primitive = mesh.primitives[primitiveID];
-            vk::AccelerationStructureGeometryKHR geometry {
-                .geometryType = vk::GeometryTypeKHR::eTriangles,
-                .geometry = vk::AccelerationStructureGeometryDataKHR {
-                    .triangles = vk::AccelerationStructureGeometryTrianglesDataKHR {
-                        .vertexFormat = vk::Format::eR32G32B32Sfloat,
-                        .vertexData = vertexBufferAddress,
-                        .vertexStride = sizeof(GLTFVertex),
-                        .maxVertex = primitive.vertex_offset + primitive.vertex_count,
-                        .indexType = vk::IndexType::eUint32,
-                        .indexData = indexBufferAddress,
-                        .transformData = transformationBufferAddress,
-                    },
-                },
-                .flags = vk::GeometryFlagBitsKHR::eOpaque,
-            };
-            meshGeometries.push_back(geometry);
 
-            meshGeometiesTriangleCounts.push_back(primitive.index_count / 3);
-
-            vk::AccelerationStructureBuildRangeInfoKHR buildRange {
-                .primitiveCount = primitive.index_count / 3,
-                .primitiveOffset = primitive.index_offset * static_cast<uint32_t>(sizeof(uint32_t)),
-                .firstVertex = primitive.vertex_offset,
-                .transformOffset = primitiveID * static_cast<uint32_t>(sizeof(vk::TransformMatrixKHR)),
-            };
-            meshGeomtriesBuildRanges.push_back(buildRange);
+        uint64_t cacheKey = 0;
+        if (cache.has_value()) {
+            cacheKey = cache->Key(mesh, BLAS_BUILD_FLAGS);
+            if (auto data = cache->Load(cacheKey)) {
+                cached.emplace_back(meshID, std::move(data.value()));
+                continue;
+            }
         }
 
-        vk::AccelerationStructureBuildGeometryInfoKHR buildInfo {
-            .type = vk::AccelerationStructureTypeKHR::eBottomLevel,
-            .flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction,
-            .geometryCount = static_cast<uint32_t>(meshGeometries.size()),
-            .pGeometries = meshGeometries.data(),
+        builds.push_back(prepareBLASBuild(meshID, host_build ? vk::AccelerationStructureBuildTypeKHR::eHost : vk::AccelerationStructureBuildTypeKHR::eDevice));
+        builds.back().cache_key = cacheKey;
+    }
+
+    logger::info("Uploaded geometry: {:.2f} MiB of vertices and {:.2f} MiB of indices, {:.2f} MiB with full vertices and 32 bit indices",
+            vertexBytes / (1024.0 * 1024.0), indexBytes / (1024.0 * 1024.0), fullBytes / (1024.0 * 1024.0));
+
+    deserializeBLAS(cached);
+    if (host_build) {
+        buildBLASHost(builds);
+    } else {
+        buildAndCompactBLAS(builds);
+    }
+
+    for(const auto& build : builds) {
+        resources.meshes[build.mesh_id].acceleration_structure = build.structure;
+    }
+
+    if (cache.has_value()) {
+        serializeBLAS(builds, cache.value());
+        logger::info("BLAS cache: {} hits, {} misses", cache->hits, cache->misses);
+    }
+}
+
+BLASBuild RTX::prepareBLASBuild(uint32_t meshID, vk::AccelerationStructureBuildTypeKHR buildType) {
+    const auto& mesh = scene.meshes[meshID];
+    const auto& meshData = resources.meshes[meshID];
+
+    BLASBuild build{};
+    build.mesh_id = meshID;
+    build.build_type = buildType;
+
+    // geometry is built in mesh space, placement is left to the top level instances
+    vk::DeviceOrHostAddressConstKHR vertexBufferAddress, indexBufferAddress, transformAddress;
+    const bool quantized = scene.vertex_layout == VertexLayout::eQuantized;
+    if (buildType == vk::AccelerationStructureBuildTypeKHR::eHost) {
+        // host builds read the geometry straight from the scene
+        vertexBufferAddress.hostAddress = mesh.VertexData().data();
+        indexBufferAddress.hostAddress = mesh.IndexData().data();
+        transformAddress.hostAddress = quantized ? &meshData.position_transform : nullptr;
+    } else {
+        vertexBufferAddress.deviceAddress = buffertools::GetBufferDeviceAddress(app, meshData.vertex_buffer);
+        indexBufferAddress.deviceAddress = buffertools::GetBufferDeviceAddress(app, meshData.index_buffer);
+        transformAddress.deviceAddress = quantized ? buffertools::GetBufferDeviceAddress(app, meshData.transform_buffer) : 0;
+    }
+
+    std::vector<uint32_t> triangleCounts;
+    for(uint32_t primitiveID = 0; primitiveID < mesh.primitives.size(); primitiveID++) {
+        const auto& primitive = mesh.primitives[primitiveID];
+        vk::AccelerationStructureGeometryKHR geometry {
+            .geometryType = vk::GeometryTypeKHR::eTriangles,
+            .geometry = vk::AccelerationStructureGeometryDataKHR {
+                .triangles = vk::AccelerationStructureGeometryTrianglesDataKHR {
+                    .vertexFormat = vertextools::PositionFormat(scene.vertex_layout),
+                    .vertexData = vertexBufferAddress,
+                    .vertexStride = vertextools::Stride(scene.vertex_layout),
+                    .maxVertex = primitive.vertex_offset + primitive.vertex_count,
+                    .indexType = primitive.index_type,
+                    .indexData = indexBufferAddress,
+                    .transformData = transformAddress,
+                },
+            },
+            .flags = vk::GeometryFlagBitsKHR::eOpaque,
         };
+        build.geometries.push_back(geometry);
 
-        auto buildSizesInfo = app.vk_device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, buildInfo, meshGeometiesTriangleCounts, app.vk_ext_dispatcher);
-        auto stagingASBuffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, buildSizesInfo.accelerationStructureSize);
+        triangleCounts.push_back(primitive.index_count / 3);
 
-        vk::AccelerationStructureCreateInfoKHR createInfo {
-            .buffer = stagingASBuffer.handle,
-            .size = buildSizesInfo.accelerationStructureSize,
-            .type = vk::AccelerationStructureTypeKHR::eBottomLevel,
+        vk::AccelerationStructureBuildRangeInfoKHR buildRange {
+            .primitiveCount = primitive.index_count / 3,
+            .primitiveOffset = primitive.index_offset,
+            .firstVertex = primitive.vertex_offset,
+            .transformOffset = 0,
         };
-        auto stagingAS = app.vk_device.createAccelerationStructureKHR(createInfo, nullptr, app.vk_ext_dispatcher);
+        build.ranges.push_back(buildRange);
+        build.triangle_count += buildRange.primitiveCount;
+    }
 
-        Buffer scratchBuffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, buildSizesInfo.buildScratchSize);
+    build.build_info = vk::AccelerationStructureBuildGeometryInfoKHR {
+        .type = vk::AccelerationStructureTypeKHR::eBottomLevel,
+        .flags = BLAS_BUILD_FLAGS,
+        .mode = vk::BuildAccelerationStructureModeKHR::eBuild,
+        .geometryCount = static_cast<uint32_t>(build.geometries.size()),
+        .pGeometries = build.geometries.data(),
+    };
 
-        buildInfo.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
-        buildInfo.dstAccelerationStructure = stagingAS;
-        buildInfo.scratchData.deviceAddress = buffertools::GetBufferDeviceAddress(app, scratchBuffer);
+    build.sizes = app.vk_device.getAccelerationStructureBuildSizesKHR(buildType, build.build_info, triangleCounts, app.vk_ext_dispatcher);
+    build.structure.buffer = createASBuffer(build.sizes.accelerationStructureSize, buildType);
 
-        app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
-            cmdBuffer.buildAccelerationStructuresKHR(buildInfo, meshGeomtriesBuildRanges.data(), app.vk_ext_dispatcher);
-        });
-        buffertools::DestroyBuffer(app, scratchBuffer);
+    vk::AccelerationStructureCreateInfoKHR createInfo {
+        .buffer = build.structure.buffer.handle,
+        .size = build.sizes.accelerationStructureSize,
+        .type = vk::AccelerationStructureTypeKHR::eBottomLevel,
+    };
+    build.structure.handle = app.vk_device.createAccelerationStructureKHR(createInfo, nullptr, app.vk_ext_dispatcher);
+    build.build_info.dstAccelerationStructure = build.structure.handle;
+    return build;
+}
 
-        vk::QueryPoolCreateInfo poolInfo {
-            .queryType = vk::QueryType::eAccelerationStructureCompactedSizeKHR,
-            .queryCount = 1,
-        };
-        auto pool = app.vk_device.createQueryPool(poolInfo);
-        app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
-            cmdBuffer.resetQueryPool(pool, 0, 1, app.vk_ext_dispatcher);
-        });
+void RTX::buildAndCompactBLAS(std::vector<BLASBuild>& builds) {
+    if (builds.empty()) {
+        return;
+    }
 
-        app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
-            cmdBuffer.writeAccelerationStructuresPropertiesKHR({stagingAS}, vk::QueryType::eAccelerationStructureCompactedSizeKHR, pool, 0, app.vk_ext_dispatcher);
-        });
+    // builds are serialized on a single scratch buffer large enough for the biggest one
+    vk::DeviceSize scratchSize = 0;
+    for(const auto& build : builds) {
+        scratchSize = std::max(scratchSize, build.sizes.buildScratchSize);
+    }
+    Buffer scratchBuffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, scratchSize);
+    const uint64_t scratchAddress = buffertools::GetBufferDeviceAddress(app, scratchBuffer);
+
+    const uint32_t buildCount = static_cast<uint32_t>(builds.size());
+    vk::QueryPoolCreateInfo poolInfo {
+        .queryType = vk::QueryType::eAccelerationStructureCompactedSizeKHR,
+        .queryCount = buildCount,
+    };
+    auto pool = app.vk_device.createQueryPool(poolInfo);
 
-        vk::DeviceSize compactedSize;
-        vk::resultCheck(app.vk_device.getQueryPoolResults(pool, 0, 1, sizeof(vk::DeviceSize), &compactedSize, sizeof(vk::DeviceSize), vk::QueryResultFlagBits::eWait, app.vk_ext_dispatcher),"");
-        app.vk_device.destroyQueryPool(pool);
+    vk::MemoryBarrier buildBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+        .dstAccessMask = vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+    };
+
+    std::vector<vk::AccelerationStructureKHR> handles;
+    auto buildStart = std::chrono::steady_clock::now();
+    app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
+        cmdBuffer.resetQueryPool(pool, 0, buildCount, app.vk_ext_dispatcher);
+        for(auto& build : builds) {
+            build.build_info.pGeometries = build.geometries.data();
+            build.build_info.scratchData.deviceAddress = scratchAddress;
+            cmdBuffer.buildAccelerationStructuresKHR(build.build_info, build.ranges.data(), app.vk_ext_dispatcher);
+            cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {}, {buildBarrier}, {}, {});
+            handles.push_back(build.structure.handle);
+        }
+        cmdBuffer.writeAccelerationStructuresPropertiesKHR(handles, vk::QueryType::eAccelerationStructureCompactedSizeKHR, pool, 0, app.vk_ext_dispatcher);
+    });
+    const double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+    buffertools::DestroyBuffer(app, scratchBuffer);
 
-        logger::info("Compaction {}%", float(compactedSize) / buildSizesInfo.accelerationStructureSize);
+    std::vector<vk::DeviceSize> compactedSizes(buildCount);
+    vk::resultCheck(app.vk_device.getQueryPoolResults(pool, 0, buildCount, compactedSizes.size() * sizeof(vk::DeviceSize), compactedSizes.data(), sizeof(vk::DeviceSize), vk::QueryResultFlagBits::eWait | vk::QueryResultFlagBits::e64, app.vk_ext_dispatcher), "Error reading compacted BLAS sizes");
+    app.vk_device.destroyQueryPool(pool);
 
-        instanceData.acceleration_structure.buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, compactedSize);
+    std::vector<RTXAccelerationStructure> compacted(buildCount);
+    for(uint32_t i=0; i<buildCount; i++) {
+        compacted[i].buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, compactedSizes[i]);
         vk::AccelerationStructureCreateInfoKHR compactCreateInfo {
-            .buffer = instanceData.acceleration_structure.buffer.handle,
-            .size = compactedSize,
+            .buffer = compacted[i].buffer.handle,
+            .size = compactedSizes[i],
             .type = vk::AccelerationStructureTypeKHR::eBottomLevel,
         };
+        compacted[i].handle = app.vk_device.createAccelerationStructureKHR(compactCreateInfo, nullptr, app.vk_ext_dispatcher);
+    }
 
-        instanceData.acceleration_structure.handle = app.vk_device.createAccelerationStructureKHR(compactCreateInfo, nullptr, app.vk_ext_dispatcher);
-
-
-        app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
+    auto compactStart = std::chrono::steady_clock::now();
+    app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
+        for(uint32_t i=0; i<buildCount; i++) {
             vk::CopyAccelerationStructureInfoKHR copyInfo {
-                .src = stagingAS,
-                .dst = instanceData.acceleration_structure.handle,
+                .src = builds[i].structure.handle,
+                .dst = compacted[i].handle,
                 .mode = vk::CopyAccelerationStructureModeKHR::eCompact,
             };
             cmdBuffer.copyAccelerationStructureKHR(copyInfo, app.vk_ext_dispatcher);
+        }
+    });
+    const double compactSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - compactStart).count();
+
+    vk::DeviceSize totalBuilt = 0, totalCompacted = 0;
+    for(uint32_t i=0; i<buildCount; i++) {
+        app.vk_device.destroyAccelerationStructureKHR(builds[i].structure.handle, nullptr, app.vk_ext_dispatcher);
+        buffertools::DestroyBuffer(app, builds[i].structure.buffer);
+        builds[i].structure = compacted[i];
+
+        const vk::DeviceSize builtSize = builds[i].sizes.accelerationStructureSize;
+        totalBuilt += builtSize;
+        totalCompacted += compactedSizes[i];
+        logger::info("BLAS {}: {} geometries, {} triangles, {} -> {} bytes ({:.1f}%)",
+                builds[i].mesh_id, builds[i].geometries.size(), builds[i].triangle_count, builtSize, compactedSizes[i], 100.0 * compactedSizes[i] / builtSize);
+    }
+
+    blas_stats.build_ms = buildSeconds * 1000.0;
+    blas_stats.compacted_bytes = totalCompacted;
+    logger::info("Built {} BLASes in {:.2f} ms, compacted in {:.2f} ms, {:.2f} MiB -> {:.2f} MiB",
+            buildCount, buildSeconds * 1000.0, compactSeconds * 1000.0,
+            totalBuilt / (1024.0 * 1024.0), totalCompacted / (1024.0 * 1024.0));
+}
+
+// upper bound on the host scratch memory alive at once, builds are issued in waves below it
+constexpr size_t HOST_SCRATCH_BUDGET = size_t(1) << 31;
+
+void RTX::buildBLASHost(std::vector<BLASBuild>& builds) {
+    if (builds.empty()) {
+        return;
+    }
+
+    auto buildStart = std::chrono::steady_clock::now();
+    size_t first = 0;
+    while (first < builds.size()) {
+        size_t last = first;
+        size_t scratchBytes = 0;
+        while (last < builds.size() && (last == first || scratchBytes + builds[last].sizes.buildScratchSize <= HOST_SCRATCH_BUDGET)) {
+            scratchBytes += builds[last].sizes.buildScratchSize;
+            last++;
+        }
+
+        std::vector<std::vector<uint8_t>> scratch(last - first);
+        std::vector<vk::DeferredOperationKHR> operations;
+        for(size_t i = first; i < last; i++) {
+            auto& build = builds[i];
+            scratch[i - first].resize(build.sizes.buildScratchSize);
+            build.build_info.pGeometries = build.geometries.data();
+            build.build_info.scratchData.hostAddress = scratch[i - first].data();
+
+            const vk::AccelerationStructureBuildRangeInfoKHR* ranges = build.ranges.data();
+            auto operation = app.vk_device.createDeferredOperationKHR(nullptr, app.vk_ext_dispatcher);
+            auto result = app.vk_device.buildAccelerationStructuresKHR(operation, build.build_info, ranges, app.vk_ext_dispatcher);
+            if (result == vk::Result::eOperationDeferredKHR) {
+                joinDeferredOperation(operation);
+            }
+            operations.push_back(operation);
+        }
+        app.thread_pool->Wait();
+
+        for(auto operation : operations) {
+            vk::resultCheck(app.vk_device.getDeferredOperationResultKHR(operation, app.vk_ext_dispatcher), "Error building BLAS on the host");
+            app.vk_device.destroyDeferredOperationKHR(operation, nullptr, app.vk_ext_dispatcher);
+        }
+        first = last;
+    }
+    const double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+
+    std::vector<vk::AccelerationStructureKHR> handles;
+    for(const auto& build : builds) {
+        handles.push_back(build.structure.handle);
+    }
+    std::vector<vk::DeviceSize> compactedSizes(builds.size());
+    vk::resultCheck(app.vk_device.writeAccelerationStructuresPropertiesKHR(static_cast<uint32_t>(handles.size()), handles.data(), vk::QueryType::eAccelerationStructureCompactedSizeKHR, compactedSizes.size() * sizeof(vk::DeviceSize), compactedSizes.data(), sizeof(vk::DeviceSize), app.vk_ext_dispatcher), "Error reading compacted BLAS sizes");
+
+    vk::DeviceSize totalBuilt = 0, totalCompacted = 0;
+    for(size_t i=0; i<builds.size(); i++) {
+        RTXAccelerationStructure compacted;
+        compacted.buffer = createASBuffer(compactedSizes[i], vk::AccelerationStructureBuildTypeKHR::eHost);
+        vk::AccelerationStructureCreateInfoKHR compactCreateInfo {
+            .buffer = compacted.buffer.handle,
+            .size = compactedSizes[i],
+            .type = vk::AccelerationStructureTypeKHR::eBottomLevel,
+        };
+        compacted.handle = app.vk_device.createAccelerationStructureKHR(compactCreateInfo, nullptr, app.vk_ext_dispatcher);
+
+        vk::CopyAccelerationStructureInfoKHR copyInfo {
+            .src = builds[i].structure.handle,
+            .dst = compacted.handle,
+            .mode = vk::CopyAccelerationStructureModeKHR::eCompact,
+        };
+        vk::resultCheck(app.vk_device.copyAccelerationStructureKHR(nullptr, copyInfo, app.vk_ext_dispatcher), "Error compacting BLAS on the host");
+
+        app.vk_device.destroyAccelerationStructureKHR(builds[i].structure.handle, nullptr, app.vk_ext_dispatcher);
+        buffertools::DestroyBuffer(app, builds[i].structure.buffer);
+        builds[i].structure = compacted;
+
+        totalBuilt += builds[i].sizes.accelerationStructureSize;
+        totalCompacted += compactedSizes[i];
+    }
+
+    logger::info("Host built {} BLASes on {} threads in {:.2f} ms, {:.2f} MiB -> {:.2f} MiB",
+            builds.size(), app.thread_pool->Size(), buildSeconds * 1000.0,
+            totalBuilt / (1024.0 * 1024.0), totalCompacted / (1024.0 * 1024.0));
+}
+
+void RTX::joinDeferredOperation(vk::DeferredOperationKHR operation) {
+    const uint32_t concurrency = std::clamp(app.vk_device.getDeferredOperationMaxConcurrencyKHR(operation, app.vk_ext_dispatcher), 1u, app.thread_pool->Size());
+    for(uint32_t i=0; i<concurrency; i++) {
+        app.thread_pool->Submit([this, operation]() {
+            while (true) {
+                auto result = app.vk_device.deferredOperationJoinKHR(operation, app.vk_ext_dispatcher);
+                if (result == vk::Result::eSuccess || result == vk::Result::eThreadDoneKHR) {
+                    return;
+                }
+                // eThreadIdleKHR: no work available for this thread right now, but the operation is not done. Back off
+                // instead of spinning, the threads still building need the cores.
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
         });
+    }
+}
 
-        app.vk_device.destroyAccelerationStructureKHR(stagingAS, nullptr, app.vk_ext_dispatcher);
-        buffertools::DestroyBuffer(app, stagingASBuffer);
-        resources.instances.push_back(instanceData);
+Buffer RTX::createASBuffer(vk::DeviceSize size, vk::AccelerationStructureBuildTypeKHR buildType) {
+    const auto usage = vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress;
+    // structures built on the host have to live in host visible memory
+    return buildType == vk::AccelerationStructureBuildTypeKHR::eHost
+        ? buffertools::CreateBufferH2D(app, usage, size)
+        : buffertools::CreateBufferD(app, usage, size);
+}
+
+void RTX::BenchmarkBLASBuilds() {
+    auto run = [&](vk::AccelerationStructureBuildTypeKHR buildType) {
+        std::vector<BLASBuild> builds;
+        for(uint32_t meshID = 0; meshID < scene.meshes.size(); meshID++) {
+            builds.push_back(prepareBLASBuild(meshID, buildType));
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if (buildType == vk::AccelerationStructureBuildTypeKHR::eHost) {
+            buildBLASHost(builds);
+        } else {
+            buildAndCompactBLAS(builds);
+        }
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        for(auto& build : builds) {
+            app.vk_device.destroyAccelerationStructureKHR(build.structure.handle, nullptr, app.vk_ext_dispatcher);
+            buffertools::DestroyBuffer(app, build.structure.buffer);
+        }
+        return ms;
+    };
+
+    const double deviceMs = run(vk::AccelerationStructureBuildTypeKHR::eDevice);
+    if (!acceleration_structure_features.accelerationStructureHostCommands) {
+        logger::info("BLAS benchmark: device {:.2f} ms, host builds are not enabled on this device", deviceMs);
+        return;
     }
+
+    const double hostMs = run(vk::AccelerationStructureBuildTypeKHR::eHost);
+    logger::info("BLAS benchmark over {} meshes: device {:.2f} ms, host {:.2f} ms on {} threads", scene.meshes.size(), deviceMs, hostMs, app.thread_pool->Size());
 }
 
-void RTX::createTopLevelAS() {
-    vk::TransformMatrixKHR transformMatrix {
-        .matrix = std::array<std::array<float,4>,3> {
-            std::array<float,4> { 1.0f, 0.0f, 0.0f, 0.0f },
-            std::array<float,4> { 0.0f, 1.0f, 0.0f, 0.0f },
-            std::array<float,4> { 0.0f, 0.0f, 1.0f, 0.0f },
+double RTX::BenchmarkTrace(std::span<const Camera> cameras, uint32_t frames, uint32_t firstTick) {
+    const auto range = vk::inits::imageSubresourceRange(vk::ImageAspectFlagBits::eColor);
+    vk::MemoryBarrier traceBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
+        vk::tools::insertImageMemoryBarrier(cmdBuffer, storage_image.handle,
+                vk::AccessFlagBits::eShaderRead, vk::AccessFlagBits::eShaderWrite,
+                vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageLayout::eGeneral,
+                vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eRayTracingShaderKHR, range);
+        // tick 0 would restart a second time on the launch after it and measure an empty accumulation
+        const uint32_t tick = std::max(firstTick, 1u);
+        for(uint32_t i=0; i<frames; i++) {
+            // every launch reads the same cameras, so they can share the first uniform slot
+            Record(cmdBuffer, 0, tick + i, cameras);
+            cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::PipelineStageFlagBits::eRayTracingShaderKHR, {}, {traceBarrier}, {}, {});
+        }
+        vk::tools::insertImageMemoryBarrier(cmdBuffer, storage_image.handle,
+                vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead,
+                vk::ImageLayout::eGeneral, vk::ImageLayout::eShaderReadOnlyOptimal,
+                vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::PipelineStageFlagBits::eAllCommands, range);
+    });
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return double(config.width) * config.height * cameras.size() * frames * config.samplesPerLaunch / seconds;
+}
+
+std::vector<glm::vec4> RTX::ReadStorageImage() {
+    const auto range = vk::inits::imageSubresourceRange(vk::ImageAspectFlagBits::eColor);
+    const size_t pixelCount = size_t(config.width) * config.height * config.cameraCount;
+    const size_t size = pixelCount * sizeof(glm::vec4);
+    Buffer readback = buffertools::CreateBufferD2H(app, vk::BufferUsageFlagBits::eTransferDst, size);
+
+    app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
+        vk::tools::insertImageMemoryBarrier(cmdBuffer, storage_image.handle,
+                vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead,
+                vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageLayout::eTransferSrcOptimal,
+                vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer, range);
+        cmdBuffer.copyImageToBuffer(storage_image.handle, vk::ImageLayout::eTransferSrcOptimal, readback.handle, vk::inits::imageCopy(config.width, config.height, 0, config.cameraCount));
+        vk::tools::insertImageMemoryBarrier(cmdBuffer, storage_image.handle,
+                vk::AccessFlagBits::eTransferRead, vk::AccessFlagBits::eShaderRead,
+                vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eShaderReadOnlyOptimal,
+                vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, range);
+    });
+
+    std::vector<glm::vec4> pixels(pixelCount);
+    auto data = buffertools::MapBuffer(app, readback);
+    vmaInvalidateAllocation(app.vma_allocator, readback.allocation, 0, VK_WHOLE_SIZE);
+    memcpy(pixels.data(), data, size);
+    buffertools::UnmapBuffer(app, readback);
+    buffertools::DestroyBuffer(app, readback);
+    return pixels;
+}
+
+// copies to and from memory require 256 byte aligned addresses
+constexpr vk::DeviceSize SERIALIZATION_ALIGNMENT = 256;
+
+void RTX::deserializeBLAS(const std::vector<std::pair<uint32_t, std::vector<uint8_t>>>& cached) {
+    if (cached.empty()) {
+        return;
+    }
+
+    std::vector<Buffer> sources;
+    std::vector<vk::CopyMemoryToAccelerationStructureInfoKHR> copies;
+    for(const auto& [meshID, data] : cached) {
+        Buffer source = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eTransferDst, data.size() + SERIALIZATION_ALIGNMENT);
+        const uint64_t baseAddress = buffertools::GetBufferDeviceAddress(app, source);
+        const uint64_t alignedAddress = (baseAddress + SERIALIZATION_ALIGNMENT - 1) & ~(SERIALIZATION_ALIGNMENT - 1);
+        app.uploader->UploadBuffer(source.handle, data.data(), data.size(), alignedAddress - baseAddress);
+        sources.push_back(source);
+
+        const vk::DeviceSize size = ASCache::DeserializedSize(data);
+        auto& structure = resources.meshes[meshID].acceleration_structure;
+        structure.buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, size);
+        vk::AccelerationStructureCreateInfoKHR createInfo {
+            .buffer = structure.buffer.handle,
+            .size = size,
+            .type = vk::AccelerationStructureTypeKHR::eBottomLevel,
+        };
+        structure.handle = app.vk_device.createAccelerationStructureKHR(createInfo, nullptr, app.vk_ext_dispatcher);
+
+        copies.push_back(vk::CopyMemoryToAccelerationStructureInfoKHR {
+            .src = vk::DeviceOrHostAddressConstKHR { .deviceAddress = alignedAddress },
+            .dst = structure.handle,
+            .mode = vk::CopyAccelerationStructureModeKHR::eDeserialize,
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
+        for(const auto& copy : copies) {
+            cmdBuffer.copyMemoryToAccelerationStructureKHR(copy, app.vk_ext_dispatcher);
         }
+    });
+    logger::info("Deserialized {} cached BLASes in {:.2f} ms", cached.size(), std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+    for(auto& source : sources) {
+        buffertools::DestroyBuffer(app, source);
+    }
+}
+
+void RTX::serializeBLAS(const std::vector<BLASBuild>& builds, ASCache& cache) {
+    if (builds.empty()) {
+        return;
+    }
+
+    const uint32_t buildCount = static_cast<uint32_t>(builds.size());
+    vk::QueryPoolCreateInfo poolInfo {
+        .queryType = vk::QueryType::eAccelerationStructureSerializationSizeKHR,
+        .queryCount = buildCount,
     };
+    auto pool = app.vk_device.createQueryPool(poolInfo);
+
+    std::vector<vk::AccelerationStructureKHR> handles;
+    for(const auto& build : builds) {
+        handles.push_back(build.structure.handle);
+    }
+    app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
+        cmdBuffer.resetQueryPool(pool, 0, buildCount, app.vk_ext_dispatcher);
+        cmdBuffer.writeAccelerationStructuresPropertiesKHR(handles, vk::QueryType::eAccelerationStructureSerializationSizeKHR, pool, 0, app.vk_ext_dispatcher);
+    });
+
+    std::vector<vk::DeviceSize> serializedSizes(buildCount);
+    vk::resultCheck(app.vk_device.getQueryPoolResults(pool, 0, buildCount, serializedSizes.size() * sizeof(vk::DeviceSize), serializedSizes.data(), sizeof(vk::DeviceSize), vk::QueryResultFlagBits::eWait | vk::QueryResultFlagBits::e64, app.vk_ext_dispatcher), "Error reading BLAS serialization sizes");
+    app.vk_device.destroyQueryPool(pool);
+
+    std::vector<Buffer> targets;
+    std::vector<vk::DeviceSize> offsets;
+    app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
+        for(uint32_t i=0; i<buildCount; i++) {
+            Buffer target = buffertools::CreateBufferD2H(app, vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eTransferDst, serializedSizes[i] + SERIALIZATION_ALIGNMENT);
+            const uint64_t baseAddress = buffertools::GetBufferDeviceAddress(app, target);
+            const uint64_t alignedAddress = (baseAddress + SERIALIZATION_ALIGNMENT - 1) & ~(SERIALIZATION_ALIGNMENT - 1);
+            targets.push_back(target);
+            offsets.push_back(alignedAddress - baseAddress);
+
+            vk::CopyAccelerationStructureToMemoryInfoKHR copyInfo {
+                .src = builds[i].structure.handle,
+                .dst = vk::DeviceOrHostAddressKHR { .deviceAddress = alignedAddress },
+                .mode = vk::CopyAccelerationStructureModeKHR::eSerialize,
+            };
+            cmdBuffer.copyAccelerationStructureToMemoryKHR(copyInfo, app.vk_ext_dispatcher);
+        }
+    });
+
+    for(uint32_t i=0; i<buildCount; i++) {
+        auto data = reinterpret_cast<uint8_t*>(buffertools::MapBuffer(app, targets[i]));
+        vmaInvalidateAllocation(app.vma_allocator, targets[i].allocation, 0, VK_WHOLE_SIZE);
+        cache.Store(builds[i].cache_key, data + offsets[i], serializedSizes[i]);
+        buffertools::UnmapBuffer(app, targets[i]);
+        buffertools::DestroyBuffer(app, targets[i]);
+    }
+}
 
+void RTX::createTopLevelAS() {
     std::vector<vk::AccelerationStructureInstanceKHR> instances;
 
-    for(const auto& instanceData : resources.instances) {
+    for(const auto& instance : scene.instances) {
+        const auto& meshData = resources.meshes[instance.mesh_id];
+        const glm::mat4& m = instance.transform;
+        vk::TransformMatrixKHR transformMatrix {
+            .matrix = std::array<std::array<float,4>,3> {
+                std::array<float,4> { m[0][0], m[1][0], m[2][0], m[3][0] },
+                std::array<float,4> { m[0][1], m[1][1], m[2][1], m[3][1] },
+                std::array<float,4> { m[0][2], m[1][2], m[2][2], m[3][2] },
+            }
+        };
+
+        // host builds reference bottom levels by handle instead of by device address
+        const uint64_t reference = host_build
+            ? (uint64_t)static_cast<VkAccelerationStructureKHR>(meshData.acceleration_structure.handle)
+            : buffertools::GetBufferDeviceAddress(app, meshData.acceleration_structure.buffer);
         instances.push_back(vk::AccelerationStructureInstanceKHR {
             .transform = transformMatrix,
-            .instanceCustomIndex = instanceData.geometry_offset,
+            .instanceCustomIndex = meshData.geometry_offset,
             .mask = 0xFF,
             .instanceShaderBindingTableRecordOffset = 0,
             .flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR,
-            .accelerationStructureReference = buffertools::GetBufferDeviceAddress(app, instanceData.acceleration_structure.buffer),
+            .accelerationStructureReference = reference,
         });
     }
 
-    Buffer instancesBuffer = buffertools::CreateBufferD(
-            app, vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR, 
-            instances.size() * sizeof(vk::AccelerationStructureInstanceKHR), instances.data());
-
-    vk::DeviceOrHostAddressConstKHR instancesBufferAddress { .deviceAddress = buffertools::GetBufferDeviceAddress(app, instancesBuffer)};
+    const auto buildType = host_build ? vk::AccelerationStructureBuildTypeKHR::eHost : vk::AccelerationStructureBuildTypeKHR::eDevice;
+    Buffer instancesBuffer{};
+    vk::DeviceOrHostAddressConstKHR instancesBufferAddress;
+    if (host_build) {
+        instancesBufferAddress.hostAddress = instances.data();
+    } else {
+        instancesBuffer = buffertools::CreateBufferD(
+                app, vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
+                instances.size() * sizeof(vk::AccelerationStructureInstanceKHR), instances.data());
+        instancesBufferAddress.deviceAddress = buffertools::GetBufferDeviceAddress(app, instancesBuffer);
+    }
 
     vk::AccelerationStructureGeometryKHR geometry {
         .geometryType = vk::GeometryTypeKHR::eInstances,
@@ -283,9 +1167,9 @@ void RTX::createTopLevelAS() {
 
 
     const uint32_t primitiveCount = static_cast<uint32_t>(instances.size());
-    auto sizeInfo = app.vk_device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, buildInfo, primitiveCount, app.vk_ext_dispatcher);
+    auto sizeInfo = app.vk_device.getAccelerationStructureBuildSizesKHR(buildType, buildInfo, primitiveCount, app.vk_ext_dispatcher);
 
-    resources.top.buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR, sizeInfo.accelerationStructureSize);
+    resources.top.buffer = createASBuffer(sizeInfo.accelerationStructureSize, buildType);
 
     vk::AccelerationStructureCreateInfoKHR createInfo {
         .buffer = resources.top.buffer.handle,
@@ -294,13 +1178,10 @@ void RTX::createTopLevelAS() {
     };
     resources.top.handle = app.vk_device.createAccelerationStructureKHR(createInfo, nullptr, app.vk_ext_dispatcher);
 
-    Buffer scratchBuffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, sizeInfo.buildScratchSize);
-
     buildInfo.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
     buildInfo.dstAccelerationStructure = resources.top.handle;
     buildInfo.geometryCount = 1;
     buildInfo.pGeometries = &geometry;
-    buildInfo.scratchData.deviceAddress = buffertools::GetBufferDeviceAddress(app, scratchBuffer);
 
     vk::AccelerationStructureBuildRangeInfoKHR buildRange {
         .primitiveCount = primitiveCount,
@@ -309,6 +1190,24 @@ void RTX::createTopLevelAS() {
         .transformOffset = 0,
     };
 
+    if (host_build) {
+        std::vector<uint8_t> scratch(sizeInfo.buildScratchSize);
+        buildInfo.scratchData.hostAddress = scratch.data();
+
+        const vk::AccelerationStructureBuildRangeInfoKHR* ranges = &buildRange;
+        auto operation = app.vk_device.createDeferredOperationKHR(nullptr, app.vk_ext_dispatcher);
+        if (app.vk_device.buildAccelerationStructuresKHR(operation, buildInfo, ranges, app.vk_ext_dispatcher) == vk::Result::eOperationDeferredKHR) {
+            joinDeferredOperation(operation);
+            app.thread_pool->Wait();
+        }
+        vk::resultCheck(app.vk_device.getDeferredOperationResultKHR(operation, app.vk_ext_dispatcher), "Error building TLAS on the host");
+        app.vk_device.destroyDeferredOperationKHR(operation, nullptr, app.vk_ext_dispatcher);
+        return;
+    }
+
+    Buffer scratchBuffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, sizeInfo.buildScratchSize);
+    buildInfo.scratchData.deviceAddress = buffertools::GetBufferDeviceAddress(app, scratchBuffer);
+
     app.WithSingleTimeCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
         cmdBuffer.buildAccelerationStructuresKHR(buildInfo, &buildRange, app.vk_ext_dispatcher);
     });
@@ -318,13 +1217,110 @@ void RTX::createTopLevelAS() {
 }
 
 void RTX::createMaterialBuffer() {
-    std::vector<GLTFMaterial> materials;
-    for(const auto& mesh : scene.meshes) {
-        for (const auto& primitive : mesh.primitives) {
-            materials.push_back(primitive.material);
+    vk::PhysicalDeviceProperties properties = app.vk_physical_device.getProperties();
+    const auto alignment = static_cast<uint32_t>(properties.limits.minStorageBufferOffsetAlignment);
+    const auto tableSize = static_cast<uint32_t>(std::max<size_t>(scene.materials.size(), 1) * sizeof(GLTFMaterial));
+    resources.material_slot_size = vk::tools::allignedSize(tableSize, alignment);
+
+    // host visible so edits land without a transfer, the table is small enough to read from there
+    resources.material_buffer = buffertools::CreateBufferH2D(app, vk::BufferUsageFlagBits::eStorageBuffer, resources.material_slot_size * config.materialSlots);
+    resources.material_buffer_data = reinterpret_cast<uint8_t*>(buffertools::MapBuffer(app, resources.material_buffer));
+    memcpy(resources.material_buffer_data, scene.materials.data(), scene.materials.size() * sizeof(GLTFMaterial));
+    buffertools::FlushBuffer(app, resources.material_buffer, 0, resources.material_slot_size);
+    resources.material_slot = 0;
+}
+
+void RTX::createLightBuffer() {
+    std::vector<LightTriangle> triangles = lighttools::EmissiveTriangles(scene);
+    std::vector<float> weights;
+    weights.reserve(triangles.size());
+    double power = 0;
+    for(const auto& triangle : triangles) {
+        weights.push_back(lighttools::Area(triangle) * lighttools::EmittedLuminance(scene.materials[triangle.material_id]));
+        power += weights.back();
+    }
+
+    resources.light_count = static_cast<uint32_t>(triangles.size());
+    resources.light_power = static_cast<float>(power);
+    resources.light_emission.resize(scene.materials.size());
+    std::transform(scene.materials.begin(), scene.materials.end(), resources.light_emission.begin(), lighttools::EmittedLuminance);
+
+    std::vector<AliasEntry> aliasTable;
+    if (triangles.empty()) {
+        triangles.push_back(LightTriangle{});
+        aliasTable.push_back(AliasEntry { .probability = 1.0f, .alias = 0 });
+    } else {
+        aliasTable = lighttools::BuildAliasTable(weights);
+        // picking a triangle by power and a point on it by area leaves a density per area proportional to the luminance
+        for(auto& triangle : triangles) {
+            triangle.area_pdf = lighttools::EmittedLuminance(scene.materials[triangle.material_id]) / resources.light_power;
+        }
+    }
+
+    resources.light_buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer, triangles.size() * sizeof(LightTriangle), triangles.data());
+    resources.alias_buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer, aliasTable.size() * sizeof(AliasEntry), aliasTable.data());
+    logger::info("Light table: {} emissive triangles, {:.2f} KiB", resources.light_count,
+            triangles.size() * (sizeof(LightTriangle) + sizeof(AliasEntry)) / 1024.0);
+}
+
+void RTX::createEnvironment() {
+    const HostImage sky = ImageTools::LoadImageH("./skybox.jpg");
+    resources.skybox = ImageTools::LoadImageD(app, vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageUsageFlagBits::eSampled, sky);
+
+    std::vector<float> weights = lighttools::EnvironmentWeights(sky.pixels.data(), sky.width, sky.height);
+    const double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+    resources.environment_sampling = total > 0.0;
+
+    std::vector<AliasEntry> aliasTable;
+    if (resources.environment_sampling) {
+        aliasTable = lighttools::BuildAliasTable(weights);
+        for(auto& weight : weights) {
+            weight = static_cast<float>(weight / total);
         }
+    } else {
+        weights = { 0.0f };
+        aliasTable.push_back(AliasEntry { .probability = 1.0f, .alias = 0 });
     }
-    resources.material_buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer, materials.size() * sizeof(GLTFMaterial), materials.data());
+
+    resources.environment_alias_buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer, aliasTable.size() * sizeof(AliasEntry), aliasTable.data());
+    resources.environment_pdf_buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer, weights.size() * sizeof(float), weights.data());
+    logger::info("Environment sampling table: {}x{} texels, {:.2f} MiB", sky.width, sky.height,
+            weights.size() * (sizeof(AliasEntry) + sizeof(float)) / (1024.0 * 1024.0));
+}
+
+void RTX::createSamplerTables() {
+    std::vector<uint32_t> directions = samplertools::SobolDirections(samplertools::SOBOL_DIMENSIONS);
+    std::vector<float> blueNoise = samplertools::BlueNoiseTile(samplertools::BLUE_NOISE_SIZE);
+    resources.sobol_buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer, directions.size() * sizeof(uint32_t), directions.data());
+    resources.blue_noise_buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer, blueNoise.size() * sizeof(float), blueNoise.data());
+}
+
+void RTX::createGeometryInfoBuffer() {
+    const uint32_t stride = vertextools::Stride(scene.vertex_layout);
+    // must match the area_pdf createLightBuffer gave the triangles, or the MIS weights no longer sum to one
+    auto lightPdf = [&](MaterialID materialID) {
+        const float luminance = lighttools::EmittedLuminance(scene.materials[materialID]);
+        return resources.light_count > 0 && luminance > 0.0f ? luminance / resources.light_power : 0.0f;
+    };
+    std::vector<GeometryInfo> geometryInfos;
+    for(uint32_t meshID = 0; meshID < scene.meshes.size(); meshID++) {
+        const auto& mesh = scene.meshes[meshID];
+        const uint64_t vertexAddress = buffertools::GetBufferDeviceAddress(app, resources.meshes[meshID].vertex_buffer);
+        const uint64_t indexAddress = buffertools::GetBufferDeviceAddress(app, resources.meshes[meshID].index_buffer);
+        for(const auto& primitive : mesh.primitives) {
+            geometryInfos.push_back(GeometryInfo {
+                .vertex_address = vertexAddress + uint64_t(primitive.vertex_offset) * stride,
+                .index_address = indexAddress + primitive.index_offset,
+                .position_scale = glm::vec4(mesh.position_scale, 0),
+                .position_offset = glm::vec4(mesh.position_offset, 0),
+                .index_size = primitive.IndexSize(),
+                .material_id = primitive.material_id,
+                .light_pdf = lightPdf(primitive.material_id),
+            });
+        }
+    }
+    resources.geometry_info_buffer = buffertools::CreateBufferD(app, vk::BufferUsageFlagBits::eStorageBuffer, geometryInfos.size() * sizeof(GeometryInfo), geometryInfos.data());
+    logger::info("Geometry table: {} records, {:.2f} KiB", geometryInfos.size(), geometryInfos.size() * sizeof(GeometryInfo) / 1024.0);
 }
 
 void RTX::createPipeline() {
@@ -346,46 +1342,98 @@ void RTX::createPipeline() {
 
     bindings.push_back(vk::DescriptorSetLayoutBinding {
         .binding = 2,
-        .descriptorType = vk::DescriptorType::eUniformBuffer,
+        .descriptorType = vk::DescriptorType::eUniformBufferDynamic,
         .descriptorCount = 1,
         .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR,
     });
 
-    uint32_t totalBuffers = 0;
-    for(const auto& mesh : scene.meshes) {
-        totalBuffers += mesh.primitives.size();
-    }
     bindings.push_back(vk::DescriptorSetLayoutBinding {
-        .binding = 3,
-        .descriptorType = vk::DescriptorType::eStorageBuffer,
-        .descriptorCount = static_cast<uint32_t>(totalBuffers),
+        .binding = 5,
+        .descriptorType = vk::DescriptorType::eStorageBufferDynamic,
+        .descriptorCount = 1,
+        .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR,
+    });
+
+    bindings.push_back(vk::DescriptorSetLayoutBinding {
+        .binding = 6,
+        .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+        .descriptorCount = static_cast<uint32_t>(scene.textures.size()),
         .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR,
     });
 
     bindings.push_back(vk::DescriptorSetLayoutBinding {
-        .binding = 4,
+        .binding = 7,
+        .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+        .descriptorCount = 1,
+        .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR,
+    });
+
+    bindings.push_back(vk::DescriptorSetLayoutBinding {
+        .binding = 8,
         .descriptorType = vk::DescriptorType::eStorageBuffer,
-        .descriptorCount = static_cast<uint32_t>(totalBuffers),
+        .descriptorCount = 1,
         .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR,
     });
 
     bindings.push_back(vk::DescriptorSetLayoutBinding {
-        .binding = 5,
+        .binding = 9,
         .descriptorType = vk::DescriptorType::eStorageBuffer,
         .descriptorCount = 1,
-        .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR,
+        .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR,
     });
 
     bindings.push_back(vk::DescriptorSetLayoutBinding {
-        .binding = 6,
-        .descriptorType = vk::DescriptorType::eCombinedImageSampler,
-        .descriptorCount = static_cast<uint32_t>(scene.textures.size()),
-        .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR,
+        .binding = 10,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .descriptorCount = 1,
+        .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR,
     });
 
     bindings.push_back(vk::DescriptorSetLayoutBinding {
-        .binding = 7,
-        .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+        .binding = 11,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .descriptorCount = 1,
+        .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR,
+    });
+
+    bindings.push_back(vk::DescriptorSetLayoutBinding {
+        .binding = 12,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .descriptorCount = 1,
+        .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR,
+    });
+
+    bindings.push_back(vk::DescriptorSetLayoutBinding {
+        .binding = 13,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .descriptorCount = 1,
+        .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR,
+    });
+
+    bindings.push_back(vk::DescriptorSetLayoutBinding {
+        .binding = 14,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .descriptorCount = 1,
+        .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR,
+    });
+
+    bindings.push_back(vk::DescriptorSetLayoutBinding {
+        .binding = 15,
+        .descriptorType = vk::DescriptorType::eStorageImage,
+        .descriptorCount = 1,
+        .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR,
+    });
+
+    bindings.push_back(vk::DescriptorSetLayoutBinding {
+        .binding = 16,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .descriptorCount = 1,
+        .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR,
+    });
+
+    bindings.push_back(vk::DescriptorSetLayoutBinding {
+        .binding = 17,
+        .descriptorType = vk::DescriptorType::eStorageImage,
         .descriptorCount = 1,
         .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR,
     });
@@ -397,9 +1445,17 @@ void RTX::createPipeline() {
 
     this->descr_layout = app.vk_device.createDescriptorSetLayout(layoutInfo);
 
+    vk::PushConstantRange pushConstantRange {
+        .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR,
+        .offset = 0,
+        .size = sizeof(LaunchConstants),
+    };
+
     vk::PipelineLayoutCreateInfo pipelineLayoutInfo {
         .setLayoutCount = 1,
         .pSetLayouts = &this->descr_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange,
     };
 
     this->pipeline_layout = app.vk_device.createPipelineLayout(pipelineLayoutInfo);
@@ -432,10 +1488,36 @@ void RTX::createPipeline() {
             .intersectionShader = VK_SHADER_UNUSED_KHR,
     });
 
-    // 3. Closest Hit
+    // 3. Shadow miss, selected with missIndex 1 by the next event estimation rays
+    shaderStages.push_back(
+        vk::inits::shaderStageCreateInfo(app.LoadShader("./shaders_bin/shadow.rmiss.spv"), vk::ShaderStageFlagBits::eMissKHR)
+    );
+
+    shader_groups.push_back(vk::RayTracingShaderGroupCreateInfoKHR {
+            .type = vk::RayTracingShaderGroupTypeKHR::eGeneral,
+            .generalShader = static_cast<uint32_t>(shaderStages.size()) - 1,
+            .closestHitShader = VK_SHADER_UNUSED_KHR,
+            .anyHitShader = VK_SHADER_UNUSED_KHR,
+            .intersectionShader = VK_SHADER_UNUSED_KHR,
+    });
+
+    // 4. Closest Hit, specialized on the vertex layout of the scene
+    const uint32_t vertexLayout = static_cast<uint32_t>(scene.vertex_layout);
+    vk::SpecializationMapEntry vertexLayoutEntry {
+        .constantID = 0,
+        .offset = 0,
+        .size = sizeof(uint32_t),
+    };
+    vk::SpecializationInfo hitSpecialization {
+        .mapEntryCount = 1,
+        .pMapEntries = &vertexLayoutEntry,
+        .dataSize = sizeof(uint32_t),
+        .pData = &vertexLayout,
+    };
     shaderStages.push_back(
         vk::inits::shaderStageCreateInfo(app.LoadShader("./shaders_bin/hit.rchit.spv"), vk::ShaderStageFlagBits::eClosestHitKHR)
     );
+    shaderStages.back().pSpecializationInfo = &hitSpecialization;
 
     shader_groups.push_back(vk::RayTracingShaderGroupCreateInfoKHR {
             .type = vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup,
@@ -467,16 +1549,19 @@ void RTX::createShaderBindingTable() {
     const uint32_t handleSize = pipeline_properties.shaderGroupHandleSize;
     const uint32_t handleSizeAlligned = vk::tools::allignedSize(pipeline_properties.shaderGroupHandleSize, pipeline_properties.shaderGroupHandleAlignment);
     const uint32_t groupCount = static_cast<uint32_t>(shader_groups.size());
-    const uint32_t sbtSize = groupCount * handleSizeAlligned;
-
-    std::vector<uint8_t> shaderHandleStorage(sbtSize);
-    auto result = app.vk_device.getRayTracingShaderGroupHandlesKHR(pipeline, 0, groupCount, sbtSize, shaderHandleStorage.data(), app.vk_ext_dispatcher);
+    // the handles come back tightly packed, entries inside a region are spaced by the aligned size
+    std::vector<uint8_t> shaderHandleStorage(groupCount * handleSize);
+    auto result = app.vk_device.getRayTracingShaderGroupHandlesKHR(pipeline, 0, groupCount, shaderHandleStorage.size(), shaderHandleStorage.data(), app.vk_ext_dispatcher);
     vk::resultCheck(result, "Error retrieving group handles");
 
+    std::vector<uint8_t> missHandles(2 * handleSizeAlligned);
+    memcpy(missHandles.data() + 0 * handleSizeAlligned, shaderHandleStorage.data() + 1 * handleSize, handleSize);
+    memcpy(missHandles.data() + 1 * handleSizeAlligned, shaderHandleStorage.data() + 2 * handleSize, handleSize);
+
     auto usage = vk::BufferUsageFlagBits::eShaderBindingTableKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress;
-    binding_table.raygen = buffertools::CreateBufferD(app, usage, handleSize, shaderHandleStorage.data() + 0 * handleSizeAlligned);
-    binding_table.miss   = buffertools::CreateBufferD(app, usage, handleSize, shaderHandleStorage.data() + 1 * handleSizeAlligned);
-    binding_table.hit    = buffertools::CreateBufferD(app, usage, handleSize, shaderHandleStorage.data() + 2 * handleSizeAlligned);
+    binding_table.raygen = buffertools::CreateBufferD(app, usage, handleSize, shaderHandleStorage.data() + 0 * handleSize);
+    binding_table.miss   = buffertools::CreateBufferD(app, usage, missHandles.size(), missHandles.data());
+    binding_table.hit    = buffertools::CreateBufferD(app, usage, handleSize, shaderHandleStorage.data() + 3 * handleSize);
 
     binding_table.raygen_address = buffertools::GetBufferDeviceAddress(app, binding_table.raygen);
     binding_table.miss_address = buffertools::GetBufferDeviceAddress(app, binding_table.miss);
@@ -493,11 +1578,7 @@ void RTX::createDescriptorSet() {
 
     this->descriptor_set = app.vk_device.allocateDescriptorSets(allocInfo)[0];
 
-    auto storageImageWriteInfo = vk::DescriptorImageInfo {
-        .imageView = storage_image.view,
-        .imageLayout = vk::ImageLayout::eGeneral,
-    };
-    auto storageImageWrite = vk::inits::writeDescriptorSetImage(descriptor_set, vk::DescriptorType::eStorageImage, 0, &storageImageWriteInfo);
+    // the storage image, moments, tile mask and G-buffer bindings are written by writeFrameDescriptors
 
     auto accelerationStructureInfo = vk::WriteDescriptorSetAccelerationStructureKHR {
         .accelerationStructureCount = 1,
@@ -511,45 +1592,25 @@ void RTX::createDescriptorSet() {
         .descriptorType = vk::DescriptorType::eAccelerationStructureKHR,
     };
 
-    this->resources.uniform_buffer = buffertools::CreateBufferH2D(app, vk::BufferUsageFlagBits::eUniformBuffer, sizeof(UniformData));
-    this->resources.uniform_buffer_data = reinterpret_cast<UniformData*>(buffertools::MapBuffer(app, resources.uniform_buffer));
+    vk::PhysicalDeviceProperties properties = app.vk_physical_device.getProperties();
+    resources.uniform_slot_size = vk::tools::allignedSize(static_cast<uint32_t>(sizeof(UniformData)), static_cast<uint32_t>(properties.limits.minUniformBufferOffsetAlignment));
+    this->resources.uniform_buffer = buffertools::CreateBufferH2D(app, vk::BufferUsageFlagBits::eUniformBuffer, resources.uniform_slot_size * config.framesInFlight);
+    this->resources.uniform_buffer_data = reinterpret_cast<uint8_t*>(buffertools::MapBuffer(app, resources.uniform_buffer));
+    // one slot, Record picks the slot of its frame through the dynamic offset
     auto uniformBufferInfo = vk::DescriptorBufferInfo {
         .buffer = resources.uniform_buffer.handle,
         .offset = 0,
-        .range = VK_WHOLE_SIZE,
+        .range = sizeof(UniformData),
     };
-    auto uniformBufferWrite = vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eUniformBuffer, 2, &uniformBufferInfo);
-
-    std::vector<vk::DescriptorBufferInfo> vertexBufferInfos;
-    for(const auto& instance : resources.instances) {
-        for(const auto& primitive : instance.primitives) {
-            vertexBufferInfos.push_back(vk::DescriptorBufferInfo {
-                .buffer = instance.vertex_buffer.handle,
-                .offset = primitive.vertex_offset * sizeof(GLTFVertex),
-                .range = primitive.vertex_count * sizeof(GLTFVertex),
-            });
-        }
-    }
-    auto vertexBufferWrite = vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eStorageBuffer, 3, vertexBufferInfos.data(), static_cast<uint32_t>(vertexBufferInfos.size()));
-
-    std::vector<vk::DescriptorBufferInfo> indexBufferInfos;
-    for(const auto& instance : resources.instances) {
-        for(const auto& primitive : instance.primitives) {
-            indexBufferInfos.push_back(vk::DescriptorBufferInfo {
-                .buffer = instance.index_buffer.handle,
-                .offset = primitive.index_offset * sizeof(uint32_t),
-                .range = primitive.index_count * sizeof(uint32_t),
-            });
-        }
-    }
-    auto indexBufferWrite = vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eStorageBuffer, 4, indexBufferInfos.data(), static_cast<uint32_t>(indexBufferInfos.size()));
+    auto uniformBufferWrite = vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eUniformBufferDynamic, 2, &uniformBufferInfo);
 
+    // one slot of the ring, Record picks the slot through the dynamic offset
     vk::DescriptorBufferInfo materialBufferInfo {
         .buffer = resources.material_buffer.handle,
         .offset = 0,
-        .range = VK_WHOLE_SIZE,
+        .range = resources.material_slot_size,
     };
-    auto materialBufferWrite = vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eStorageBuffer, 5, &materialBufferInfo);
+    auto materialBufferWrite = vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eStorageBufferDynamic, 5, &materialBufferInfo);
 
     std::vector<vk::DescriptorImageInfo> textureArrayInfos;
     for(const auto& texture : resources.textures) {
@@ -568,17 +1629,71 @@ void RTX::createDescriptorSet() {
     };
     auto skyboxWrite = vk::inits::writeDescriptorSetImage(descriptor_set, vk::DescriptorType::eCombinedImageSampler, 7, &skyboxImageInfo);
 
+    vk::DescriptorBufferInfo environmentAliasBufferInfo {
+        .buffer = resources.environment_alias_buffer.handle,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    auto environmentAliasWrite = vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eStorageBuffer, 11, &environmentAliasBufferInfo);
+
+    vk::DescriptorBufferInfo environmentPdfBufferInfo {
+        .buffer = resources.environment_pdf_buffer.handle,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    auto environmentPdfWrite = vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eStorageBuffer, 12, &environmentPdfBufferInfo);
+
+    vk::DescriptorBufferInfo sobolBufferInfo {
+        .buffer = resources.sobol_buffer.handle,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    auto sobolWrite = vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eStorageBuffer, 13, &sobolBufferInfo);
+
+    vk::DescriptorBufferInfo blueNoiseBufferInfo {
+        .buffer = resources.blue_noise_buffer.handle,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    auto blueNoiseWrite = vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eStorageBuffer, 14, &blueNoiseBufferInfo);
+
     std::vector<vk::WriteDescriptorSet> writes {
-        storageImageWrite,
         accelerationStructureWrite,
         uniformBufferWrite,
-        vertexBufferWrite,
-        indexBufferWrite,
         materialBufferWrite,
         textureArrayWrite,
         skyboxWrite,
+        environmentAliasWrite,
+        environmentPdfWrite,
+        sobolWrite,
+        blueNoiseWrite,
     };
 
 
+    app.vk_device.updateDescriptorSets(writes, {});
+    writeLightDescriptors();
+}
+
+void RTX::writeLightDescriptors() {
+    vk::DescriptorBufferInfo geometryInfoBufferInfo {
+        .buffer = resources.geometry_info_buffer.handle,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    vk::DescriptorBufferInfo lightBufferInfo {
+        .buffer = resources.light_buffer.handle,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    vk::DescriptorBufferInfo aliasBufferInfo {
+        .buffer = resources.alias_buffer.handle,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    std::vector<vk::WriteDescriptorSet> writes {
+        vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eStorageBuffer, 8, &geometryInfoBufferInfo),
+        vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eStorageBuffer, 9, &lightBufferInfo),
+        vk::inits::writeDescriptorSetBuffer(descriptor_set, vk::DescriptorType::eStorageBuffer, 10, &aliasBufferInfo),
+    };
     app.vk_device.updateDescriptorSets(writes, {});
 }
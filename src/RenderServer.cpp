@@ -0,0 +1,281 @@
+#include <RenderServer.h>
+#include <json.hpp>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cerrno>
+
+using json = nlohmann::json;
+
+// jobs are single lines, anything longer is a client that never sends a newline
+constexpr size_t MAX_LINE_LENGTH = 64 * 1024;
+// replies are sent from the render thread, a client that stops reading them may only hold it up this long
+constexpr time_t SEND_TIMEOUT_SECONDS = 5;
+
+RenderServer::Connection::~Connection() {
+    close(fd);
+}
+
+void RenderServer::Connection::Send(const std::string& line) {
+    std::lock_guard lock(write_mutex);
+    SendLocked(line);
+}
+
+void RenderServer::Connection::SendLocked(const std::string& line) {
+    const std::string data = line + "\n";
+    size_t sent = 0;
+    while (sent < data.size()) {
+        // a client that hung up must not take the server down with SIGPIPE
+        const ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // a reply cut off halfway leaves nothing the client could parse, so later ones fail right away instead of
+            // waiting for the timeout again, and the reader sees the connection end
+            logger::warn("Dropping a render server client that hung up or stopped reading its replies");
+            shutdown(fd, SHUT_RDWR);
+            return;
+        }
+        sent += n;
+    }
+}
+
+RenderServer::RenderServer(std::filesystem::path socketPath, std::filesystem::path outputDirectory, OfflineJob defaults) : socket_path(std::move(socketPath)), defaults(std::move(defaults)) {
+    std::filesystem::create_directories(outputDirectory);
+    output_directory = std::filesystem::canonical(outputDirectory);
+
+    sockaddr_un address { .sun_family = AF_UNIX };
+    if (socket_path.string().size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error(fmt::format("Socket path {} is too long", socket_path.string()));
+    }
+    strcpy(address.sun_path, socket_path.c_str());
+
+    // a previous server that was killed leaves its socket file behind
+    std::filesystem::remove(socket_path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    // connecting needs write access to the socket file, so clients of other users are turned away. Nobody can
+    // connect before listen, which closes the window between bind and chmod.
+    if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || chmod(socket_path.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(listen_fd, 16) != 0) {
+        const std::string error = strerror(errno);
+        if (listen_fd >= 0) {
+            close(listen_fd);
+        }
+        throw std::runtime_error(fmt::format("Could not listen on {}: {}", socket_path.string(), error));
+    }
+
+    accept_thread = std::thread(&RenderServer::acceptConnections, this);
+    logger::info("Render server listening on {}, writing to {}", socket_path.string(), output_directory.string());
+}
+
+RenderServer::~RenderServer() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    // unblocks accept and every read, the threads see stopping and return
+    shutdown(listen_fd, SHUT_RDWR);
+    accept_thread.join();
+    close(listen_fd);
+    for(auto& reader : readers) {
+        shutdown(reader.connection->fd, SHUT_RDWR);
+        reader.thread.join();
+    }
+    std::filesystem::remove(socket_path);
+}
+
+void RenderServer::Run(const std::function<RenderResult(const OfflineJob&)>& render) {
+    while (true) {
+        QueuedJob queued;
+        size_t queueDepth;
+        {
+            std::unique_lock lock(mutex);
+            job_available.wait(lock, [&]() { return stopping || !queue.empty(); });
+            // a shutdown request still drains what was queued before it
+            if (queue.empty()) {
+                return;
+            }
+            queued = std::move(queue.front());
+            queue.pop_front();
+            queueDepth = queue.size();
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const double queueMs = std::chrono::duration<double, std::milli>(start - queued.queued).count();
+        try {
+            const RenderResult result = render(queued.job);
+            const auto end = std::chrono::steady_clock::now();
+            const double renderMs = std::chrono::duration<double, std::milli>(end - start).count();
+            const double latencyMs = std::chrono::duration<double, std::milli>(end - queued.queued).count();
+            const double samplesPerSecond = double(queued.job.width) * queued.job.height * result.cameras * result.samples / std::max(result.trace_seconds, 1e-9);
+
+            jobs_done++;
+            busy_seconds += renderMs * 1e-3;
+            const double uptime = std::chrono::duration<double>(end - started).count();
+            const double jobsPerMinute = 60.0 * jobs_done / uptime;
+            {
+                std::lock_guard lock(mutex);
+                queueDepth = queue.size();
+            }
+
+            queued.connection->Send(json {
+                { "id", queued.id },
+                { "status", "done" },
+                { "output", queued.outputs.size() == 1 ? json(queued.outputs[0]) : json(queued.outputs) },
+                { "samples", result.samples },
+                { "cameras", result.cameras },
+                { "queue_ms", queueMs },
+                { "render_ms", renderMs },
+                { "latency_ms", latencyMs },
+                { "samples_per_second", samplesPerSecond },
+                { "queue_depth", queueDepth },
+                { "jobs_per_minute", jobsPerMinute },
+            }.dump());
+            logger::info("Job {} done: {} at {} spp, {:.0f} ms latency ({:.0f} ms queued), {:.2f} Msamples/s, {} queued, {:.1f} jobs/min, busy {:.0f}% of the time",
+                    queued.id, queued.job.output, result.samples, latencyMs, queueMs, samplesPerSecond * 1e-6, queueDepth, jobsPerMinute, 100.0 * busy_seconds / uptime);
+        } catch (const std::exception& e) {
+            logger::warn("Job {} failed: {}", queued.id, e.what());
+            queued.connection->Send(json { { "id", queued.id }, { "status", "error" }, { "error", e.what() } }.dump());
+        }
+    }
+}
+
+void RenderServer::acceptConnections() {
+    while (true) {
+        const int fd = accept(listen_fd, nullptr, nullptr);
+        const int error = errno;
+        std::lock_guard lock(mutex);
+        if (stopping) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return;
+        }
+        if (fd < 0) {
+            if (error == EINTR || error == ECONNABORTED) {
+                continue;
+            }
+            logger::warn("Render server stopped accepting connections: {}", strerror(error));
+            return;
+        }
+
+        // clients that hung up are joined here, so a long running server does not collect threads
+        std::erase_if(readers, [](Reader& reader) {
+            if (reader.connection->reading) {
+                return false;
+            }
+            reader.thread.join();
+            return true;
+        });
+        const timeval sendTimeout { .tv_sec = SEND_TIMEOUT_SECONDS };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+        auto connection = std::make_shared<Connection>(fd);
+        readers.push_back(Reader {
+            .connection = connection,
+            .thread = std::thread(&RenderServer::readJobs, this, connection),
+        });
+    }
+}
+
+void RenderServer::readJobs(std::shared_ptr<Connection> connection) {
+    std::string pending;
+    char buffer[4096];
+    while (true) {
+        const ssize_t n = read(connection->fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            connection->reading = false;
+            return;
+        }
+        pending.append(buffer, n);
+
+        size_t newline;
+        while ((newline = pending.find('\n')) != std::string::npos) {
+            const std::string line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            if (line.find_first_not_of(" \t\r") != std::string::npos) {
+                submit(line, connection);
+            }
+        }
+        if (pending.size() > MAX_LINE_LENGTH) {
+            connection->Send(json { { "status", "error" }, { "error", "job exceeds the maximum line length" } }.dump());
+            connection->reading = false;
+            return;
+        }
+    }
+}
+
+void RenderServer::submit(const std::string& line, const std::shared_ptr<Connection>& connection) {
+    const json request = json::parse(line, nullptr, false);
+    if (request.is_discarded() || !request.is_object()) {
+        connection->Send(json { { "status", "error" }, { "error", "a job has to be a JSON object on a single line" } }.dump());
+        return;
+    }
+
+    if (request.value("shutdown", false)) {
+        std::lock_guard lock(mutex);
+        stopping = true;
+        job_available.notify_one();
+        logger::info("Render server shutting down after {} queued jobs", queue.size());
+        return;
+    }
+
+    OfflineJob job = defaults;
+    std::vector<std::string> outputs;
+    try {
+        job.Parse(line);
+        if (job.materials != defaults.materials) {
+            throw std::runtime_error(fmt::format("the server applies {} to every job, not {}", defaults.materials, job.materials));
+        }
+        const size_t cameraCount = job.Cameras().size();
+        for(uint32_t c=0; c<cameraCount; c++) {
+            outputs.push_back(job.OutputPath(c).string());
+        }
+        job.output = resolveOutput(job.output);
+    } catch (const std::exception& e) {
+        connection->Send(json { { "status", "error" }, { "error", e.what() } }.dump());
+        return;
+    }
+    if (job.spp == 0 && job.seconds <= 0) {
+        connection->Send(json { { "status", "error" }, { "error", "a job needs spp or seconds" } }.dump());
+        return;
+    }
+
+    std::unique_lock lock(mutex);
+    if (stopping) {
+        lock.unlock();
+        connection->Send(json { { "status", "error" }, { "error", "the server is shutting down" } }.dump());
+        return;
+    }
+    const uint64_t id = next_job_id++;
+    queue.push_back(QueuedJob {
+        .id = id,
+        .job = std::move(job),
+        .outputs = std::move(outputs),
+        .connection = connection,
+        .queued = std::chrono::steady_clock::now(),
+    });
+    const size_t queueDepth = queue.size();
+    // the connection's write lock is taken before the job can be picked up, so its "done" cannot overtake this
+    // reply, while a slow client only holds up its own connection and not the whole server
+    std::unique_lock writeLock(connection->write_mutex);
+    job_available.notify_one();
+    lock.unlock();
+    connection->SendLocked(json { { "id", id }, { "status", "queued" }, { "queue_depth", queueDepth } }.dump());
+}
+
+std::string RenderServer::resolveOutput(const std::string& output) const {
+    const std::filesystem::path path = output;
+    if (path.empty() || path.is_absolute()) {
+        throw std::runtime_error(fmt::format("output {} has to be a path relative to the output directory", output));
+    }
+    // resolves .. and symlinks that already exist, the suffix of multi camera outputs stays in the same directory
+    const auto resolved = std::filesystem::weakly_canonical(output_directory / path);
+    const auto relative = resolved.lexically_relative(output_directory);
+    if (relative.empty() || *relative.begin() == "..") {
+        throw std::runtime_error(fmt::format("output {} is outside of the output directory", output));
+    }
+    return resolved.string();
+}
@@ -0,0 +1,27 @@
+#include <SampleBudget.h>
+
+// weight of the newest frame in the running estimates
+constexpr double SMOOTHING = 0.25;
+
+SampleBudget::SampleBudget(double targetSeconds, uint32_t minSamples, uint32_t maxSamples)
+    : target_seconds(targetSeconds), min_samples(std::max(minSamples, 1u)), max_samples(std::max(maxSamples, min_samples)), samples_per_launch(min_samples) {
+}
+
+uint32_t SampleBudget::Update(double frameSeconds) {
+    if (frameSeconds <= 0) {
+        return samples_per_launch;
+    }
+
+    // the first frame sets the estimates, after that one slow frame should not halve the budget
+    const double cost = frameSeconds / samples_per_launch;
+    const double rate = samples_per_launch / frameSeconds;
+    seconds_per_sample = seconds_per_sample > 0 ? seconds_per_sample + SMOOTHING * (cost - seconds_per_sample) : cost;
+    samples_per_second = samples_per_second > 0 ? samples_per_second + SMOOTHING * (rate - samples_per_second) : rate;
+
+    // the cost includes the fixed overhead of a frame, so this undershoots the target a little rather than overshooting it,
+    // and growing at most twofold per frame keeps a misjudged cost from producing one very long frame
+    const double ideal = target_seconds / seconds_per_sample;
+    const double limit = std::max(std::min(2.0 * samples_per_launch, static_cast<double>(max_samples)), static_cast<double>(min_samples));
+    samples_per_launch = static_cast<uint32_t>(std::clamp(ideal, static_cast<double>(min_samples), limit));
+    return samples_per_launch;
+}
@@ -0,0 +1,133 @@
+#include <SamplerTools.h>
+#include <random>
+
+struct SobolPolynomial {
+    uint32_t degree;
+    // inner coefficients of the polynomial, highest first
+    uint32_t coefficients;
+    std::array<uint32_t, 3> initial;
+};
+
+// new-joe-kuo-6.21201, dimensions 2 to 4
+constexpr SobolPolynomial SOBOL_POLYNOMIALS[] = {
+    { 1, 0, { 1 } },
+    { 2, 1, { 1, 3 } },
+    { 3, 1, { 1, 3, 1 } },
+};
+
+std::vector<uint32_t> samplertools::SobolDirections(uint32_t dimensions) {
+    if (dimensions > 1 + std::size(SOBOL_POLYNOMIALS)) {
+        throw std::runtime_error("Not enough Sobol polynomials for the requested dimensions");
+    }
+
+    std::vector<uint32_t> directions(size_t(dimensions) * 32);
+    for(uint32_t bit=0; bit<32; bit++) {
+        directions[bit] = 1u << (31 - bit);
+    }
+
+    for(uint32_t dimension=1; dimension<dimensions; dimension++) {
+        const auto& polynomial = SOBOL_POLYNOMIALS[dimension-1];
+        const uint32_t s = polynomial.degree;
+        uint32_t* v = directions.data() + size_t(dimension) * 32;
+        for(uint32_t i=0; i<s; i++) {
+            v[i] = polynomial.initial[i] << (31 - i);
+        }
+        for(uint32_t i=s; i<32; i++) {
+            v[i] = v[i-s] ^ (v[i-s] >> s);
+            for(uint32_t k=1; k<s; k++) {
+                v[i] ^= ((polynomial.coefficients >> (s-1-k)) & 1) * v[i-k];
+            }
+        }
+    }
+    return directions;
+}
+
+std::vector<float> samplertools::BlueNoiseTile(uint32_t size) {
+    const uint32_t count = size * size;
+
+    // toroidal gaussian with Ulichney's sigma of 1.5, indexed by the offset between two cells
+    std::vector<float> kernel(count);
+    for(uint32_t y=0; y<size; y++) {
+        for(uint32_t x=0; x<size; x++) {
+            const float dx = static_cast<float>(std::min(x, size - x));
+            const float dy = static_cast<float>(std::min(y, size - y));
+            kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * 1.5f * 1.5f));
+        }
+    }
+
+    std::vector<uint8_t> pattern(count, 0);
+    std::vector<float> energy(count, 0.0f);
+    auto toggle = [&](uint32_t i, bool set) {
+        pattern[i] = set;
+        const float sign = set ? 1.0f : -1.0f;
+        const uint32_t ix = i % size, iy = i / size;
+        for(uint32_t y=0; y<size; y++) {
+            for(uint32_t x=0; x<size; x++) {
+                energy[y * size + x] += sign * kernel[((y + size - iy) % size) * size + (x + size - ix) % size];
+            }
+        }
+    };
+    // the set cell with the most energy around it and the empty cell with the least
+    auto tightestCluster = [&]() {
+        uint32_t best = 0;
+        float bestEnergy = -std::numeric_limits<float>::max();
+        for(uint32_t i=0; i<count; i++) {
+            if (pattern[i] && energy[i] > bestEnergy) { best = i; bestEnergy = energy[i]; }
+        }
+        return best;
+    };
+    auto largestVoid = [&]() {
+        uint32_t best = 0;
+        float bestEnergy = std::numeric_limits<float>::max();
+        for(uint32_t i=0; i<count; i++) {
+            if (!pattern[i] && energy[i] < bestEnergy) { best = i; bestEnergy = energy[i]; }
+        }
+        return best;
+    };
+
+    // a tenth of the cells at random, relaxed by moving the tightest cluster into the largest void until that is a no-op
+    std::mt19937 rng(1);
+    const uint32_t initialCount = std::max(count / 10, 1u);
+    for(uint32_t placed=0; placed<initialCount;) {
+        const uint32_t i = rng() % count;
+        if (!pattern[i]) {
+            toggle(i, true);
+            placed++;
+        }
+    }
+    // bounded in case the swap keeps cycling between equally good positions
+    for(uint32_t iteration=0; iteration<count; iteration++) {
+        const uint32_t cluster = tightestCluster();
+        toggle(cluster, false);
+        const uint32_t hole = largestVoid();
+        toggle(hole, true);
+        if (hole == cluster) {
+            break;
+        }
+    }
+
+    std::vector<uint32_t> rank(count);
+    const auto initialPattern = pattern;
+    const auto initialEnergy = energy;
+    for(uint32_t r=initialCount; r-- > 0;) {
+        const uint32_t cluster = tightestCluster();
+        toggle(cluster, false);
+        rank[cluster] = r;
+    }
+
+    // past half full the minority are the empty cells, but the tightest cluster of those is still the largest void
+    // because the energy is linear, so one loop fills the rest
+    pattern = initialPattern;
+    energy = initialEnergy;
+    for(uint32_t r=initialCount; r<count; r++) {
+        const uint32_t hole = largestVoid();
+        toggle(hole, true);
+        rank[hole] = r;
+    }
+
+    std::vector<float> tile(count);
+    for(uint32_t i=0; i<count; i++) {
+        tile[i] = (rank[i] + 0.5f) / count;
+    }
+    return tile;
+}
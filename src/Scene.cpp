@@ -1,13 +1,157 @@
 #include <Scene.h>
+#include <Hash.h>
+#include <MeshTools.h>
+
+// layout of a .pvscene: a header followed by record tables and bulk data, every bulk
+// array starts on its own page so it can be handed to the uploader straight from the mapping
+constexpr char CACHE_MAGIC[8] = { 'P', 'V', 'S', 'C', 'E', 'N', 'E', '\0' };
+constexpr uint64_t CACHE_ALIGNMENT = 4096;
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    VertexLayout vertex_layout;
+    uint32_t optimized;
+    // what the textures were encoded as after falling back for the device, see deviceTextureEncoding
+    texturetools::Encoding texture_encoding;
+    uint32_t mesh_count;
+    uint32_t instance_count;
+    uint32_t texture_count;
+    uint32_t material_count;
+    uint64_t source_size;
+    int64_t source_time;
+    uint64_t file_size;
+    uint64_t meshes_offset;
+    uint64_t instances_offset;
+    uint64_t textures_offset;
+    uint64_t materials_offset;
+};
+
+struct CacheMesh {
+    uint64_t primitives_offset;
+    uint64_t primitive_count;
+    uint64_t vertex_data_offset;
+    uint64_t vertex_data_size;
+    uint64_t index_data_offset;
+    uint64_t index_data_size;
+    glm::vec3 position_scale;
+    glm::vec3 position_offset;
+};
+
+struct CacheTexture {
+    uint32_t width;
+    uint32_t height;
+    uint64_t data_offset;
+    uint64_t data_size;
+    vk::Format format;
+    uint32_t mip_levels;
+    uint32_t normal_map;
+};
+
+// encoded textures on disk, a header followed by the mip chain
+constexpr char TEXTURE_MAGIC[8] = { 'P', 'V', 'T', 'E', 'X', '\0', '\0', '\0' };
+constexpr uint32_t TEXTURE_CACHE_VERSION = 1;
+
+struct TextureCacheHeader {
+    char magic[8];
+    vk::Format format;
+    uint32_t mip_levels;
+    uint32_t width;
+    uint32_t height;
+    uint64_t size;
+};
 
 template<typename DST_T, typename SRC_T>
-inline void vector_insert_cast(std::vector<DST_T>& dst, SRC_T* src, size_t nrElements) {
+inline void copy_cast(DST_T* dst, const SRC_T* src, size_t nrElements) {
     for(size_t i=0; i<nrElements; i++) {
-        dst.push_back(static_cast<DST_T>(src[i]));
+        dst[i] = static_cast<DST_T>(src[i]);
     }
 }
 
+// first element of an accessor and the bytes between elements, interleaved buffer views set a byteStride larger than the element
+static std::pair<const uint8_t*, size_t> accessorData(const tinygltf::Model& model, const tinygltf::Accessor& accessor) {
+    const auto& view = model.bufferViews[accessor.bufferView];
+    const int stride = accessor.ByteStride(view);
+    if (stride <= 0) {
+        throw std::runtime_error("Invalid glTF accessor stride");
+    }
+    return { model.buffers[view.buffer].data.data() + accessor.byteOffset + view.byteOffset, static_cast<size_t>(stride) };
+}
+
+// tinygltf image callback that only keeps the encoded bytes, decoding happens later on all cores
+static bool deferImageDecode(tinygltf::Image* image, const int, std::string*, std::string*, int, int, const unsigned char* bytes, int size, void*) {
+    image->image.assign(bytes, bytes + size);
+    image->width = -1;
+    image->height = -1;
+    return true;
+}
+
+static void decodeImage(tinygltf::Image& image) {
+    int width, height, components;
+    uint8_t* pixels = stbi_load_from_memory(image.image.data(), static_cast<int>(image.image.size()), &width, &height, &components, 4);
+    if (pixels == nullptr) {
+        // fails the load like tinygltf did when it decoded, the pool rethrows it from ParallelFor. stbi_failure_reason
+        // is a global in this stb_image, it cannot be read safely from the workers.
+        throw std::runtime_error(fmt::format("Could not decode image {} ({} bytes)", image.name, image.image.size()));
+    }
+    image.width = width;
+    image.height = height;
+    image.component = 4;
+    image.bits = 8;
+    image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+    image.image.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(pixels);
+}
+
 void Scene::LoadModel(const char* filename, bool binary) {
+    const LoadRange range {
+        .mesh_offset = static_cast<uint32_t>(meshes.size()),
+        .instance_offset = static_cast<uint32_t>(instances.size()),
+        .texture_offset = static_cast<uint32_t>(textures.size()),
+        .material_offset = static_cast<uint32_t>(materials.size()),
+    };
+    auto start = std::chrono::steady_clock::now();
+
+    std::filesystem::path cachePath;
+    bool cached = false;
+    if (cache_directory != nullptr) {
+        // the stem keeps the cache directory readable, the hash keeps equally named models apart
+        const auto absolute = std::filesystem::absolute(filename).string();
+        cachePath = std::filesystem::path(cache_directory) / fmt::format("{}-{:08x}.pvscene",
+                std::filesystem::path(filename).stem().string(), hash::Bytes(absolute.data(), absolute.size()) & 0xffffffff);
+        cached = loadCache(cachePath, filename);
+    }
+
+    if (!cached) {
+        loadGLTF(filename, binary);
+    }
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    size_t uniqueTriangles = 0, instancedTriangles = 0, primitiveCount = 0;
+    for(size_t i=range.instance_offset; i<instances.size(); i++) {
+        for(const auto& primitive : meshes[instances[i].mesh_id].primitives) {
+            instancedTriangles += primitive.index_count / 3;
+        }
+    }
+    for(size_t i=range.mesh_offset; i<meshes.size(); i++) {
+        for(const auto& primitive : meshes[i].primitives) {
+            uniqueTriangles += primitive.index_count / 3;
+        }
+        primitiveCount += meshes[i].primitives.size();
+    }
+    logger::info("Loaded {} from {} in {:.2f} ms: {} unique meshes, {} instances, {} unique triangles, {} instanced triangles, {} unique materials for {} primitives",
+            filename, cached ? "scene cache" : "glTF", ms,
+            meshes.size() - range.mesh_offset, instances.size() - range.instance_offset, uniqueTriangles, instancedTriangles,
+            materials.size() - range.material_offset, primitiveCount);
+
+    if (!cached && cache_directory != nullptr) {
+        storeCache(cachePath, filename, range);
+    }
+}
+
+void Scene::loadGLTF(const char* filename, bool binary) {
+    const size_t meshOffset = meshes.size();
+    const size_t textureOffset = textures.size();
     // TODO: this dumb
     this->textures.push_back(GLTFTexture {
         .width = 32,
@@ -15,8 +159,10 @@ void Scene::LoadModel(const char* filename, bool binary) {
         .data = std::vector<uint8_t>(32*32*4),
     });
 
+    auto parseStart = std::chrono::steady_clock::now();
     tinygltf::Model model;
     tinygltf::TinyGLTF loader;
+    loader.SetImageLoader(deferImageDecode, nullptr);
     std::string err, warn;
 
 
@@ -37,12 +183,149 @@ void Scene::LoadModel(const char* filename, bool binary) {
         exit(1);
     }
 
-    assert(model.scenes.size() == 1 && "Currently only support single scenes");
-    auto& scene = model.scenes[0];
-    
+    auto decodeStart = std::chrono::steady_clock::now();
+    app.thread_pool->ParallelFor(model.images.size(), [&](size_t i) {
+        if (!model.images[i].image.empty()) {
+            decodeImage(model.images[i]);
+        }
+    });
+
+    // every glTF mesh is loaded once, each node referencing it becomes an instance
+    auto convertStart = std::chrono::steady_clock::now();
+    std::vector<int32_t> meshIDs(model.meshes.size(), -1);
+    TextureCache textureCache;
+    std::unordered_map<int, MaterialID> materialIDs;
+    // (glTF primitive, destination mesh, primitive index) for the parallel conversion
+    std::vector<std::tuple<const tinygltf::Primitive*, uint32_t, uint32_t>> conversions;
+
+    // scenes are optional in glTF, without one every node that is nobody's child is a root
+    std::vector<int> rootNodes;
+    if (!model.scenes.empty()) {
+        const bool hasDefault = model.defaultScene > -1 && model.defaultScene < static_cast<int>(model.scenes.size());
+        rootNodes = model.scenes[hasDefault ? model.defaultScene : 0].nodes;
+    } else {
+        std::vector<bool> isChild(model.nodes.size(), false);
+        for(const auto& node : model.nodes) {
+            for(int child : node.children) {
+                isChild[child] = true;
+            }
+        }
+        for(int i=0; i<static_cast<int>(model.nodes.size()); i++) {
+            if (!isChild[i]) {
+                rootNodes.push_back(i);
+            }
+        }
+    }
+    std::vector<std::pair<int, glm::mat4>> stack;
+    for(auto it = rootNodes.rbegin(); it != rootNodes.rend(); it++) {
+        stack.emplace_back(*it, glm::mat4(1.0f));
+    }
+
+    while (!stack.empty()) {
+        auto [nodeID, parentTransform] = stack.back();
+        stack.pop_back();
+        const auto& node = model.nodes[nodeID];
+        const glm::mat4 transform = parentTransform * nodeTransform(node);
+
+        if (node.mesh != -1) {
+            if (meshIDs[node.mesh] == -1) {
+                const uint32_t meshID = static_cast<uint32_t>(meshes.size());
+                meshIDs[node.mesh] = static_cast<int32_t>(meshID);
+                meshes.push_back(layoutMesh(model, model.meshes[node.mesh], filename, textureCache, materialIDs));
+                for(uint32_t i=0; i<model.meshes[node.mesh].primitives.size(); i++) {
+                    conversions.emplace_back(&model.meshes[node.mesh].primitives[i], meshID, i);
+                }
+            }
+            instances.push_back(GLTFInstance {
+                .mesh_id = static_cast<uint32_t>(meshIDs[node.mesh]),
+                .transform = transform,
+            });
+        }
+
+        for(auto it = node.children.rbegin(); it != node.children.rend(); it++) {
+            stack.emplace_back(*it, transform);
+        }
+    }
+
+    size_t sourceVertices = 0;
+    for(size_t i=meshOffset; i<meshes.size(); i++) {
+        for(const auto& primitive : meshes[i].primitives) {
+            sourceVertices += primitive.vertex_count;
+        }
+    }
+    app.thread_pool->ParallelFor(conversions.size(), [&](size_t i) {
+        auto [primitive, meshID, primitiveID] = conversions[i];
+        convertPrimitive(model, *primitive, meshes[meshID], meshes[meshID].primitives[primitiveID], vertex_layout, optimize_meshes);
+    });
+    size_t optimizedVertices = 0;
+    if (optimize_meshes) {
+        app.thread_pool->ParallelFor(meshes.size() - meshOffset, [&](size_t i) {
+            compactVertices(meshes[meshOffset + i], vertex_layout);
+        });
+        for(size_t i=meshOffset; i<meshes.size(); i++) {
+            for(const auto& primitive : meshes[i].primitives) {
+                optimizedVertices += primitive.vertex_count;
+            }
+        }
+        logger::info("glTF {}: welded {} vertices into {}, triangles sorted along a Morton curve", filename, sourceVertices, optimizedVertices);
+    }
+
+    auto encodeStart = std::chrono::steady_clock::now();
+    const auto encoding = deviceTextureEncoding();
+    if (encoding != texture_encoding) {
+        logger::warn("Device cannot sample BC textures, keeping scene textures uncompressed");
+    }
+    size_t sourceBytes = 0, encodedBytes = 0;
+    std::atomic<uint32_t> cacheHits = 0;
+    for(size_t i=textureOffset; i<textures.size(); i++) {
+        sourceBytes += textures[i].data.size();
+    }
+    // one texture per task, the encoders themselves are single threaded
+    app.thread_pool->ParallelFor(textures.size() - textureOffset, [&](size_t i) {
+        if (processTexture(textures[textureOffset + i], encoding)) {
+            cacheHits++;
+        }
+    });
+    for(size_t i=textureOffset; i<textures.size(); i++) {
+        encodedBytes += textures[i].data.size();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    logger::info("glTF {}: {} unique textures for {} references, deduplication saved {:.2f} MiB",
+            filename, textureCache.textures.size(), textureCache.references, textureCache.bytes_saved / (1024.0 * 1024.0));
+
+    auto ms = [](auto from, auto to) { return std::chrono::duration<double, std::milli>(to - from).count(); };
+    logger::info("glTF {}: parsed in {:.2f} ms, decoded {} images in {:.2f} ms, converted {} primitives in {:.2f} ms, encoded {} textures in {:.2f} ms ({} cached) on {} threads",
+            filename, ms(parseStart, decodeStart), model.images.size(), ms(decodeStart, convertStart),
+            conversions.size(), ms(convertStart, encodeStart), textures.size() - textureOffset, ms(encodeStart, end), cacheHits.load(), app.thread_pool->Size());
+    logger::info("glTF {}: textures take {:.2f} MiB as RGBA8 without mips, {:.2f} MiB as encoded mip chains",
+            filename, sourceBytes / (1024.0 * 1024.0), encodedBytes / (1024.0 * 1024.0));
+}
+
+texturetools::Encoding Scene::deviceTextureEncoding() const {
+    if (texture_encoding != texturetools::Encoding::eUncompressed && !app.vk_physical_device.getFeatures().textureCompressionBC) {
+        return texturetools::Encoding::eUncompressed;
+    }
+    return texture_encoding;
+}
+
+void Scene::ReleaseTexturePixels() {
+    size_t released = 0;
+    for(auto& texture : textures) {
+        released += texture.data.size();
+        texture.data = {};
+    }
+    logger::info("Released {:.2f} MiB of host texture pixels", released / (1024.0 * 1024.0));
+}
 
-    assert(scene.nodes.size() >= 1 && "Currently only support single nodes");
-    auto& node = model.nodes[scene.nodes[0]];
+glm::mat4 Scene::nodeTransform(const tinygltf::Node& node) {
+    if (node.matrix.size() == 16) {
+        glm::mat4 matrix;
+        for(uint32_t i=0; i<16; i++) {
+            matrix[i / 4][i % 4] = static_cast<float>(node.matrix[i]);
+        }
+        return matrix;
+    }
 
     glm::vec3 scale = glm::vec3(1);
     if (node.scale.size() == 3) {
@@ -70,166 +353,517 @@ void Scene::LoadModel(const char* filename, bool binary) {
     transform = glm::translate(transform, translation);
     transform = transform * glm::toMat4(rotation);
     transform = glm::scale(transform, scale);
+    return transform;
+}
 
+TextureID Scene::resolveTexture(tinygltf::Model& model, int textureIndex, bool normalMap, TextureCache& cache) {
+    const auto& t = model.textures[textureIndex];
+    const std::pair<int, bool> key { t.source, normalMap };
+    auto& t_image = model.images[t.source];
+    cache.references++;
 
-    // hack to eliminate non mesh nodes
-    while(node.mesh == -1) {
-        assert(node.children.size() == 1 && "Expected a linear node chain for a quick hack");
-        node = model.nodes[node.children[0]];
+    if (auto it = cache.textures.find(key); it != cache.textures.end()) {
+        cache.bytes_saved += textures[it->second].data.size();
+        return it->second;
     }
-    assert(node.mesh != -1 && "Invalid mesh");
 
-    auto& mesh = model.meshes[node.mesh];
+    GLTFTexture texture {
+        .width = static_cast<uint32_t>(t_image.width),
+        .height = static_cast<uint32_t>(t_image.height),
+        .normal_map = normalMap,
+    };
+    if (auto it = cache.images.find(t.source); it != cache.images.end()) {
+        // same image in the other role, the pixels were already moved out of the model
+        texture.data = textures[it->second].data;
+    } else {
+        texture.data = std::move(t_image.image);
+        t_image.image = {};
+    }
 
-    uint32_t runningVertexCount = 0;
-    uint32_t runningIndexCount = 0;
-    GLTFMesh resmesh{};
-    for(auto& primitive : mesh.primitives) {
-        GLTFPrimitive res{};
-        res.transform = transform;
+    const TextureID textureID = static_cast<TextureID>(textures.size());
+    textures.push_back(std::move(texture));
+    cache.textures.emplace(key, textureID);
+    cache.images.emplace(t.source, textureID);
+    return textureID;
+}
 
-        assert(primitive.attributes.find("POSITION") != primitive.attributes.end());
-        assert(primitive.attributes.find("NORMAL") != primitive.attributes.end());
-        //assert(primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end());
-
-        uint32_t posBufAccIdx = primitive.attributes["POSITION"];
-        auto& posAcc = model.accessors[posBufAccIdx];
-        auto& posView = model.bufferViews[posAcc.bufferView];
-        auto& posBuf = model.buffers[posView.buffer];
-        assert(posAcc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
-        assert(posAcc.type == TINYGLTF_TYPE_VEC3);
-        glm::vec3* posHead = reinterpret_cast<glm::vec3*>(posBuf.data.data() + posAcc.byteOffset + posView.byteOffset);
-
-        uint32_t normalBufAccIdx = primitive.attributes["NORMAL"];
-        auto& normalAcc = model.accessors[normalBufAccIdx];
-        auto& normalView = model.bufferViews[normalAcc.bufferView];
-        auto& normalBuf = model.buffers[normalView.buffer];
-        assert(normalAcc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
-        assert(normalAcc.type == TINYGLTF_TYPE_VEC3);
-        glm::vec3* normalHead = reinterpret_cast<glm::vec3*>(normalBuf.data.data() + normalAcc.byteOffset + normalView.byteOffset);
-
-        glm::vec2* texHead = nullptr;
-        if (primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end()) {
-            uint32_t texBufAccIdx = primitive.attributes["TEXCOORD_0"];
-            auto& texAcc = model.accessors[texBufAccIdx];
-            auto& texView = model.bufferViews[texAcc.bufferView];
-            auto& texBuf = model.buffers[texView.buffer];
-            assert(texAcc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
-            assert(texAcc.type == TINYGLTF_TYPE_VEC2);
-            texHead = reinterpret_cast<glm::vec2*>(texBuf.data.data() + texAcc.byteOffset + texView.byteOffset);
-            assert(posAcc.count == texAcc.count);
-        }
-
-        assert(posAcc.count == normalAcc.count);
+bool Scene::processTexture(GLTFTexture& texture, texturetools::Encoding encoding) const {
+    if (texture.data.empty()) {
+        return false;
+    }
 
-        const size_t nrVertices = posAcc.count;
+    bool hasAlpha = false;
+    for(size_t i=3; i<texture.data.size(); i+=4) {
+        hasAlpha = hasAlpha || texture.data[i] != 255;
+    }
 
-        for(size_t i=0; i<nrVertices; i++) {
-            glm::vec2 uv = texHead == nullptr ? glm::vec2(0) : *(texHead+i);
-            glm::vec3& normal = *(normalHead+i);
-            normal = glm::normalize((transform * glm::vec4(normal,0)).xyz());
-            resmesh.vertices.push_back(GLTFVertex {
-                .pos = glm::vec4(*(posHead+i), uv.x),
-                .normal = glm::vec4(normal, uv.y),
-            });
+    uint64_t key = hash::Bytes(texture.data.data(), texture.data.size());
+    key = hash::Combine(key, texture.width);
+    key = hash::Combine(key, texture.height);
+    key = hash::Combine(key, texture.normal_map);
+    key = hash::Combine(key, static_cast<uint32_t>(encoding));
+    key = hash::Combine(key, TEXTURE_CACHE_VERSION);
+
+    std::filesystem::path path;
+    if (texture_cache_directory != nullptr) {
+        path = std::filesystem::path(texture_cache_directory) / fmt::format("{:016x}.tex", key);
+        std::ifstream file(path, std::ios::binary);
+        TextureCacheHeader header{};
+        // the key covers the encoding, but a stale or foreign file must not hand the uploader a chain of the wrong size
+        const vk::Format expectedFormat = texturetools::ChooseFormat(encoding, texture.normal_map, hasAlpha);
+        const uint32_t expectedLevels = texturetools::MipLevelCount(texture.width, texture.height);
+        if (file.is_open() && file.read(reinterpret_cast<char*>(&header), sizeof(header))
+                && memcmp(header.magic, TEXTURE_MAGIC, sizeof(TEXTURE_MAGIC)) == 0
+                && header.width == texture.width && header.height == texture.height
+                && header.format == expectedFormat && header.mip_levels == expectedLevels
+                && header.size == texturetools::ChainSize(expectedFormat, texture.width, texture.height, expectedLevels)) {
+            std::vector<uint8_t> data(header.size);
+            if (file.read(reinterpret_cast<char*>(data.data()), data.size())) {
+                texture.data = std::move(data);
+                texture.format = header.format;
+                texture.mip_levels = header.mip_levels;
+                return true;
+            }
         }
+    }
 
+    const uint32_t mipLevels = texturetools::MipLevelCount(texture.width, texture.height);
+    const auto chain = texturetools::GenerateMips(texture.data.data(), texture.width, texture.height, texture.normal_map);
+    texture.format = texturetools::ChooseFormat(encoding, texture.normal_map, hasAlpha);
+    texture.data = texturetools::EncodeChain(chain, texture.width, texture.height, mipLevels, texture.format);
+    texture.mip_levels = mipLevels;
+
+    if (!path.empty()) {
+        std::filesystem::create_directories(path.parent_path());
+        // unique temporary per thread, renamed into place so readers never see a partial file
+        auto tmpPath = path;
+        tmpPath += fmt::format(".{}.tmp", std::hash<std::thread::id>()(std::this_thread::get_id()));
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (file.is_open()) {
+            TextureCacheHeader header {
+                .format = texture.format,
+                .mip_levels = texture.mip_levels,
+                .width = texture.width,
+                .height = texture.height,
+                .size = texture.data.size(),
+            };
+            memcpy(header.magic, TEXTURE_MAGIC, sizeof(TEXTURE_MAGIC));
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(texture.data.data()), texture.data.size());
+            file.close();
+            std::filesystem::rename(tmpPath, path);
+        }
+    }
+    return false;
+}
 
-        assert(primitive.indices != -1);
-        uint32_t indexBufAccIdx = primitive.indices;
-        auto& indexAcc = model.accessors[indexBufAccIdx];
-        auto& indexView = model.bufferViews[indexAcc.bufferView];
-        auto& indexBuf = model.buffers[indexView.buffer];
-        assert(indexAcc.type == TINYGLTF_TYPE_SCALAR);
-        uint16_t* indexHead = reinterpret_cast<uint16_t*>(indexBuf.data.data() + indexAcc.byteOffset + indexView.byteOffset);
-        const size_t nrIndices = indexAcc.count;
-
-        switch(indexAcc.componentType) {
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: vector_insert_cast<uint32_t, uint16_t>(resmesh.indices, reinterpret_cast<uint16_t*>(indexHead), nrIndices); break;
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: vector_insert_cast<uint32_t, uint32_t>(resmesh.indices, reinterpret_cast<uint32_t*>(indexHead), nrIndices); break;
-            default: throw std::runtime_error("Unsupported index type"); break;
-        }
-
-        res.material.emission = glm::vec4(0);
-        res.material.glass = glm::vec4(0,0,0,1);
-        res.material.diffuse_color = glm::vec4(1);
-        res.material.texture_id = -1;
-        res.material.roughness = 1;
-        res.material.metallic = 1;
-        res.material.normal_texture_id = -1;
-        if (primitive.material != -1) {
-            const auto& m = model.materials[primitive.material];
-            assert(m.pbrMetallicRoughness.baseColorFactor.size() == 4 && "Four channel base color expected");
-            res.material.diffuse_color.x = m.pbrMetallicRoughness.baseColorFactor[0];
-            res.material.diffuse_color.y = m.pbrMetallicRoughness.baseColorFactor[1];
-            res.material.diffuse_color.z = m.pbrMetallicRoughness.baseColorFactor[2];
-            const float m_alpha = m.pbrMetallicRoughness.baseColorFactor[3];
-            if (m.alphaMode == "OPAQUE") {
-                res.material.diffuse_color.w = 1.0f;
-            } else if (m.alphaMode == "MASK") {
-                if (m_alpha > m.alphaCutoff) {
-                    res.material.diffuse_color.w = 1.0f;
-                } else {
-                    res.material.diffuse_color.w = 0.0f;
-                }
-            } else if (m.alphaMode == "BLEND") {
-                res.material.diffuse_color.w = m_alpha;
+MaterialID Scene::resolveMaterial(tinygltf::Model& model, int materialIndex, TextureCache& textureCache, std::unordered_map<int, MaterialID>& materialIDs) {
+    // primitives without a material share the default one under index -1
+    if (auto it = materialIDs.find(materialIndex); it != materialIDs.end()) {
+        return it->second;
+    }
+
+    GLTFMaterial material{};
+    material.emission = glm::vec4(0);
+    material.glass = glm::vec4(0,0,0,1);
+    material.diffuse_color = glm::vec4(1);
+    material.texture_id = -1;
+    material.roughness = 1;
+    material.metallic = 1;
+    material.normal_texture_id = -1;
+    if (materialIndex != -1) {
+        const auto& m = model.materials[materialIndex];
+        assert(m.pbrMetallicRoughness.baseColorFactor.size() == 4 && "Four channel base color expected");
+        material.diffuse_color.x = m.pbrMetallicRoughness.baseColorFactor[0];
+        material.diffuse_color.y = m.pbrMetallicRoughness.baseColorFactor[1];
+        material.diffuse_color.z = m.pbrMetallicRoughness.baseColorFactor[2];
+        const float m_alpha = m.pbrMetallicRoughness.baseColorFactor[3];
+        if (m.alphaMode == "OPAQUE") {
+            material.diffuse_color.w = 1.0f;
+        } else if (m.alphaMode == "MASK") {
+            if (m_alpha > m.alphaCutoff) {
+                material.diffuse_color.w = 1.0f;
             } else {
-                assert(false);
-            }
-            res.material.roughness = m.pbrMetallicRoughness.roughnessFactor;
-            res.material.metallic = m.pbrMetallicRoughness.metallicFactor;
-
-            res.material.emission.x = m.emissiveFactor[0];
-            res.material.emission.y = m.emissiveFactor[1];
-            res.material.emission.z = m.emissiveFactor[2];
-
-            const TextureID textureID = m.pbrMetallicRoughness.baseColorTexture.index;
-            if (textureID != -1) {
-                const auto& t = model.textures[textureID];
-                const auto& t_image = model.images[t.source];
-
-                GLTFTexture texture {
-                    .width = static_cast<uint32_t>(t_image.width),
-                    .height = static_cast<uint32_t>(t_image.height),
-                    .data = t_image.image,
-                };
-
-                this->textures.push_back(texture);
-                res.material.texture_id = static_cast<uint32_t>(textures.size()) - 1;
+                material.diffuse_color.w = 0.0f;
             }
+        } else if (m.alphaMode == "BLEND") {
+            material.diffuse_color.w = m_alpha;
+        } else {
+            assert(false);
+        }
+        material.roughness = m.pbrMetallicRoughness.roughnessFactor;
+        material.metallic = m.pbrMetallicRoughness.metallicFactor;
+
+        material.emission.x = m.emissiveFactor[0];
+        material.emission.y = m.emissiveFactor[1];
+        material.emission.z = m.emissiveFactor[2];
+
+        const int textureID = m.pbrMetallicRoughness.baseColorTexture.index;
+        if (textureID != -1) {
+            material.texture_id = resolveTexture(model, textureID, false, textureCache);
+        }
+
+        const int normalTexturID = m.normalTexture.index;
+        if (normalTexturID != -1) {
+            material.normal_texture_id = resolveTexture(model, normalTexturID, true, textureCache);
+        }
+    }
 
-            const TextureID normalTexturID = m.normalTexture.index;
-            if (normalTexturID != -1) {
-                const auto& t = model.textures[normalTexturID];
-                const auto& t_image = model.images[t.source];
+    const MaterialID materialID = static_cast<MaterialID>(materials.size());
+    materials.push_back(material);
+    materialIDs.emplace(materialIndex, materialID);
+    return materialID;
+}
 
-                GLTFTexture normalTexture {
-                    .width = static_cast<uint32_t>(t_image.width),
-                    .height = static_cast<uint32_t>(t_image.height),
-                    .data = t_image.image,
-                };
+GLTFMesh Scene::layoutMesh(tinygltf::Model& model, const tinygltf::Mesh& mesh, const char* filename, TextureCache& textureCache, std::unordered_map<int, MaterialID>& materialIDs) {
+    const uint32_t stride = vertextools::Stride(vertex_layout);
+    uint32_t runningVertexCount = 0;
+    uint32_t runningIndexBytes = 0;
+    glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+    GLTFMesh resmesh{};
+    for(const auto& primitive : mesh.primitives) {
+        GLTFPrimitive res{};
 
-                this->textures.push_back(normalTexture);
-                res.material.normal_texture_id = static_cast<uint32_t>(textures.size()) - 1;
+        assert(primitive.attributes.find("POSITION") != primitive.attributes.end());
+        assert(primitive.attributes.find("NORMAL") != primitive.attributes.end());
+        assert(primitive.indices != -1);
+        const auto& posAcc = model.accessors[primitive.attributes.at("POSITION")];
+        const size_t nrVertices = posAcc.count;
+        const size_t nrIndices = model.accessors[primitive.indices].count;
+
+        // glTF requires bounds on positions, they set the quantization range of the whole mesh
+        if (posAcc.minValues.size() == 3 && posAcc.maxValues.size() == 3) {
+            boundsMin = glm::min(boundsMin, glm::vec3(posAcc.minValues[0], posAcc.minValues[1], posAcc.minValues[2]));
+            boundsMax = glm::max(boundsMax, glm::vec3(posAcc.maxValues[0], posAcc.maxValues[1], posAcc.maxValues[2]));
+        } else {
+            const auto [posHead, posStride] = accessorData(model, posAcc);
+            for(size_t i=0; i<nrVertices; i++) {
+                const glm::vec3 pos = *reinterpret_cast<const glm::vec3*>(posHead + i * posStride);
+                boundsMin = glm::min(boundsMin, pos);
+                boundsMax = glm::max(boundsMax, pos);
             }
-        } 
+        }
+
+        res.material_id = resolveMaterial(model, primitive.material, textureCache, materialIDs);
 
         res.index_count = nrIndices;
-        res.index_offset = runningIndexCount;
+        res.index_offset = runningIndexBytes;
         res.vertex_count = nrVertices;
         res.vertex_offset = runningVertexCount;
+        res.index_type = nrVertices <= std::numeric_limits<uint16_t>::max() + 1 ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
 
-        runningIndexCount += nrIndices;
+        runningIndexBytes += nrIndices * res.IndexSize();
         runningVertexCount += nrVertices;
 
-        while(runningIndexCount % 4 != 0) {
-            resmesh.indices.push_back(0);
-            runningIndexCount++;
+        // keep every primitive's vertices and indices 16 byte aligned, the padding stays zero
+        while(runningIndexBytes % 16 != 0) {
+            runningIndexBytes++;
+        }
+        while((runningVertexCount * stride) % 16 != 0) {
+            runningVertexCount++;
         }
 
         logger::info("Loaded a primitive of {}, #vertices: {}  ---  #indices: {}", filename, nrVertices, nrIndices);
         resmesh.primitives.push_back(res);
     }
-    meshes.push_back(resmesh);
+
+    if (vertex_layout == VertexLayout::eQuantized && runningVertexCount > 0) {
+        resmesh.position_offset = (boundsMin + boundsMax) * 0.5f;
+        resmesh.position_scale = glm::max((boundsMax - boundsMin) * 0.5f, glm::vec3(1e-6f));
+    }
+
+    // sized once, the primitives are filled in concurrently by convertPrimitive
+    resmesh.vertex_data.resize(size_t(runningVertexCount) * stride);
+    resmesh.index_data.resize(runningIndexBytes);
+    return resmesh;
+}
+
+void Scene::convertPrimitive(const tinygltf::Model& model, const tinygltf::Primitive& primitive, GLTFMesh& mesh, GLTFPrimitive& res, VertexLayout layout, bool optimize) {
+    uint32_t posBufAccIdx = primitive.attributes.at("POSITION");
+    auto& posAcc = model.accessors[posBufAccIdx];
+    assert(posAcc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
+    assert(posAcc.type == TINYGLTF_TYPE_VEC3);
+    const auto [posHead, posStride] = accessorData(model, posAcc);
+
+    uint32_t normalBufAccIdx = primitive.attributes.at("NORMAL");
+    auto& normalAcc = model.accessors[normalBufAccIdx];
+    assert(normalAcc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
+    assert(normalAcc.type == TINYGLTF_TYPE_VEC3);
+    const auto [normalHead, normalStride] = accessorData(model, normalAcc);
+
+    const uint8_t* texHead = nullptr;
+    size_t texStride = 0;
+    if (primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end()) {
+        uint32_t texBufAccIdx = primitive.attributes.at("TEXCOORD_0");
+        auto& texAcc = model.accessors[texBufAccIdx];
+        assert(texAcc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
+        assert(texAcc.type == TINYGLTF_TYPE_VEC2);
+        std::tie(texHead, texStride) = accessorData(model, texAcc);
+        assert(posAcc.count == texAcc.count);
+    }
+
+    assert(posAcc.count == normalAcc.count);
+
+    std::vector<GLTFVertex> vertices(res.vertex_count);
+    for(size_t i=0; i<res.vertex_count; i++) {
+        glm::vec2 uv = texHead == nullptr ? glm::vec2(0) : *reinterpret_cast<const glm::vec2*>(texHead + i * texStride);
+        const glm::vec3& normal = *reinterpret_cast<const glm::vec3*>(normalHead + i * normalStride);
+        vertices[i] = GLTFVertex {
+            .pos = glm::vec4(*reinterpret_cast<const glm::vec3*>(posHead + i * posStride), uv.x),
+            .normal = glm::vec4(normal, uv.y),
+        };
+    }
+
+    uint32_t indexBufAccIdx = primitive.indices;
+    auto& indexAcc = model.accessors[indexBufAccIdx];
+    auto& indexView = model.bufferViews[indexAcc.bufferView];
+    auto& indexBuf = model.buffers[indexView.buffer];
+    assert(indexAcc.type == TINYGLTF_TYPE_SCALAR);
+    const uint8_t* indexHead = indexBuf.data.data() + indexAcc.byteOffset + indexView.byteOffset;
+
+    std::vector<uint32_t> indices(res.index_count);
+    switch(indexAcc.componentType) {
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: copy_cast<uint32_t, uint8_t>(indices.data(), indexHead, res.index_count); break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: copy_cast<uint32_t, uint16_t>(indices.data(), reinterpret_cast<const uint16_t*>(indexHead), res.index_count); break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: copy_cast<uint32_t, uint32_t>(indices.data(), reinterpret_cast<const uint32_t*>(indexHead), res.index_count); break;
+        default: throw std::runtime_error("Unsupported index type"); break;
+    }
+
+    if (optimize) {
+        // only ever shrinks the vertex count, the gap left in the mesh is closed by compactVertices
+        meshtools::Optimize(vertices, indices);
+        res.vertex_count = static_cast<uint32_t>(vertices.size());
+    }
+
+    const uint32_t stride = vertextools::Stride(layout);
+    vertextools::Pack(layout, vertices.data(), vertices.size(), mesh.position_scale, mesh.position_offset, mesh.vertex_data.data() + size_t(res.vertex_offset) * stride);
+
+    uint8_t* dst = mesh.index_data.data() + res.index_offset;
+    if (res.index_type == vk::IndexType::eUint16) {
+        copy_cast<uint16_t, uint32_t>(reinterpret_cast<uint16_t*>(dst), indices.data(), indices.size());
+    } else {
+        memcpy(dst, indices.data(), indices.size() * sizeof(uint32_t));
+    }
+}
+
+void Scene::compactVertices(GLTFMesh& mesh, VertexLayout layout) {
+    const uint32_t stride = vertextools::Stride(layout);
+    uint32_t runningVertexCount = 0;
+    for(auto& primitive : mesh.primitives) {
+        // primitives only move towards the front, so nothing is overwritten before it is moved
+        memmove(mesh.vertex_data.data() + size_t(runningVertexCount) * stride, mesh.vertex_data.data() + size_t(primitive.vertex_offset) * stride, size_t(primitive.vertex_count) * stride);
+        primitive.vertex_offset = runningVertexCount;
+        runningVertexCount += primitive.vertex_count;
+        while((runningVertexCount * stride) % 16 != 0) {
+            runningVertexCount++;
+        }
+    }
+    mesh.vertex_data.resize(size_t(runningVertexCount) * stride);
+    mesh.vertex_data.shrink_to_fit();
+}
+
+bool Scene::loadCache(const std::filesystem::path& path, const std::filesystem::path& source) {
+    std::error_code error;
+    const auto size = std::filesystem::file_size(path, error);
+    if (error) {
+        return false;
+    }
+    // an empty or truncated file is what an interrupted write leaves behind, rebuild it like any other stale cache
+    if (size < sizeof(CacheHeader)) {
+        logger::warn("Ignoring truncated scene cache {}", path.string());
+        return false;
+    }
+
+    std::unique_ptr<MappedFile> file;
+    try {
+        file = std::make_unique<MappedFile>(path);
+    } catch (const std::exception& e) {
+        logger::warn("Ignoring unreadable scene cache: {}", e.what());
+        return false;
+    }
+    auto inBounds = [&](uint64_t offset, uint64_t bytes) {
+        return offset <= file->Size() && bytes <= file->Size() - offset;
+    };
+
+    CacheHeader header{};
+    memcpy(&header, file->Data(), sizeof(CacheHeader));
+    bool valid = memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+        && header.version == CACHE_VERSION
+        && header.vertex_layout == vertex_layout
+        && (header.optimized != 0) == optimize_meshes
+        && header.texture_encoding == deviceTextureEncoding()
+        && header.file_size == file->Size()
+        && header.source_size == std::filesystem::file_size(source)
+        && header.source_time == std::filesystem::last_write_time(source).time_since_epoch().count()
+        && inBounds(header.meshes_offset, header.mesh_count * sizeof(CacheMesh))
+        && inBounds(header.instances_offset, header.instance_count * sizeof(GLTFInstance))
+        && inBounds(header.textures_offset, header.texture_count * sizeof(CacheTexture))
+        && inBounds(header.materials_offset, header.material_count * sizeof(GLTFMaterial));
+
+    const auto cacheMeshes = file->View<CacheMesh>(header.meshes_offset, valid ? header.mesh_count : 0);
+    const auto cacheTextures = file->View<CacheTexture>(header.textures_offset, valid ? header.texture_count : 0);
+    for(const auto& mesh : cacheMeshes) {
+        valid = valid && inBounds(mesh.primitives_offset, mesh.primitive_count * sizeof(GLTFPrimitive))
+            && inBounds(mesh.vertex_data_offset, mesh.vertex_data_size)
+            && inBounds(mesh.index_data_offset, mesh.index_data_size);
+    }
+    for(const auto& texture : cacheTextures) {
+        valid = valid && inBounds(texture.data_offset, texture.data_size);
+    }
+
+    if (!valid) {
+        logger::warn("Ignoring stale scene cache {}", path.string());
+        return false;
+    }
+
+    // ids in the cache are relative to the model, rebase them onto what is already loaded
+    const uint32_t meshOffset = static_cast<uint32_t>(meshes.size());
+    const uint32_t textureOffset = static_cast<uint32_t>(textures.size());
+    const uint32_t materialOffset = static_cast<uint32_t>(materials.size());
+    const TextureID noTexture = -1;
+
+    for(auto material : file->View<GLTFMaterial>(header.materials_offset, header.material_count)) {
+        if (material.texture_id != noTexture) material.texture_id += textureOffset;
+        if (material.normal_texture_id != noTexture) material.normal_texture_id += textureOffset;
+        materials.push_back(material);
+    }
+
+    for(const auto& cacheMesh : cacheMeshes) {
+        GLTFMesh mesh{};
+        const auto primitives = file->View<GLTFPrimitive>(cacheMesh.primitives_offset, cacheMesh.primitive_count);
+        mesh.primitives.assign(primitives.begin(), primitives.end());
+        for(auto& primitive : mesh.primitives) {
+            primitive.material_id += materialOffset;
+        }
+        mesh.mapped_vertex_data = file->View<uint8_t>(cacheMesh.vertex_data_offset, cacheMesh.vertex_data_size);
+        mesh.mapped_index_data = file->View<uint8_t>(cacheMesh.index_data_offset, cacheMesh.index_data_size);
+        mesh.position_scale = cacheMesh.position_scale;
+        mesh.position_offset = cacheMesh.position_offset;
+        meshes.push_back(std::move(mesh));
+    }
+
+    for(const auto& instance : file->View<GLTFInstance>(header.instances_offset, header.instance_count)) {
+        instances.push_back(GLTFInstance {
+            .mesh_id = instance.mesh_id + meshOffset,
+            .transform = instance.transform,
+        });
+    }
+
+    for(const auto& cacheTexture : cacheTextures) {
+        textures.push_back(GLTFTexture {
+            .width = cacheTexture.width,
+            .height = cacheTexture.height,
+            .mapped_data = file->View<uint8_t>(cacheTexture.data_offset, cacheTexture.data_size),
+            .format = cacheTexture.format,
+            .mip_levels = cacheTexture.mip_levels,
+            .normal_map = cacheTexture.normal_map != 0,
+        });
+    }
+
+    mapped_files.push_back(std::move(file));
+    return true;
+}
+
+void Scene::storeCache(const std::filesystem::path& path, const std::filesystem::path& source, const LoadRange& range) const {
+    std::filesystem::create_directories(path.parent_path());
+    // write to a temporary first so an interrupted run never leaves a truncated cache behind
+    auto tmpPath = path;
+    tmpPath += ".tmp";
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        logger::warn("Could not write scene cache {}", path.string());
+        return;
+    }
+
+    // the header is filled in last, once all offsets are known
+    CacheHeader header{};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+    uint64_t head = sizeof(CacheHeader);
+
+    static const std::vector<char> zeros(CACHE_ALIGNMENT);
+    auto append = [&](const void* data, uint64_t size, uint64_t alignment) {
+        const uint64_t padding = (alignment - head % alignment) % alignment;
+        file.write(zeros.data(), padding);
+        file.write(reinterpret_cast<const char*>(data), size);
+        head += padding + size;
+        return head - size;
+    };
+
+    const TextureID noTexture = -1;
+    std::vector<CacheMesh> cacheMeshes;
+    for(uint32_t i=range.mesh_offset; i<meshes.size(); i++) {
+        const auto& mesh = meshes[i];
+        std::vector<GLTFPrimitive> primitives = mesh.primitives;
+        for(auto& primitive : primitives) {
+            primitive.material_id -= range.material_offset;
+        }
+        const auto vertices = mesh.VertexData();
+        const auto indices = mesh.IndexData();
+        CacheMesh cacheMesh {
+            .primitives_offset = append(primitives.data(), primitives.size() * sizeof(GLTFPrimitive), alignof(GLTFPrimitive)),
+            .primitive_count = primitives.size(),
+            .vertex_data_offset = append(vertices.data(), vertices.size(), CACHE_ALIGNMENT),
+            .vertex_data_size = vertices.size(),
+            .index_data_offset = append(indices.data(), indices.size(), CACHE_ALIGNMENT),
+            .index_data_size = indices.size(),
+            .position_scale = mesh.position_scale,
+            .position_offset = mesh.position_offset,
+        };
+        cacheMeshes.push_back(cacheMesh);
+    }
+
+    std::vector<CacheTexture> cacheTextures;
+    for(uint32_t i=range.texture_offset; i<textures.size(); i++) {
+        const auto data = textures[i].Data();
+        cacheTextures.push_back(CacheTexture {
+            .width = textures[i].width,
+            .height = textures[i].height,
+            .data_offset = append(data.data(), data.size(), CACHE_ALIGNMENT),
+            .data_size = data.size(),
+            .format = textures[i].format,
+            .mip_levels = textures[i].mip_levels,
+            .normal_map = textures[i].normal_map,
+        });
+    }
+
+    std::vector<GLTFMaterial> cacheMaterials(materials.begin() + range.material_offset, materials.end());
+    for(auto& material : cacheMaterials) {
+        if (material.texture_id != noTexture) material.texture_id -= range.texture_offset;
+        if (material.normal_texture_id != noTexture) material.normal_texture_id -= range.texture_offset;
+    }
+
+    std::vector<GLTFInstance> cacheInstances(instances.begin() + range.instance_offset, instances.end());
+    for(auto& instance : cacheInstances) {
+        instance.mesh_id -= range.mesh_offset;
+    }
+
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.vertex_layout = vertex_layout;
+    header.optimized = optimize_meshes;
+    header.texture_encoding = deviceTextureEncoding();
+    header.mesh_count = static_cast<uint32_t>(cacheMeshes.size());
+    header.instance_count = static_cast<uint32_t>(cacheInstances.size());
+    header.texture_count = static_cast<uint32_t>(cacheTextures.size());
+    header.material_count = static_cast<uint32_t>(cacheMaterials.size());
+    header.source_size = std::filesystem::file_size(source);
+    header.source_time = std::filesystem::last_write_time(source).time_since_epoch().count();
+    header.meshes_offset = append(cacheMeshes.data(), cacheMeshes.size() * sizeof(CacheMesh), alignof(CacheMesh));
+    header.instances_offset = append(cacheInstances.data(), cacheInstances.size() * sizeof(GLTFInstance), alignof(GLTFInstance));
+    header.textures_offset = append(cacheTextures.data(), cacheTextures.size() * sizeof(CacheTexture), alignof(CacheTexture));
+    header.materials_offset = append(cacheMaterials.data(), cacheMaterials.size() * sizeof(GLTFMaterial), alignof(GLTFMaterial));
+    header.file_size = head;
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+    file.close();
+    // a full disk fails the writes, only a complete file may replace the cache
+    if (file.fail()) {
+        logger::warn("Could not write scene cache {}", path.string());
+        std::filesystem::remove(tmpPath);
+        return;
+    }
+    std::filesystem::rename(tmpPath, path);
+    logger::info("Wrote scene cache {} ({:.2f} MiB)", path.string(), head / (1024.0 * 1024.0));
 }
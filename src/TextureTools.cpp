@@ -0,0 +1,494 @@
+#include <TextureTools.h>
+
+namespace texturetools {
+
+static float srgbToLinear(float c) {
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linearToSrgb(float c) {
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+static uint8_t toUnorm8(float c) {
+    return static_cast<uint8_t>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+uint32_t MipLevelCount(uint32_t width, uint32_t height) {
+    uint32_t levels = 1;
+    while ((width | height) > 1) {
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+        levels++;
+    }
+    return levels;
+}
+
+std::pair<uint32_t, uint32_t> BlockInfo(vk::Format format) {
+    switch (format) {
+        case vk::Format::eBc1RgbaUnormBlock: return { 4, 8 };
+        case vk::Format::eBc3UnormBlock: return { 4, 16 };
+        case vk::Format::eBc5UnormBlock: return { 4, 16 };
+        case vk::Format::eBc7UnormBlock: return { 4, 16 };
+        case vk::Format::eR8G8B8A8Unorm: return { 1, 4 };
+        default: throw std::runtime_error("Unsupported texture format");
+    }
+}
+
+size_t LevelSize(vk::Format format, uint32_t width, uint32_t height) {
+    const auto [blockExtent, blockBytes] = BlockInfo(format);
+    return size_t((width + blockExtent - 1) / blockExtent) * ((height + blockExtent - 1) / blockExtent) * blockBytes;
+}
+
+size_t ChainSize(vk::Format format, uint32_t width, uint32_t height, uint32_t mipLevels) {
+    size_t size = 0;
+    for(uint32_t level=0; level<mipLevels; level++) {
+        size += LevelSize(format, width, height);
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+    }
+    return size;
+}
+
+std::vector<uint8_t> GenerateMips(const uint8_t* rgba, uint32_t width, uint32_t height, bool normalMap) {
+    const uint32_t mipLevels = MipLevelCount(width, height);
+    std::vector<uint8_t> chain(ChainSize(vk::Format::eR8G8B8A8Unorm, width, height, mipLevels));
+    memcpy(chain.data(), rgba, size_t(width) * height * 4);
+
+    // filtering happens on linear values (or unit normals), kept in float between levels so
+    // the chain does not accumulate 8 bit rounding
+    std::vector<glm::vec4> level(size_t(width) * height);
+    for(size_t i=0; i<level.size(); i++) {
+        glm::vec4 texel = glm::vec4(rgba[4*i+0], rgba[4*i+1], rgba[4*i+2], rgba[4*i+3]) / 255.0f;
+        if (normalMap) {
+            level[i] = glm::vec4(glm::vec3(texel) * 2.0f - 1.0f, texel.w);
+        } else {
+            level[i] = glm::vec4(srgbToLinear(texel.x), srgbToLinear(texel.y), srgbToLinear(texel.z), texel.w);
+        }
+    }
+
+    size_t offset = size_t(width) * height * 4;
+    for(uint32_t mip=1; mip<mipLevels; mip++) {
+        const uint32_t dstWidth = std::max(width / 2, 1u);
+        const uint32_t dstHeight = std::max(height / 2, 1u);
+        std::vector<glm::vec4> next(size_t(dstWidth) * dstHeight);
+
+        for(uint32_t y=0; y<dstHeight; y++) {
+            const uint32_t y0 = std::min(2*y, height - 1), y1 = std::min(2*y + 1, height - 1);
+            for(uint32_t x=0; x<dstWidth; x++) {
+                const uint32_t x0 = std::min(2*x, width - 1), x1 = std::min(2*x + 1, width - 1);
+                glm::vec4 sum = level[y0*width + x0] + level[y0*width + x1] + level[y1*width + x0] + level[y1*width + x1];
+                glm::vec4 texel = sum * 0.25f;
+                if (normalMap) {
+                    const float length = glm::length(glm::vec3(texel));
+                    texel = glm::vec4(length > 0.0f ? glm::vec3(texel) / length : glm::vec3(0, 0, 1), texel.w);
+                }
+                next[y*dstWidth + x] = texel;
+
+                uint8_t* out = chain.data() + offset + 4 * (size_t(y)*dstWidth + x);
+                if (normalMap) {
+                    out[0] = toUnorm8(texel.x * 0.5f + 0.5f);
+                    out[1] = toUnorm8(texel.y * 0.5f + 0.5f);
+                    out[2] = toUnorm8(texel.z * 0.5f + 0.5f);
+                } else {
+                    out[0] = toUnorm8(linearToSrgb(texel.x));
+                    out[1] = toUnorm8(linearToSrgb(texel.y));
+                    out[2] = toUnorm8(linearToSrgb(texel.z));
+                }
+                out[3] = toUnorm8(texel.w);
+            }
+        }
+
+        offset += size_t(dstWidth) * dstHeight * 4;
+        level = std::move(next);
+        width = dstWidth;
+        height = dstHeight;
+    }
+    return chain;
+}
+
+vk::Format ChooseFormat(Encoding encoding, bool normalMap, bool hasAlpha) {
+    if (encoding == Encoding::eUncompressed) {
+        return vk::Format::eR8G8B8A8Unorm;
+    }
+    if (normalMap) {
+        return vk::Format::eBc5UnormBlock;
+    }
+    if (encoding == Encoding::eBC7) {
+        return vk::Format::eBc7UnormBlock;
+    }
+    return hasAlpha ? vk::Format::eBc3UnormBlock : vk::Format::eBc1RgbaUnormBlock;
+}
+
+std::vector<uint8_t> EncodeChain(const std::vector<uint8_t>& chain, uint32_t width, uint32_t height, uint32_t mipLevels, vk::Format format) {
+    if (format == vk::Format::eR8G8B8A8Unorm) {
+        return chain;
+    }
+
+    const auto [blockExtent, blockBytes] = BlockInfo(format);
+    std::vector<uint8_t> encoded(ChainSize(format, width, height, mipLevels));
+    const uint8_t* src = chain.data();
+    uint8_t* dst = encoded.data();
+
+    for(uint32_t mip=0; mip<mipLevels; mip++) {
+        const uint32_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        for(uint32_t by=0; by<blocksY; by++) {
+            for(uint32_t bx=0; bx<blocksX; bx++) {
+                // gather the block, texels past the edge of small levels repeat the last row and column
+                uint8_t block[64];
+                for(uint32_t y=0; y<4; y++) {
+                    for(uint32_t x=0; x<4; x++) {
+                        const uint32_t sx = std::min(bx*4 + x, width - 1), sy = std::min(by*4 + y, height - 1);
+                        memcpy(block + 4*(y*4 + x), src + 4*(size_t(sy)*width + sx), 4);
+                    }
+                }
+
+                switch (format) {
+                    case vk::Format::eBc1RgbaUnormBlock: EncodeBC1Block(block, dst); break;
+                    case vk::Format::eBc3UnormBlock: EncodeBC3Block(block, dst); break;
+                    case vk::Format::eBc5UnormBlock: EncodeBC5Block(block, dst); break;
+                    case vk::Format::eBc7UnormBlock: EncodeBC7Block(block, dst); break;
+                    default: throw std::runtime_error("Unsupported texture format");
+                }
+                dst += blockBytes;
+            }
+        }
+
+        src += size_t(width) * height * 4;
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+    }
+    return encoded;
+}
+
+// principal axis of the block's colors through power iteration on the covariance matrix
+template<int N>
+static void principalAxis(const float (&pixels)[16][4], float (&mean)[4], float (&axis)[4]) {
+    for(int c=0; c<N; c++) {
+        mean[c] = 0.0f;
+        for(int i=0; i<16; i++) mean[c] += pixels[i][c];
+        mean[c] /= 16.0f;
+    }
+
+    float covariance[N][N] = {};
+    for(int i=0; i<16; i++) {
+        for(int a=0; a<N; a++) {
+            for(int b=0; b<N; b++) {
+                covariance[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+            }
+        }
+    }
+
+    for(int c=0; c<N; c++) axis[c] = 1.0f;
+    for(int iteration=0; iteration<8; iteration++) {
+        float next[N] = {};
+        for(int a=0; a<N; a++) {
+            for(int b=0; b<N; b++) next[a] += covariance[a][b] * axis[b];
+        }
+        float length = 0.0f;
+        for(int c=0; c<N; c++) length += next[c] * next[c];
+        length = std::sqrt(length);
+        if (length < 1e-6f) {
+            for(int c=0; c<N; c++) axis[c] = 0.0f;
+            return;
+        }
+        for(int c=0; c<N; c++) axis[c] = next[c] / length;
+    }
+}
+
+// endpoints spanning the projection of the block onto its principal axis
+template<int N>
+static void fitEndpoints(const float (&pixels)[16][4], float (&e0)[4], float (&e1)[4]) {
+    float mean[4], axis[4];
+    principalAxis<N>(pixels, mean, axis);
+
+    float tMin = 0.0f, tMax = 0.0f;
+    for(int i=0; i<16; i++) {
+        float t = 0.0f;
+        for(int c=0; c<N; c++) t += (pixels[i][c] - mean[c]) * axis[c];
+        tMin = std::min(tMin, t);
+        tMax = std::max(tMax, t);
+    }
+    for(int c=0; c<N; c++) {
+        e0[c] = std::clamp(mean[c] + axis[c] * tMax, 0.0f, 255.0f);
+        e1[c] = std::clamp(mean[c] + axis[c] * tMin, 0.0f, 255.0f);
+    }
+}
+
+// least squares endpoints for fixed interpolation weights, keeps the old ones when degenerate
+template<int N>
+static void refineEndpoints(const float (&pixels)[16][4], const float (&weights)[16], float (&e0)[4], float (&e1)[4]) {
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[4] = {}, bx[4] = {};
+    for(int i=0; i<16; i++) {
+        const float b = weights[i], a = 1.0f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for(int c=0; c<N; c++) {
+            ax[c] += a * pixels[i][c];
+            bx[c] += b * pixels[i][c];
+        }
+    }
+
+    const float det = aa * bb - ab * ab;
+    if (std::abs(det) < 1e-6f) {
+        return;
+    }
+    for(int c=0; c<N; c++) {
+        e0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / det, 0.0f, 255.0f);
+        e1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / det, 0.0f, 255.0f);
+    }
+}
+
+static void loadBlock(const uint8_t block[64], float (&pixels)[16][4]) {
+    for(int i=0; i<16; i++) {
+        for(int c=0; c<4; c++) pixels[i][c] = block[4*i + c];
+    }
+}
+
+static uint16_t packRGB565(const float (&color)[4]) {
+    const uint32_t r = static_cast<uint32_t>(color[0] * 31.0f / 255.0f + 0.5f);
+    const uint32_t g = static_cast<uint32_t>(color[1] * 63.0f / 255.0f + 0.5f);
+    const uint32_t b = static_cast<uint32_t>(color[2] * 31.0f / 255.0f + 0.5f);
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static void unpackRGB565(uint16_t packed, float (&color)[4]) {
+    const uint32_t r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = static_cast<float>((r << 3) | (r >> 2));
+    color[1] = static_cast<float>((g << 2) | (g >> 4));
+    color[2] = static_cast<float>((b << 3) | (b >> 2));
+}
+
+// four color mode palette indices for two packed endpoints, returns the squared error
+static float bc1Indices(const float (&pixels)[16][4], uint16_t c0, uint16_t c1, uint32_t& indices) {
+    float palette[4][4];
+    unpackRGB565(c0, palette[0]);
+    unpackRGB565(c1, palette[1]);
+    for(int c=0; c<3; c++) {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+
+    float error = 0.0f;
+    indices = 0;
+    for(int i=0; i<16; i++) {
+        uint32_t best = 0;
+        float bestDistance = std::numeric_limits<float>::max();
+        for(uint32_t p=0; p<4; p++) {
+            float distance = 0.0f;
+            for(int c=0; c<3; c++) distance += (pixels[i][c] - palette[p][c]) * (pixels[i][c] - palette[p][c]);
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                best = p;
+            }
+        }
+        indices |= best << (2*i);
+        error += bestDistance;
+    }
+    return error;
+}
+
+void EncodeBC1Block(const uint8_t block[64], uint8_t out[8]) {
+    float pixels[16][4];
+    loadBlock(block, pixels);
+
+    float e0[4], e1[4];
+    fitEndpoints<3>(pixels, e0, e1);
+
+    uint16_t c0 = packRGB565(e0), c1 = packRGB565(e1);
+    uint32_t indices = 0;
+    float error = 0.0f;
+    if (c0 != c1) {
+        if (c0 < c1) std::swap(c0, c1);
+        error = bc1Indices(pixels, c0, c1, indices);
+
+        // one least squares pass on the chosen indices, kept only when it helps
+        constexpr float paletteWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+        float weights[16];
+        for(int i=0; i<16; i++) weights[i] = paletteWeights[(indices >> (2*i)) & 3];
+        float r0[4], r1[4];
+        unpackRGB565(c0, r0);
+        unpackRGB565(c1, r1);
+        refineEndpoints<3>(pixels, weights, r0, r1);
+        uint16_t rc0 = packRGB565(r0), rc1 = packRGB565(r1);
+        if (rc0 < rc1) std::swap(rc0, rc1);
+        uint32_t refinedIndices;
+        if (rc0 != rc1 && bc1Indices(pixels, rc0, rc1, refinedIndices) < error) {
+            c0 = rc0;
+            c1 = rc1;
+            indices = refinedIndices;
+        }
+    }
+
+    // c0 > c1 selects the four color mode, equal endpoints decode every index 0 to c0
+    out[0] = c0 & 0xff;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 0xff;
+    out[3] = c1 >> 8;
+    memcpy(out + 4, &indices, 4);
+}
+
+void EncodeBC4Block(const uint8_t values[16], uint8_t out[8]) {
+    uint8_t a0 = 0, a1 = 255;
+    for(int i=0; i<16; i++) {
+        a0 = std::max(a0, values[i]);
+        a1 = std::min(a1, values[i]);
+    }
+
+    uint64_t indices = 0;
+    if (a0 != a1) {
+        // a0 > a1 selects eight interpolated values
+        int palette[8] = { a0, a1 };
+        for(int p=2; p<8; p++) {
+            palette[p] = ((8 - p) * a0 + (p - 1) * a1 + 3) / 7;
+        }
+        for(int i=0; i<16; i++) {
+            uint64_t best = 0;
+            int bestDistance = 256;
+            for(int p=0; p<8; p++) {
+                const int distance = std::abs(palette[p] - values[i]);
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= best << (3*i);
+        }
+    }
+
+    out[0] = a0;
+    out[1] = a1;
+    for(int b=0; b<6; b++) {
+        out[2 + b] = static_cast<uint8_t>(indices >> (8*b));
+    }
+}
+
+void EncodeBC3Block(const uint8_t block[64], uint8_t out[16]) {
+    uint8_t alpha[16];
+    for(int i=0; i<16; i++) alpha[i] = block[4*i + 3];
+    EncodeBC4Block(alpha, out);
+    // the color half of BC3 always decodes in four color mode, which BC1 blocks produced here use
+    EncodeBC1Block(block, out + 8);
+}
+
+void EncodeBC5Block(const uint8_t block[64], uint8_t out[16]) {
+    uint8_t red[16], green[16];
+    for(int i=0; i<16; i++) {
+        red[i] = block[4*i + 0];
+        green[i] = block[4*i + 1];
+    }
+    EncodeBC4Block(red, out);
+    EncodeBC4Block(green, out + 8);
+}
+
+// little endian bit stream over a 128 bit block
+struct BlockWriter {
+    uint8_t* out;
+    uint32_t bit = 0;
+
+    void Write(uint32_t value, uint32_t bits) {
+        for(uint32_t i=0; i<bits; i++, bit++) {
+            out[bit / 8] |= ((value >> i) & 1) << (bit % 8);
+        }
+    }
+};
+
+constexpr uint32_t BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// mode 6 endpoints are 7 bits per channel plus a shared lowest bit, picks the better p-bit
+static void quantizeBC7Endpoint(const float (&endpoint)[4], uint32_t (&quantized)[4], uint32_t& pBit) {
+    float bestError = std::numeric_limits<float>::max();
+    for(uint32_t p=0; p<2; p++) {
+        float error = 0.0f;
+        uint32_t candidate[4];
+        for(int c=0; c<4; c++) {
+            const float v = std::round((endpoint[c] - p) / 2.0f);
+            candidate[c] = static_cast<uint32_t>(std::clamp(v, 0.0f, 127.0f));
+            const float decoded = static_cast<float>((candidate[c] << 1) | p);
+            error += (decoded - endpoint[c]) * (decoded - endpoint[c]);
+        }
+        if (error < bestError) {
+            bestError = error;
+            pBit = p;
+            memcpy(quantized, candidate, sizeof(candidate));
+        }
+    }
+}
+
+static float bc7Indices(const float (&pixels)[16][4], const uint32_t (&q0)[4], uint32_t p0, const uint32_t (&q1)[4], uint32_t p1, uint32_t (&indices)[16]) {
+    float palette[16][4];
+    for(int c=0; c<4; c++) {
+        const uint32_t a = (q0[c] << 1) | p0, b = (q1[c] << 1) | p1;
+        for(int w=0; w<16; w++) {
+            palette[w][c] = static_cast<float>(((64 - BC7_WEIGHTS[w]) * a + BC7_WEIGHTS[w] * b + 32) >> 6);
+        }
+    }
+
+    float error = 0.0f;
+    for(int i=0; i<16; i++) {
+        float bestDistance = std::numeric_limits<float>::max();
+        for(uint32_t w=0; w<16; w++) {
+            float distance = 0.0f;
+            for(int c=0; c<4; c++) distance += (pixels[i][c] - palette[w][c]) * (pixels[i][c] - palette[w][c]);
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                indices[i] = w;
+            }
+        }
+        error += bestDistance;
+    }
+    return error;
+}
+
+void EncodeBC7Block(const uint8_t block[64], uint8_t out[16]) {
+    float pixels[16][4];
+    loadBlock(block, pixels);
+
+    float e0[4], e1[4];
+    fitEndpoints<4>(pixels, e0, e1);
+
+    uint32_t q0[4], q1[4], p0, p1, indices[16];
+    quantizeBC7Endpoint(e0, q0, p0);
+    quantizeBC7Endpoint(e1, q1, p1);
+    float error = bc7Indices(pixels, q0, p0, q1, p1, indices);
+
+    // one least squares pass on the chosen indices, kept only when it helps
+    float weights[16];
+    for(int i=0; i<16; i++) weights[i] = BC7_WEIGHTS[indices[i]] / 64.0f;
+    refineEndpoints<4>(pixels, weights, e0, e1);
+    uint32_t rq0[4], rq1[4], rp0, rp1, refinedIndices[16];
+    quantizeBC7Endpoint(e0, rq0, rp0);
+    quantizeBC7Endpoint(e1, rq1, rp1);
+    if (bc7Indices(pixels, rq0, rp0, rq1, rp1, refinedIndices) < error) {
+        memcpy(q0, rq0, sizeof(q0));
+        memcpy(q1, rq1, sizeof(q1));
+        memcpy(indices, refinedIndices, sizeof(indices));
+        p0 = rp0;
+        p1 = rp1;
+    }
+
+    // the first index is stored without its top bit, so it has to be below 8
+    if (indices[0] & 8) {
+        std::swap(q0, q1);
+        std::swap(p0, p1);
+        for(auto& index : indices) index = 15 - index;
+    }
+
+    memset(out, 0, 16);
+    BlockWriter writer { .out = out };
+    writer.Write(1 << 6, 7);
+    for(int c=0; c<4; c++) {
+        writer.Write(q0[c], 7);
+        writer.Write(q1[c], 7);
+    }
+    writer.Write(p0, 1);
+    writer.Write(p1, 1);
+    writer.Write(indices[0], 3);
+    for(int i=1; i<16; i++) {
+        writer.Write(indices[i], 4);
+    }
+}
+
+}
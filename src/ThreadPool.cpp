@@ -0,0 +1,76 @@
+#include <ThreadPool.h>
+
+ThreadPool::ThreadPool(uint32_t threadCount) {
+    for(uint32_t i=0; i<threadCount; i++) {
+        workers.emplace_back([this]() { work(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock lock(mutex);
+        stopping = true;
+    }
+    task_available.notify_all();
+    for(auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    {
+        std::unique_lock lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    task_available.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock lock(mutex);
+    all_done.wait(lock, [this]() { return tasks.empty() && active == 0; });
+    if (error) {
+        std::rethrow_exception(std::exchange(error, nullptr));
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn) {
+    for(size_t i=0; i<count; i++) {
+        Submit([&fn, i]() { fn(i); });
+    }
+    Wait();
+}
+
+void ThreadPool::work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(mutex);
+            task_available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            active++;
+        }
+
+        std::exception_ptr taskError;
+        try {
+            task();
+        } catch (...) {
+            taskError = std::current_exception();
+        }
+
+        {
+            std::unique_lock lock(mutex);
+            // later failures are usually the same problem hit by another task, keep the first
+            if (taskError && !error) {
+                error = taskError;
+            }
+            active--;
+            if (tasks.empty() && active == 0) {
+                all_done.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,176 @@
+#include <Uploader.h>
+#include <AppBase.h>
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+Uploader::Uploader(AppBase& app, vk::DeviceSize arenaSize) : app(app), arena_size(arenaSize) {
+    arena = buffertools::CreateBufferH(app, vk::BufferUsageFlagBits::eTransferSrc, arena_size);
+    arena_data = reinterpret_cast<uint8_t*>(buffertools::MapBuffer(app, arena));
+}
+
+Uploader::~Uploader() {
+    Finish();
+    buffertools::UnmapBuffer(app, arena);
+    buffertools::DestroyBuffer(app, arena);
+}
+
+void Uploader::UploadBuffer(vk::Buffer dst, const void* data, vk::DeviceSize size, vk::DeviceSize dstOffset) {
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
+    vk::DeviceSize done = 0;
+    while (done < size) {
+        const vk::DeviceSize chunk = std::min(size - done, arena_size);
+        const vk::DeviceSize offset = allocate(chunk, 16);
+        memcpy(arena_data + offset, src + done, chunk);
+
+        vk::BufferCopy copyRegion {
+            .srcOffset = offset,
+            .dstOffset = dstOffset + done,
+            .size = chunk,
+        };
+        currentCommandBuffer().copyBuffer(arena.handle, dst, copyRegion);
+        done += chunk;
+    }
+    stats.bytes += size;
+}
+
+void Uploader::UploadImage(vk::Image dst, uint32_t width, uint32_t height, size_t texelSize, const void* data, vk::ImageLayout finalLayout) {
+    UploadImageLevel(dst, 0, width, height, 1, texelSize, data);
+    FinishImage(dst, finalLayout);
+}
+
+void Uploader::FinishImage(vk::Image dst, vk::ImageLayout finalLayout, uint32_t mipLevels) {
+    vk::tools::insertImageMemoryBarrier(currentCommandBuffer(), dst,
+            vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eMemoryRead,
+            vk::ImageLayout::eTransferDstOptimal, finalLayout,
+            vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands,
+            vk::inits::imageSubresourceRange(vk::ImageAspectFlagBits::eColor, mipLevels));
+}
+
+void Uploader::UploadImageLevel(vk::Image dst, uint32_t mipLevel, uint32_t width, uint32_t height, uint32_t blockExtent, size_t blockSize, const void* data) {
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
+    // rows are rows of blocks, copies are split on block row boundaries
+    const uint32_t blockRows = (height + blockExtent - 1) / blockExtent;
+    const vk::DeviceSize rowPitch = ((width + blockExtent - 1) / blockExtent) * blockSize;
+    if (rowPitch > arena_size) {
+        throw std::runtime_error("image row does not fit in the staging arena");
+    }
+
+    const uint32_t rowsPerChunk = static_cast<uint32_t>(std::min<vk::DeviceSize>(blockRows, arena_size / rowPitch));
+    uint32_t row = 0;
+    while (row < blockRows) {
+        const uint32_t rows = std::min(rowsPerChunk, blockRows - row);
+        const vk::DeviceSize chunk = rows * rowPitch;
+        const vk::DeviceSize offset = allocate(chunk, 16);
+        memcpy(arena_data + offset, src + row * rowPitch, chunk);
+
+        const uint32_t texelRow = row * blockExtent;
+        auto copyRegion = vk::inits::imageCopy(width, std::min(rows * blockExtent, height - texelRow), mipLevel);
+        copyRegion.bufferOffset = offset;
+        copyRegion.imageOffset = vk::Offset3D { 0, static_cast<int32_t>(texelRow), 0 };
+        currentCommandBuffer().copyBufferToImage(arena.handle, dst, vk::ImageLayout::eTransferDstOptimal, copyRegion);
+        row += rows;
+    }
+    stats.bytes += rowPitch * blockRows;
+}
+
+void Uploader::TransitionImage(vk::Image image, vk::ImageLayout oldLayout, vk::ImageLayout newLayout, uint32_t mipLevels) {
+    vk::tools::insertImageMemoryBarrier(currentCommandBuffer(), image,
+            vk::AccessFlagBits::eMemoryRead, vk::AccessFlagBits::eMemoryWrite,
+            oldLayout, newLayout,
+            vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eAllCommands,
+            vk::inits::imageSubresourceRange(vk::ImageAspectFlagBits::eColor, mipLevels));
+}
+
+void Uploader::Flush() {
+    if (!recording.has_value()) {
+        return;
+    }
+
+    // make the transfers visible to everything submitted after this batch
+    vk::MemoryBarrier barrier {
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlagBits::eMemoryRead,
+    };
+    recording->cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, {}, {barrier}, {}, {});
+
+    // reset before submitting, the app flushes us again on every submission
+    Batch batch = recording.value();
+    recording.reset();
+    batch.id = app.SubmitSingleTimeCommandBuffer(batch.cmdBuffer);
+    batch.arenaEnd = arena_head;
+    in_flight.push_back(batch);
+    stats.submissions++;
+
+    retireCompleted();
+}
+
+void Uploader::Finish() {
+    Flush();
+    while (!in_flight.empty()) {
+        retireOldest();
+    }
+
+    if (stats.submissions > 0) {
+        logger::info("Uploaded {:.2f} MiB in {} submissions, stalled for {:.2f} ms",
+                static_cast<double>(stats.bytes) / (1024.0 * 1024.0), stats.submissions, stats.stallSeconds * 1000.0);
+    }
+    stats.bytes = 0;
+    stats.submissions = 0;
+    stats.stallSeconds = 0.0;
+}
+
+vk::CommandBuffer Uploader::currentCommandBuffer() {
+    if (recording.has_value()) {
+        return recording->cmdBuffer;
+    }
+
+    Batch batch {
+        .cmdBuffer = app.AcquireSingleTimeCommandBuffer(),
+    };
+    recording = batch;
+    return batch.cmdBuffer;
+}
+
+vk::DeviceSize Uploader::allocate(vk::DeviceSize size, vk::DeviceSize alignment) {
+    assert(size <= arena_size);
+    while (true) {
+        uint64_t offset = alignUp(arena_head, alignment);
+        // allocations never straddle the end of the ring
+        if (offset % arena_size + size > arena_size) {
+            offset = alignUp(offset, arena_size);
+        }
+
+        if (offset + size - arena_tail <= arena_size) {
+            arena_head = offset + size;
+            return offset % arena_size;
+        }
+
+        // the ring is full, the staged data has to reach the gpu before we can overwrite it
+        Flush();
+        if (in_flight.empty()) {
+            arena_head = arena_tail = alignUp(arena_head, arena_size);
+        } else {
+            retireOldest();
+        }
+    }
+}
+
+void Uploader::retireOldest() {
+    auto batch = in_flight.front();
+    in_flight.pop_front();
+
+    auto start = std::chrono::steady_clock::now();
+    app.WaitForSubmission(batch.id);
+    stats.stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    arena_tail = batch.arenaEnd;
+}
+
+void Uploader::retireCompleted() {
+    while (!in_flight.empty() && app.IsSubmissionDone(in_flight.front().id)) {
+        arena_tail = in_flight.front().arenaEnd;
+        in_flight.pop_front();
+    }
+}
@@ -0,0 +1,89 @@
+#include <Vertex.h>
+
+uint32_t vertextools::Stride(VertexLayout layout) {
+    switch(layout) {
+        case VertexLayout::eFull: return sizeof(GLTFVertex);
+        case VertexLayout::ePacked: return sizeof(PackedVertex);
+        case VertexLayout::eQuantized: return sizeof(QuantizedVertex);
+    }
+    throw std::runtime_error("Unknown vertex layout");
+}
+
+vk::Format vertextools::PositionFormat(VertexLayout layout) {
+    return layout == VertexLayout::eQuantized ? vk::Format::eR16G16B16A16Snorm : vk::Format::eR32G32B32Sfloat;
+}
+
+uint32_t vertextools::OctEncode(glm::vec3 normal) {
+    // project onto the octahedron and fold the lower half over the diagonals
+    normal /= std::max(std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z), 1e-20f);
+    glm::vec2 e = glm::vec2(normal);
+    if (normal.z < 0.0f) {
+        const glm::vec2 sign = glm::vec2(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+        e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * sign;
+    }
+    return glm::packSnorm2x16(e);
+}
+
+glm::vec3 vertextools::OctDecode(uint32_t encoded) {
+    const glm::vec2 e = glm::unpackSnorm2x16(encoded);
+    glm::vec3 n = glm::vec3(e, 1.0f - std::abs(e.x) - std::abs(e.y));
+    const float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+void vertextools::Pack(VertexLayout layout, const GLTFVertex* src, size_t count, glm::vec3 scale, glm::vec3 offset, uint8_t* dst) {
+    switch(layout) {
+        case VertexLayout::eFull:
+            memcpy(dst, src, count * sizeof(GLTFVertex));
+            break;
+        case VertexLayout::ePacked: {
+            auto* out = reinterpret_cast<PackedVertex*>(dst);
+            for(size_t i=0; i<count; i++) {
+                out[i] = PackedVertex {
+                    .pos = glm::vec3(src[i].pos),
+                    .normal = OctEncode(glm::vec3(src[i].normal)),
+                    .uv = glm::packHalf2x16(glm::vec2(src[i].pos.w, src[i].normal.w)),
+                };
+            }
+            break;
+        }
+        case VertexLayout::eQuantized: {
+            auto* out = reinterpret_cast<QuantizedVertex*>(dst);
+            for(size_t i=0; i<count; i++) {
+                const glm::vec3 q = glm::clamp((glm::vec3(src[i].pos) - offset) / scale, -1.0f, 1.0f);
+                out[i] = QuantizedVertex {
+                    .pos = {
+                        static_cast<int16_t>(std::round(q.x * 32767.0f)),
+                        static_cast<int16_t>(std::round(q.y * 32767.0f)),
+                        static_cast<int16_t>(std::round(q.z * 32767.0f)),
+                        0,
+                    },
+                    .normal = OctEncode(glm::vec3(src[i].normal)),
+                    .uv = glm::packHalf2x16(glm::vec2(src[i].pos.w, src[i].normal.w)),
+                };
+            }
+            break;
+        }
+    }
+}
+
+glm::vec3 vertextools::UnpackPosition(VertexLayout layout, const uint8_t* vertex, glm::vec3 scale, glm::vec3 offset) {
+    switch(layout) {
+        case VertexLayout::eFull:
+        case VertexLayout::ePacked: {
+            // both layouts start with the float position
+            glm::vec3 pos;
+            memcpy(&pos, vertex, sizeof(glm::vec3));
+            return pos;
+        }
+        case VertexLayout::eQuantized: {
+            std::array<int16_t, 4> q;
+            memcpy(q.data(), vertex, sizeof(q));
+            const glm::vec3 pos = glm::max(glm::vec3(q[0], q[1], q[2]) / 32767.0f, -1.0f);
+            return pos * scale + offset;
+        }
+    }
+    throw std::runtime_error("Unknown vertex layout");
+}
@@ -26,6 +26,9 @@ WindowApp::~WindowApp() {
     for (auto fence : inFlightFences) {
         vk_device.destroyFence(fence);
     }
+    if (timestampPool) {
+        vk_device.destroyQueryPool(timestampPool);
+    }
     for(auto view : vk_swapchain_views) {
         vk_device.destroyImageView(view);
     }
@@ -39,22 +42,49 @@ void WindowApp::Init(WindowAppConfig config) {
     this->vk_present_queue = vk_device.getQueue(vk_present_family, 0);
     createSwapchain();
     createSyncObjects();
+    createTimestampPool();
 }
 
 Frame WindowApp::WindowFrameStart() {
+    const auto waitStart = std::chrono::steady_clock::now();
     vk::resultCheck(vk_device.waitForFences({inFlightFences[flightIdx]}, VK_TRUE, UINT64_MAX), "error waiting for fence");
-    vk_device.resetFences({inFlightFences[flightIdx]});
+    readFrameTimings(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count());
     this->imageIdx = vk_device.acquireNextImageKHR(vk_swapchain, UINT64_MAX, imageAvailableSemaphores[flightIdx]).value;
 
+    // the swapchain may hand out an image an older frame in another slot is still rendering to
+    if (imagesInFlight[imageIdx] && imagesInFlight[imageIdx] != inFlightFences[flightIdx]) {
+        vk::resultCheck(vk_device.waitForFences({imagesInFlight[imageIdx]}, VK_TRUE, UINT64_MAX), "error waiting for fence");
+    }
+    imagesInFlight[imageIdx] = inFlightFences[flightIdx];
+
+    auto cmdBuffer = commandBuffers[flightIdx];
+    cmdBuffer.reset();
+    cmdBuffer.begin(vk::CommandBufferBeginInfo { .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+    if (timestampPool) {
+        cmdBuffer.resetQueryPool(timestampPool, 2 * flightIdx, 2);
+        cmdBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestampPool, 2 * flightIdx);
+    }
+    frameStart = std::chrono::steady_clock::now();
+
     return Frame {
         .image = vk_swapchain_images[imageIdx],
         .view = vk_swapchain_views[imageIdx],
         .imageIdx = imageIdx,
         .flightIdx = flightIdx,
+        .cmdBuffer = cmdBuffer,
     };
 }
 
-void WindowApp::WindowFrameEnd(vk::CommandBuffer cmdBuffer) {
+void WindowApp::WindowFrameEnd() {
+    auto cmdBuffer = commandBuffers[flightIdx];
+    if (timestampPool) {
+        cmdBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestampPool, 2 * flightIdx + 1);
+        timestampsWritten[flightIdx] = true;
+    }
+    cmdBuffer.end();
+    cpuMs[flightIdx] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+
+    uploader->Flush();
     vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eColorAttachmentOutput;
 
     vk::SubmitInfo submitInfo {
@@ -67,6 +97,8 @@ void WindowApp::WindowFrameEnd(vk::CommandBuffer cmdBuffer) {
         .pSignalSemaphores = &renderFinishedSemaphores[flightIdx],
     };
 
+    // reset only now, an image acquired in WindowFrameStart may have waited on this fence
+    vk_device.resetFences({inFlightFences[flightIdx]});
     vk_graphics_queue.submit({submitInfo}, inFlightFences[flightIdx]);
 
     vk::PresentInfoKHR presentInfo {
@@ -172,6 +204,47 @@ void WindowApp::createSyncObjects() {
         this->renderFinishedSemaphores.push_back(vk_device.createSemaphore(semInfo));
         this->inFlightFences.push_back(vk_device.createFence(fenceInfo));
     }
+    this->imagesInFlight.resize(vk_swapchain_images.size());
+
+    vk::CommandBufferAllocateInfo allocInfo {
+        .commandPool = vk_graphics_pool,
+        .level = vk::CommandBufferLevel::ePrimary,
+        .commandBufferCount = config.framesInFlight,
+    };
+    this->commandBuffers = vk_device.allocateCommandBuffers(allocInfo);
+}
+
+void WindowApp::createTimestampPool() {
+    this->cpuMs.resize(config.framesInFlight);
+    this->timestampsWritten.resize(config.framesInFlight);
+    if (vk_physical_device.getQueueFamilyProperties()[vk_graphics_family].timestampValidBits == 0) {
+        logger::warn("The graphics queue does not support timestamps, GPU frame times are not measured");
+        return;
+    }
+
+    this->timestampPeriod = vk_physical_device.getProperties().limits.timestampPeriod;
+    vk::QueryPoolCreateInfo createInfo {
+        .queryType = vk::QueryType::eTimestamp,
+        .queryCount = 2 * config.framesInFlight,
+    };
+    this->timestampPool = vk_device.createQueryPool(createInfo);
+}
+
+void WindowApp::readFrameTimings(double waitMs) {
+    frameTimings.cpu_ms = cpuMs[flightIdx];
+    frameTimings.wait_ms = waitMs;
+    if (!timestampPool || !timestampsWritten[flightIdx]) {
+        return;
+    }
+
+    // the fence has signaled, so both timestamps are available
+    std::array<uint64_t, 2> timestamps;
+    vk::resultCheck(vk_device.getQueryPoolResults(timestampPool, 2 * flightIdx, 2, sizeof(timestamps), timestamps.data(), sizeof(uint64_t), vk::QueryResultFlagBits::e64), "error reading frame timestamps");
+    const double toMs = timestampPeriod * 1e-6;
+    frameTimings.gpu_ms = (timestamps[1] - timestamps[0]) * toMs;
+    // slots are recycled in submission order, so lastGpuEnd is the end of the frame submitted just before
+    frameTimings.gpu_idle_ms = lastGpuEnd > 0 && timestamps[0] > lastGpuEnd ? (timestamps[0] - lastGpuEnd) * toMs : 0;
+    lastGpuEnd = timestamps[1];
 }
 
 vk::SurfaceFormatKHR WindowApp::chooseSurfaceFormat() const {
@@ -1,5 +1,7 @@
 #include <precomp.h>
 #include <WindowApp.h>
+#include <OfflineApp.h>
+#include <RenderServer.h>
 #include <GraphicsPipelineConfig.h>
 #include <GraphicsPipeline.h>
 #include <Vertex.h>
@@ -8,6 +10,8 @@
 #include <RenderPass.h>
 #include <Camera.h>
 #include <Scene.h>
+#include <MaterialOverrides.h>
+#include <SampleBudget.h>
 
 constexpr uint32_t WINDOW_WIDTH = 1920;
 constexpr uint32_t WINDOW_HEIGHT = 1080;
@@ -22,7 +26,7 @@ constexpr WindowAppConfig windowConfig {
     .width = WINDOW_WIDTH,
     .height = WINDOW_HEIGHT,
     .name = "Vulkan App",
-    .framesInFlight = 1,
+    .framesInFlight = 2,
 };
 
 uint32_t wang_hash(uint32_t seed)
@@ -47,19 +51,556 @@ float randf() {
     return randi32() * 2.3283064365387e-10f;
 }
 
+// loads filename with the mesh settings of the command line and applies the material overrides, which are left in
+// materialOverrides for picking up later edits. setup runs before the load, for the settings a benchmark compares.
+void loadScene(Scene& scene, std::optional<MaterialOverrides>& materialOverrides, const std::string& filename, const std::string& materialsPath,
+        VertexLayout vertexLayout, bool optimizeMeshes, const std::function<void(Scene&)>& setup = {}) {
+    scene.vertex_layout = vertexLayout;
+    scene.optimize_meshes = optimizeMeshes;
+    if (setup) {
+        setup(scene);
+    }
+    scene.LoadModel(filename.c_str(), true);
+    materialOverrides.emplace(scene, materialsPath);
+    materialOverrides->Poll();
+}
+
+// the scene and settings every benchmark starts from, taken from the command line
+struct BenchmarkFixture {
+    AppBase& app;
+    const char* filename;
+    const char* materialOverridesPath;
+    VertexLayout vertexLayout;
+    bool optimizeMeshes;
+
+    // loads the scene with the material overrides applied, setup runs before the load for the settings the compared
+    // sides differ in
+    void Load(Scene& scene, const std::function<void(Scene&)>& setup = {}) const {
+        std::optional<MaterialOverrides> materialOverrides;
+        loadScene(scene, materialOverrides, filename, materialOverridesPath, vertexLayout, optimizeMeshes, setup);
+    }
+
+    // every pixel keeps sampling, so both sides of a comparison trace the same work
+    RTXConfig Config() const {
+        return RTXConfig {
+            .width = WINDOW_WIDTH,
+            .height = WINDOW_HEIGHT,
+            .adaptiveSampling = false,
+        };
+    }
+};
+
+// times a full glTF parse against loading the same model from the scene cache
+void benchmarkSceneLoad(const BenchmarkFixture& fixture) {
+    auto timeLoad = [&](bool useCache) {
+        Scene scene(fixture.app);
+        auto start = std::chrono::steady_clock::now();
+        fixture.Load(scene, [&](Scene& loading) {
+            if (!useCache) {
+                loading.cache_directory = nullptr;
+            }
+        });
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    // the first cached load writes the cache if it is missing or stale
+    timeLoad(true);
+    const double gltfMs = timeLoad(false);
+    const double cacheMs = timeLoad(true);
+    logger::info("Scene load benchmark for {}: glTF {:.2f} ms, scene cache {:.2f} ms ({:.1f}x)", fixture.filename, gltfMs, cacheMs, gltfMs / cacheMs);
+}
+
+// loads and renders a model with and without the mesh optimization pass, caches are bypassed so both sides do the full work
+void benchmarkMeshOptimization(const BenchmarkFixture& fixture, const Camera& camera) {
+    struct Result {
+        double buildMs;
+        vk::DeviceSize blasBytes;
+        double raysPerSecond;
+    };
+
+    auto run = [&](bool optimize) {
+        Scene scene(fixture.app);
+        fixture.Load(scene, [&](Scene& loading) {
+            loading.cache_directory = nullptr;
+            loading.optimize_meshes = optimize;
+        });
+
+        RTXConfig config = fixture.Config();
+        config.accelerationStructureCache = nullptr;
+        RTX rtx(fixture.app, scene, config);
+        // the first launches warm up caches and clocks
+        rtx.BenchmarkTrace(camera, 8);
+        const Result result {
+            .buildMs = rtx.blas_stats.build_ms,
+            .blasBytes = rtx.blas_stats.compacted_bytes,
+            .raysPerSecond = rtx.BenchmarkTrace(camera, 64),
+        };
+        rtx.Destroy();
+        return result;
+    };
+
+    const Result off = run(false);
+    const Result on = run(true);
+    logger::info("Mesh optimization benchmark for {}: BLAS build {:.2f} -> {:.2f} ms, BLAS size {:.2f} -> {:.2f} MiB, {:.1f} -> {:.1f} Mrays/s (primary)",
+            fixture.filename, off.buildMs, on.buildMs, off.blasBytes / (1024.0 * 1024.0), on.blasBytes / (1024.0 * 1024.0),
+            off.raysPerSecond * 1e-6, on.raysPerSecond * 1e-6);
+}
+
+// RMS luminance difference of two accumulation images, every pixel is divided by its sample count first
+double rmsDifference(const std::vector<glm::vec4>& a, const std::vector<glm::vec4>& b) {
+    double squaredError = 0;
+    for(size_t i=0; i<a.size(); i++) {
+        const float la = lighttools::Luminance(glm::vec3(a[i]) / std::max(a[i].w, 1.0f));
+        const float lb = lighttools::Luminance(glm::vec3(b[i]) / std::max(b[i].w, 1.0f));
+        squaredError += double(la - lb) * (la - lb);
+    }
+    return std::sqrt(squaredError / a.size());
+}
+
+// renders the same view with and without next event estimation for equal wall time and compares the noise,
+// which is measured as the difference between two independent accumulations so no reference image is needed
+void benchmarkNextEvent(const BenchmarkFixture& fixture, const Camera& camera, double seconds) {
+    struct Result {
+        uint32_t frames;
+        double noise;
+    };
+
+    Scene scene(fixture.app);
+    fixture.Load(scene);
+
+    auto run = [&](bool nextEvent) {
+        RTXConfig config = fixture.Config();
+        config.nextEventEstimation = nextEvent;
+        RTX rtx(fixture.app, scene, config);
+        rtx.BenchmarkTrace(camera, 8);
+
+        std::array<std::vector<glm::vec4>, 2> images;
+        uint32_t frames = 0;
+        for(auto& image : images) {
+            frames = 0;
+            const auto start = std::chrono::steady_clock::now();
+            while (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < seconds) {
+                rtx.BenchmarkTrace(camera, 4, frames + 1);
+                frames += 4;
+            }
+            image = rtx.ReadStorageImage();
+        }
+        rtx.Destroy();
+
+        // the difference of two independent estimates has twice the variance of either
+        return Result {
+            .frames = frames,
+            .noise = rmsDifference(images[0], images[1]) / std::sqrt(2.0),
+        };
+    };
+
+    const Result off = run(false);
+    const Result on = run(true);
+    logger::info("Next event estimation benchmark for {} at {:.1f} s per image: {} -> {} frames, RMS noise {:.5f} -> {:.5f} ({:.2f}x lower variance)",
+            fixture.filename, seconds, off.frames, on.frames, off.noise, on.noise, (off.noise * off.noise) / std::max(on.noise * on.noise, 1e-20));
+}
+
+// time to equal error with and without sampling the skybox directly. A long render with it on is the reference,
+// the error sampling off reaches within seconds of tracing is the target the other side has to match.
+void benchmarkEnvironmentSampling(const BenchmarkFixture& fixture, const Camera& camera, double seconds) {
+    Scene scene(fixture.app);
+    fixture.Load(scene);
+    RTX rtx(fixture.app, scene, fixture.Config());
+
+    // traces from a fresh accumulation until done returns true, only tracing counts towards the returned time
+    auto accumulate = [&](const std::function<bool(double)>& done) {
+        uint32_t frames = 0;
+        double traced = 0;
+        while (!done(traced)) {
+            const auto start = std::chrono::steady_clock::now();
+            rtx.BenchmarkTrace(camera, 4, frames + 1);
+            traced += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            frames += 4;
+        }
+        return traced;
+    };
+
+    rtx.SetEnvironmentSampling(true);
+    accumulate([&](double traced) { return traced >= 20 * seconds; });
+    const auto reference = rtx.ReadStorageImage();
+
+    rtx.SetEnvironmentSampling(false);
+    const double offSeconds = accumulate([&](double traced) { return traced >= seconds; });
+    const double target = rmsDifference(rtx.ReadStorageImage(), reference);
+
+    rtx.SetEnvironmentSampling(true);
+    double error = 0;
+    const double onSeconds = accumulate([&](double traced) {
+        if (traced == 0) {
+            return false;
+        }
+        error = rmsDifference(rtx.ReadStorageImage(), reference);
+        return error <= target || traced >= 4 * seconds;
+    });
+    rtx.Destroy();
+
+    logger::info("Environment sampling benchmark for {}: RMSE {:.5f} after {:.2f} s without, {:.5f} after {:.2f} s with ({:.2f}x faster)",
+            fixture.filename, target, offSeconds, error, onSeconds, offSeconds / onSeconds);
+}
+
+// convergence curves of the sample sequences: RMSE at every power of two samples per pixel against a long render
+// with the random sequence, which is independent of the Sobol samples so it does not flatter them
+void benchmarkSampleSequences(const BenchmarkFixture& fixture, const Camera& camera, uint32_t maxSamples) {
+    Scene scene(fixture.app);
+    fixture.Load(scene);
+    RTX rtx(fixture.app, scene, fixture.Config());
+
+    rtx.SetSampleSequence(SampleSequence::eRandom);
+    rtx.BenchmarkTrace(camera, 16 * maxSamples, 1);
+    const auto reference = rtx.ReadStorageImage();
+
+    auto curve = [&](SampleSequence sequence) {
+        rtx.SetSampleSequence(sequence);
+        std::vector<double> errors;
+        uint32_t samples = 0;
+        for(uint32_t target=1; target<=maxSamples; target*=2) {
+            // tick 1 restarts the accumulation, every tick after adds one sample
+            rtx.BenchmarkTrace(camera, target - samples, samples + 1);
+            samples = target;
+            errors.push_back(rmsDifference(rtx.ReadStorageImage(), reference));
+        }
+        return errors;
+    };
+
+    const auto random = curve(SampleSequence::eRandom);
+    const auto sobol = curve(SampleSequence::eSobol);
+    rtx.Destroy();
+
+    logger::info("Sample sequence convergence for {} (RMSE against {} random samples):", fixture.filename, 16 * maxSamples);
+    for(size_t i=0; i<random.size(); i++) {
+        logger::info("{:>6} spp: random {:.5f}, sobol {:.5f}", 1u << i, random[i], sobol[i]);
+    }
+}
+
+// trace throughput and texture memory with the scene's textures uncompressed and block compressed
+void benchmarkTextureEncoding(const BenchmarkFixture& fixture, const Camera& camera, uint32_t frames) {
+    struct Result {
+        size_t texture_bytes = 0;
+        double rays_per_second;
+    };
+
+    auto run = [&](texturetools::Encoding encoding) {
+        Scene scene(fixture.app);
+        fixture.Load(scene, [&](Scene& loading) {
+            loading.texture_encoding = encoding;
+            // the scene cache only holds one encoding, going through it would rewrite it on every run
+            loading.cache_directory = nullptr;
+        });
+
+        Result result;
+        for(const auto& texture : scene.textures) {
+            result.texture_bytes += texture.Data().size();
+        }
+        RTX rtx(fixture.app, scene, fixture.Config());
+        rtx.BenchmarkTrace(camera, 8);
+        result.rays_per_second = rtx.BenchmarkTrace(camera, frames);
+        rtx.Destroy();
+        return result;
+    };
+
+    if (!fixture.app.vk_physical_device.getFeatures().textureCompressionBC) {
+        logger::warn("Texture encoding benchmark: the device cannot sample BC textures, both runs would be uncompressed");
+        return;
+    }
+    const Result uncompressed = run(texturetools::Encoding::eUncompressed);
+    const Result compressed = run(texturetools::Encoding::eBC7);
+    logger::info("Texture encoding benchmark for {}: RGBA8 {:.2f} MiB at {:.2f} Mrays/s, BC7/BC5 {:.2f} MiB at {:.2f} Mrays/s ({:.2f}x)",
+            fixture.filename, uncompressed.texture_bytes / (1024.0 * 1024.0), uncompressed.rays_per_second * 1e-6,
+            compressed.texture_bytes / (1024.0 * 1024.0), compressed.rays_per_second * 1e-6, compressed.rays_per_second / uncompressed.rays_per_second);
+}
+
+// throughput of rendering a ring of views around camera one launch at a time against all of them in one launch
+void benchmarkCameraBatch(const BenchmarkFixture& fixture, const Camera& camera, uint32_t cameraCount, uint32_t frames) {
+    Scene scene(fixture.app);
+    fixture.Load(scene);
+
+    RTXConfig config = fixture.Config();
+    config.width = 256;
+    config.height = 256;
+    config.cameraCount = cameraCount;
+    RTX rtx(fixture.app, scene, config);
+
+    std::vector<Camera> cameras(cameraCount, camera);
+    for(uint32_t i=0; i<cameraCount; i++) {
+        cameras[i].phi += glm::two_pi<float>() * i / cameraCount;
+    }
+    rtx.BenchmarkTrace(cameras, 4);
+
+    const auto sequentialStart = std::chrono::steady_clock::now();
+    for(const auto& view : cameras) {
+        rtx.BenchmarkTrace(view, frames);
+    }
+    const double sequentialSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - sequentialStart).count();
+    const double batched = rtx.BenchmarkTrace(cameras, frames);
+    rtx.Destroy();
+
+    const double sequential = double(config.width) * config.height * cameraCount * frames * config.samplesPerLaunch / sequentialSeconds;
+    logger::info("Camera batch benchmark for {} with {} cameras at {}x{}: {:.2f} Mrays/s one at a time, {:.2f} Mrays/s batched ({:.2f}x)",
+            fixture.filename, cameraCount, config.width, config.height, sequential * 1e-6, batched * 1e-6, batched / sequential);
+}
+
+double secondsSince(std::chrono::steady_clock::time_point from) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - from).count();
+}
+
+// traces the job's views on an RTX already sized for them until the sample count or time budget runs out and writes one image per view
+RenderResult traceJob(RTX& rtx, const OfflineJob& job) {
+    if (job.spp == 0 && job.seconds <= 0) {
+        throw std::runtime_error("An offline job needs a sample count or a time budget");
+    }
+
+    const std::vector<Camera> cameras = job.Cameras();
+
+    // launches of about half a second keep the time budget tight, software drivers may not manage more than one sample in that
+    SampleBudget sampleBudget(0.5);
+    uint32_t samples = 0;
+    uint32_t tick = 1;
+    const auto traceStart = std::chrono::steady_clock::now();
+    while ((job.spp == 0 || samples < job.spp) && (job.seconds <= 0 || secondsSince(traceStart) < job.seconds)) {
+        const uint32_t launch = job.spp > 0 ? std::min(sampleBudget.SamplesPerLaunch(), job.spp - samples) : sampleBudget.SamplesPerLaunch();
+        rtx.SetSamplesPerLaunch(launch);
+        const auto launchStart = std::chrono::steady_clock::now();
+        rtx.BenchmarkTrace(cameras, 1, tick++);
+        sampleBudget.Update(secondsSince(launchStart));
+        samples += launch;
+    }
+    const double traceSeconds = secondsSince(traceStart);
+
+    // one layer per camera, one after the other
+    const auto accumulation = rtx.ReadStorageImage();
+    const size_t layerSize = size_t(job.width) * job.height;
+    for(size_t c=0; c<cameras.size(); c++) {
+        HostImage image {
+            .width = job.width,
+            .height = job.height,
+            .pixels = std::vector<float>(layerSize * 4),
+        };
+        for(size_t i=0; i<layerSize; i++) {
+            const glm::vec4& accumulated = accumulation[c * layerSize + i];
+            const glm::vec3 color = glm::vec3(accumulated) / std::max(accumulated.w, 1.0f);
+            image.pixels[4*i+0] = color.r;
+            image.pixels[4*i+1] = color.g;
+            image.pixels[4*i+2] = color.b;
+            image.pixels[4*i+3] = 1.0f;
+        }
+        ImageTools::WriteImageH(job.OutputPath(c), image);
+    }
+    return RenderResult { .samples = samples, .cameras = static_cast<uint32_t>(cameras.size()), .trace_seconds = traceSeconds };
+}
+
+// renders a single view without a window and exits
+void renderOffline(AppBase& app, const OfflineJob& job, RTXConfig config, VertexLayout vertexLayout, bool optimizeMeshes) {
+    const auto start = std::chrono::steady_clock::now();
+    Scene scene(app);
+    std::optional<MaterialOverrides> materialOverrides;
+    loadScene(scene, materialOverrides, job.scene, job.materials, vertexLayout, optimizeMeshes);
+
+    config.width = job.width;
+    config.height = job.height;
+    config.cameraCount = static_cast<uint32_t>(job.Cameras().size());
+    RTX rtx(app, scene, config);
+    scene.ReleaseTexturePixels();
+    const RenderResult result = traceJob(rtx, job);
+    rtx.Destroy();
+
+    // converged tiles stop early with adaptive sampling, so the rate counts the samples that were launched
+    logger::info("Rendered {} from {} camera(s) at {} spp to {}: {:.2f} s total, {:.2f} s tracing, {:.2f} Msamples/s ({:.1f} spp/s)",
+            job.scene, result.cameras, result.samples, job.output, secondsSince(start), result.trace_seconds,
+            double(job.width) * job.height * result.cameras * result.samples / result.trace_seconds * 1e-6, result.samples / result.trace_seconds);
+}
+
+// loads the defaults' scene once and renders jobs from socketPath against it into outputDirectory until a client
+// asks to shut down
+void serveJobs(AppBase& app, const std::filesystem::path& socketPath, const std::filesystem::path& outputDirectory, const OfflineJob& defaults, RTXConfig config, VertexLayout vertexLayout, bool optimizeMeshes) {
+    Scene scene(app);
+    std::optional<MaterialOverrides> materialOverrides;
+    loadScene(scene, materialOverrides, defaults.scene, defaults.materials, vertexLayout, optimizeMeshes);
+
+    config.width = defaults.width;
+    config.height = defaults.height;
+    config.cameraCount = static_cast<uint32_t>(defaults.Cameras().size());
+    RTX rtx(app, scene, config);
+    scene.ReleaseTexturePixels();
+
+    {
+        RenderServer server(socketPath, outputDirectory, defaults);
+        server.Run([&](const OfflineJob& job) {
+            if (job.scene != defaults.scene) {
+                throw std::runtime_error(fmt::format("The server has {} loaded, not {}", defaults.scene, job.scene));
+            }
+            // the materials file of the server applies to every job, edits to it are picked up in between
+            if (materialOverrides->Poll()) {
+                rtx.UpdateMaterials();
+            }
+            rtx.Resize(job.width, job.height, static_cast<uint32_t>(job.Cameras().size()));
+            return traceJob(rtx, job);
+        });
+    }
+    rtx.Destroy();
+}
 
 int main(int argc, char** argv) {
     logger::set_level(logger::level::debug);
 
+    bool hostBuild = false;
+    bool benchmarkBuilds = false;
+    bool benchmarkScene = false;
+    bool benchmarkMeshes = false;
+    bool optimizeMeshes = true;
+    bool nextEvent = true;
+    bool benchmarkNextEvents = false;
+    bool benchmarkEnvironment = false;
+    bool environmentSampling = true;
+    bool benchmarkSequences = false;
+    bool benchmarkCameras = false;
+    bool benchmarkTextures = false;
+    SampleSequence sampleSequence = SampleSequence::eSobol;
+    bool adaptiveSampling = true;
+    bool temporalReprojection = true;
+    // frame time targets while navigating and once the camera has been still for a second, --spp fixes the samples instead
+    double interactiveMs = 16.0;
+    double convergeMs = 250.0;
+    uint32_t fixedSamples = 0;
+    // 1 serializes CPU and GPU, which is the baseline the frame timings of the default are compared against
+    uint32_t framesInFlight = windowConfig.framesInFlight;
+    const char* materialOverridesPath = "materials.json";
+    VertexLayout vertexLayout = VertexLayout::eQuantized;
+    // --offline renders job without opening a window, --job loads it from a file and later arguments override that.
+    // --serve takes jobs from a Unix socket instead, job is then the default for what they leave out and their outputs
+    // go below --output-dir.
+    bool offline = false;
+    const char* socketPath = nullptr;
+    const char* outputDirectory = "renders";
+    OfflineJob job;
+    for(int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--host-build") == 0) hostBuild = true;
+        if (strcmp(argv[i], "--bench-as") == 0) benchmarkBuilds = true;
+        if (strcmp(argv[i], "--bench-scene") == 0) benchmarkScene = true;
+        if (strcmp(argv[i], "--bench-mesh-opt") == 0) benchmarkMeshes = true;
+        if (strcmp(argv[i], "--no-mesh-opt") == 0) optimizeMeshes = false;
+        if (strcmp(argv[i], "--no-nee") == 0) nextEvent = false;
+        if (strcmp(argv[i], "--bench-nee") == 0) benchmarkNextEvents = true;
+        if (strcmp(argv[i], "--no-env-sampling") == 0) environmentSampling = false;
+        if (strcmp(argv[i], "--bench-env") == 0) benchmarkEnvironment = true;
+        if (strcmp(argv[i], "--random-sampler") == 0) sampleSequence = SampleSequence::eRandom;
+        if (strcmp(argv[i], "--bench-sampler") == 0) benchmarkSequences = true;
+        if (strcmp(argv[i], "--bench-cameras") == 0) benchmarkCameras = true;
+        if (strcmp(argv[i], "--bench-textures") == 0) benchmarkTextures = true;
+        if (strcmp(argv[i], "--no-adaptive") == 0) adaptiveSampling = false;
+        if (strcmp(argv[i], "--no-reprojection") == 0) temporalReprojection = false;
+        if (strcmp(argv[i], "--frame-ms") == 0 && i+1 < argc) interactiveMs = atof(argv[++i]);
+        // 0 keeps the interactive target while the view is still
+        if (strcmp(argv[i], "--converge-ms") == 0 && i+1 < argc) convergeMs = atof(argv[++i]);
+        if (strcmp(argv[i], "--spp") == 0 && i+1 < argc) fixedSamples = static_cast<uint32_t>(atoi(argv[++i]));
+        if (strcmp(argv[i], "--frames-in-flight") == 0 && i+1 < argc) {
+            const int frames = atoi(argv[++i]);
+            if (frames < 1 || frames > 8) {
+                throw std::runtime_error(fmt::format("--frames-in-flight {} is out of range, expected 1 to 8", argv[i]));
+            }
+            framesInFlight = static_cast<uint32_t>(frames);
+        }
+        if (strcmp(argv[i], "--materials") == 0 && i+1 < argc) {
+            materialOverridesPath = argv[++i];
+            job.materials = materialOverridesPath;
+        }
+        if (strcmp(argv[i], "--offline") == 0) offline = true;
+        if (strcmp(argv[i], "--serve") == 0 && i+1 < argc) { offline = true; socketPath = argv[++i]; }
+        if (strcmp(argv[i], "--job") == 0 && i+1 < argc) { offline = true; job.Load(argv[++i]); }
+        if (strcmp(argv[i], "--scene") == 0 && i+1 < argc) job.scene = argv[++i];
+        if (strcmp(argv[i], "--output") == 0 && i+1 < argc) job.output = argv[++i];
+        if (strcmp(argv[i], "--output-dir") == 0 && i+1 < argc) outputDirectory = argv[++i];
+        if (strcmp(argv[i], "--width") == 0 && i+1 < argc) job.width = static_cast<uint32_t>(atoi(argv[++i]));
+        if (strcmp(argv[i], "--height") == 0 && i+1 < argc) job.height = static_cast<uint32_t>(atoi(argv[++i]));
+        if (strcmp(argv[i], "--eye") == 0 && i+3 < argc) {
+            for(int c=0; c<3; c++) job.eye[c] = static_cast<float>(atof(argv[++i]));
+        }
+        if (strcmp(argv[i], "--theta") == 0 && i+1 < argc) job.theta = static_cast<float>(atof(argv[++i]));
+        if (strcmp(argv[i], "--phi") == 0 && i+1 < argc) job.phi = static_cast<float>(atof(argv[++i]));
+        if (strcmp(argv[i], "--fov") == 0 && i+1 < argc) job.fov = static_cast<float>(atof(argv[++i]));
+        if (strcmp(argv[i], "--target-spp") == 0 && i+1 < argc) job.spp = static_cast<uint32_t>(atoi(argv[++i]));
+        if (strcmp(argv[i], "--seconds") == 0 && i+1 < argc) job.seconds = atof(argv[++i]);
+        // --vertex-layout full|packed|quantized, full is the original 32 byte vertex
+        if (strcmp(argv[i], "--vertex-layout") == 0 && i+1 < argc) {
+            i++;
+            if (strcmp(argv[i], "full") == 0) vertexLayout = VertexLayout::eFull;
+            else if (strcmp(argv[i], "packed") == 0) vertexLayout = VertexLayout::ePacked;
+            else if (strcmp(argv[i], "quantized") == 0) vertexLayout = VertexLayout::eQuantized;
+            else throw std::runtime_error(fmt::format("Unknown vertex layout {}, expected full, packed or quantized", argv[i]));
+        }
+    }
+
+    if (offline) {
+        OfflineApp app;
+        app.Require<RTX>();
+        if (hostBuild) {
+            app.Require<RTXHostBuild>();
+        }
+        app.Init();
+        const RTXConfig offlineConfig {
+            .hostBuild = hostBuild,
+            .nextEventEstimation = nextEvent,
+            .environmentSampling = environmentSampling,
+            .sampleSequence = sampleSequence,
+            .adaptiveSampling = adaptiveSampling,
+        };
+        if (socketPath) {
+            serveJobs(app, socketPath, outputDirectory, job, offlineConfig, vertexLayout, optimizeMeshes);
+        } else {
+            renderOffline(app, job, offlineConfig, vertexLayout, optimizeMeshes);
+        }
+        return 0;
+    }
+
     WindowApp app;
     app.Require<RTX>();
-    app.Init(windowConfig);
+    if (hostBuild || benchmarkBuilds) {
+        app.Require<RTXHostBuild>();
+    }
+    WindowAppConfig appConfig = windowConfig;
+    appConfig.framesInFlight = framesInFlight;
+    app.Init(appConfig);
 
     Camera camera(app.glfw_window);
     camera.eye.y = 5;
     camera.eye.x = -5;
 
+    const BenchmarkFixture fixture {
+        .app = app,
+        .filename = job.scene.c_str(),
+        .materialOverridesPath = materialOverridesPath,
+        .vertexLayout = vertexLayout,
+        .optimizeMeshes = optimizeMeshes,
+    };
+    if (benchmarkScene) {
+        benchmarkSceneLoad(fixture);
+    }
+    if (benchmarkMeshes) {
+        benchmarkMeshOptimization(fixture, camera);
+    }
+    if (benchmarkNextEvents) {
+        benchmarkNextEvent(fixture, camera, 10.0);
+    }
+    if (benchmarkEnvironment) {
+        benchmarkEnvironmentSampling(fixture, camera, 5.0);
+    }
+    if (benchmarkSequences) {
+        benchmarkSampleSequences(fixture, camera, 256);
+    }
+    if (benchmarkTextures) {
+        benchmarkTextureEncoding(fixture, camera, 64);
+    }
+    if (benchmarkCameras) {
+        benchmarkCameraBatch(fixture, camera, 16, 16);
+    }
+
     Scene scene(app);
+    scene.vertex_layout = vertexLayout;
+    scene.optimize_meshes = optimizeMeshes;
 //    {
 //        scene.LoadModel("models/rungholt.glb", true);
 //    }
@@ -84,12 +625,8 @@ int main(int argc, char** argv) {
 //          scene.LoadModel("models/sibenik.glb", true);
       }
       {
+          // material tweaks for bistro live in materials.json and are picked up while running
           scene.LoadModel("models/bistro.glb", true);
-          scene.meshes.back().primitives[33].material.roughness = 0.4;
-//          scene.meshes.back().primitives[38].material.emission = 0.0f * glm::vec4(4, 2, 3,0);
-//          scene.meshes.back().primitives[39].material.emission = 0.0f * glm::vec4(2, 1, 1.5,0);
-          scene.meshes.back().primitives[8].material.diffuse_color.w = 0.0f;
-          scene.meshes.back().primitives[8].material.glass.w = 1.46f;
       }
 
 //    scene.LoadModel("models/fireplace_room.glb", true);
@@ -123,9 +660,26 @@ int main(int argc, char** argv) {
     RTXConfig rtxConfig {
         .width = WINDOW_WIDTH,
         .height = WINDOW_HEIGHT,
+        .hostBuild = hostBuild,
+        .framesInFlight = framesInFlight,
+        // a slot more than there are frames, so the one written next is never still being read
+        .materialSlots = framesInFlight + 1,
+        .nextEventEstimation = nextEvent,
+        .environmentSampling = environmentSampling,
+        .sampleSequence = sampleSequence,
+        .adaptiveSampling = adaptiveSampling,
+        .temporalReprojection = temporalReprojection,
+        .samplesPerLaunch = std::max(fixedSamples, 1u),
     };
 
+    MaterialOverrides materialOverrides(scene, materialOverridesPath);
+    materialOverrides.Poll();
+
     RTX rtx(app, scene, rtxConfig);
+    scene.ReleaseTexturePixels();
+    if (benchmarkBuilds) {
+        rtx.BenchmarkBLASBuilds();
+    }
 
     auto rtxSampler = rtx.CreateStorageImageSampler();
 
@@ -166,37 +720,60 @@ int main(int argc, char** argv) {
         app.vk_device.updateDescriptorSets({write}, {});
     }
 
-    vk::CommandBuffer cmdBuffer = app.MakeGraphicsCommandBuffer();
+    SampleBudget sampleBudget = fixedSamples > 0 ? SampleBudget(interactiveMs * 1e-3, fixedSamples, fixedSamples) : SampleBudget(interactiveMs * 1e-3);
+    double lastMove = glfwGetTime();
 
     uint32_t tick = 0;
     double ping = glfwGetTime();
     float lastFrameTime = static_cast<float>(glfwGetTime());
     while(!app.WindowShouldClose()) {
         double pong = glfwGetTime();
-        if (tick % 500 == 0) {
-            logger::info("FPS: {}", 1.0 / (pong - ping));
+        rtx.SetSamplesPerLaunch(sampleBudget.Update(pong - ping));
+        const bool report = tick % 500 == 0;
+        if (report) {
+            logger::info("FPS: {}, {} samples per launch, {:.1f} samples per pixel per second",
+                    1.0 / (pong - ping), sampleBudget.SamplesPerLaunch(), sampleBudget.SamplesPerSecond());
+            const auto& timings = app.LastFrameTimings();
+            logger::info("Frame: CPU {:.2f} ms, GPU {:.2f} ms, GPU idle {:.2f} ms before it, {:.2f} ms waiting for the GPU",
+                    timings.cpu_ms, timings.gpu_ms, timings.gpu_idle_ms, timings.wait_ms);
         }
         ping = pong;
         glfwPollEvents();
         tick++;
+        // tick 1 restarts the accumulation, a camera move carries over what still lines up with the new view
+        bool reproject = false;
         if (camera.getHasMoved()) {
-            tick = 0;
+            tick = 1;
+            reproject = true;
+            lastMove = pong;
+        }
+        sampleBudget.SetTarget((pong - lastMove < 1.0 || convergeMs <= 0 ? interactiveMs : convergeMs) * 1e-3);
+        // material edits invalidate what has been accumulated so far
+        if (materialOverrides.Poll()) {
+            rtx.UpdateMaterials();
+            tick = 1;
+            reproject = false;
         }
         float currentTime = static_cast<float>(glfwGetTime());
         float dt = currentTime - lastFrameTime;
         lastFrameTime = currentTime;
         camera.update(dt);
         auto frame = app.WindowFrameStart();
-
-        cmdBuffer.reset();
-        cmdBuffer.begin(vk::CommandBufferBeginInfo());
+        vk::CommandBuffer cmdBuffer = frame.cmdBuffer;
+        // the slot's fence has signaled, so its copy of the stats is no longer written to
+        if (report && adaptiveSampling) {
+            // converged tiles make samples cheaper, so the estimate errs on the long side
+            const auto convergence = rtx.Convergence(frame.flightIdx);
+            logger::info("Converged: {:.1f}% of tiles, about {:.1f} s to the target noise",
+                    100.0 * convergence.converged_tiles / rtx.TileCount(), convergence.remaining_samples / std::max(sampleBudget.SamplesPerSecond(), 1e-6));
+        }
 
         vk::tools::insertImageMemoryBarrier(cmdBuffer, rtx.storage_image.handle, 
                 vk::AccessFlagBits::eShaderRead, vk::AccessFlagBits::eMemoryWrite,
                 vk::ImageLayout::eReadOnlyOptimal, vk::ImageLayout::eGeneral,
                 vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eRayTracingShaderKHR,
                 vk::inits::imageSubresourceRange(vk::ImageAspectFlagBits::eColor));
-        rtx.Record(cmdBuffer, tick, camera);
+        rtx.Record(cmdBuffer, frame.flightIdx, tick, camera, reproject);
         vk::tools::insertImageMemoryBarrier(cmdBuffer, rtx.storage_image.handle,
                 vk::AccessFlagBits::eMemoryWrite, vk::AccessFlagBits::eShaderRead,
                 vk::ImageLayout::eGeneral, vk::ImageLayout::eShaderReadOnlyOptimal,
@@ -229,8 +806,7 @@ int main(int argc, char** argv) {
         cmdBuffer.draw(3, 1, 0, 0);
         cmdBuffer.endRenderPass();
 
-        cmdBuffer.end();
-        app.WindowFrameEnd(cmdBuffer);
+        app.WindowFrameEnd();
     }
 
     app.vk_device.waitIdle();